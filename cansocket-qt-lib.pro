@@ -6,4 +6,6 @@ lessThan(QT_MAJOR_VERSION, 5) | lessThan(QT_MINOR_VERSION, 5) {
 requires(linux)
 load(configure)
 qtCompileTest(isotp)
+qtCompileTest(iouring)
+qtCompileTest(sdt)
 load(qt_parts)
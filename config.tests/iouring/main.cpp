@@ -0,0 +1,29 @@
+/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+
+int main()
+{
+    // provided buffer rings and multishot receive
+    struct io_uring_buf_reg reg;
+    reg.bgid = 0;
+    (void)reg;
+    return IORING_RECV_MULTISHOT + IORING_REGISTER_PBUF_RING + __NR_io_uring_setup;
+}
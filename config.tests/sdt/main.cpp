@@ -0,0 +1,27 @@
+/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <sys/sdt.h>
+
+int main()
+{
+    // USDT probes of the trace points
+    int value = 0;
+    DTRACE_PROBE3(cansocket, test, value, value, value);
+    return value;
+}
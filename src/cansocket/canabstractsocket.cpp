@@ -19,6 +19,10 @@
 #include "canabstractsocket.h"
 #include "canabstractsocket_p.h"
 #include "canframe_p.h"
+#include "caniouring_p.h"
+#include "canreceivethread_p.h"
+#include "cansocketreactor_p.h"
+#include "cansockettrace_p.h"
 
 #include <QtCore/qelapsedtimer.h>
 #include <QtCore/qsocketnotifier.h>
@@ -31,6 +35,10 @@
 #   error Unsupported OS
 #endif
 
+#define CAN_IOURING_RECEIVE_BUFFERS 64 // provided buffers, one received unit each
+#define CAN_IOURING_MAX_SENDS 32 // linked sends per submission
+#define CAN_RECEIVE_QUEUE_DEFAULT_SIZE 262144 // bytes queued by the receive thread
+
 /*!
     \class CanAbstractSocket
 
@@ -64,6 +72,17 @@ CanAbstractSocket::~CanAbstractSocket()
         close();
 }
 
+/*!
+    Connects the socket to the interface \a interfaceName and opens it in
+    \a mode.
+
+    With QIODevice::Unbuffered, read() takes the frames straight from the
+    socket into the memory of the caller while readyRead() is emitted, and
+    bytesAvailable() reports the next frame waiting in the socket, not all
+    of them; read until read() returns 0 to take every frame. The frames are buffered as
+    usual when the readyRead() handlers don't read them, and for sockets
+    reading with the receive thread or io_uring backend.
+ */
 bool CanAbstractSocket::connectToInterface(const QString &interfaceName, OpenMode mode)
 {
     Q_D(CanAbstractSocket);
@@ -73,7 +92,7 @@ bool CanAbstractSocket::connectToInterface(const QString &interfaceName, OpenMod
         return false;
     }
 
-   static const OpenMode unsupportedModes = Append | Truncate | Text | Unbuffered;
+   static const OpenMode unsupportedModes = Append | Truncate | Text;
    if ((mode & unsupportedModes) || mode == NotOpen) {
        setSocketError(CanAbstractSocket::UnsupportedSocketOperationError, tr("Unsupported open mode"));
        return false;
@@ -93,6 +112,25 @@ bool CanAbstractSocket::connectToInterface(const QString &interfaceName, OpenMod
        return false;
    }
 
+   if (d->reactorEntry && !d->reactorEntry->reactor->registerDescriptor(d->reactorEntry)) {
+       d->setError(d->getSystemError());
+       close();
+       return false;
+   }
+
+   // falls back to the socket notifiers if the backend can't be used,
+   // busy polling always reads on the receive thread
+   if ((d->ioBackend == ReceiveThreadIoBackend || d->busyPollTime() > 0)
+           && (mode & QIODevice::ReadOnly)) {
+       d->startReceiveThread();
+   } else if (d->ioBackend == IoUringIoBackend) {
+       d->startIoUring();
+   }
+
+   // the backends read on their own, unbuffered sockets buffer like the others
+   d->directRead = (mode & QIODevice::Unbuffered) && (mode & QIODevice::ReadOnly)
+           && d->canReadDirectly() && !d->receiveThread && !d->ioUring;
+
    if (mode & QIODevice::ReadOnly)
        d->setReadNotificationEnabled(true);
 
@@ -115,6 +153,8 @@ void CanAbstractSocket::close()
 
     QIODevice::close();
 
+    d->directRead = false;
+    d->directReadPending = false;
     setSocketState(ClosingState);
 
     d->disconnectFromInterface();
@@ -209,15 +249,111 @@ qint64 CanAbstractSocket::readBufferSize() const
     return d->readBufferMaxSize;
 }
 
+/*!
+    Sets the I/O \a backend used by the next connectToInterface().
+
+    With IoUringIoBackend a multishot receive and linked sends are kept in
+    flight on an io_uring instance, and received data and send completions
+    are reaped in batches from a single notification. If the kernel or the
+    socket doesn't support it (e.g. receive timestamps are enabled), the
+    socket silently uses the socket notifiers. The read buffer size is a soft
+    limit with io_uring, data already received is always buffered.
+
+    With ReceiveThreadIoBackend a private thread reads the socket as soon as
+    data arrives and queues it in a lock-free queue of receiveQueueSize()
+    bytes, so a busy owner thread doesn't make the kernel buffer overrun.
+    The owner thread moves the queued data into the read buffer and gets one
+    readyRead() per batch. Frames arriving while the queue is full are
+    dropped and counted, see receiveQueueDroppedFrames(). Writing is not
+    affected. Receive options should be set before connecting, as the
+    thread reads with the options it was started with.
+
+    \sa ioBackend()
+ */
+void CanAbstractSocket::setIoBackend(IoBackend backend)
+{
+    Q_D(CanAbstractSocket);
+    d->ioBackend = backend;
+}
+
+/*!
+    Returns the I/O backend in use while connected, otherwise the backend
+    requested with setIoBackend().
+ */
+CanAbstractSocket::IoBackend CanAbstractSocket::ioBackend() const
+{
+    Q_D(const CanAbstractSocket);
+
+    if (d->state == ConnectedState) {
+        if (d->ioUring)
+            return IoUringIoBackend;
+        if (d->receiveThread)
+            return ReceiveThreadIoBackend;
+        return NotifierIoBackend;
+    }
+    return d->ioBackend;
+}
+
+/*!
+    Sets the \a size in bytes of the queue filled by the receive thread,
+    used by the next connectToInterface(). The default is 256 kB.
+
+    \sa setIoBackend()
+ */
+void CanAbstractSocket::setReceiveQueueSize(qint64 size)
+{
+    Q_D(CanAbstractSocket);
+    d->receiveQueueSize = size;
+}
+
+qint64 CanAbstractSocket::receiveQueueSize() const
+{
+    Q_D(const CanAbstractSocket);
+    return d->receiveQueueSize;
+}
+
+/*!
+    Returns the number of frames the receive thread dropped because its
+    queue was full, since connecting or the last resetReceiveQueueStatistics().
+ */
+quint64 CanAbstractSocket::receiveQueueDroppedFrames() const
+{
+    Q_D(const CanAbstractSocket);
+    return d->receiveQueueDroppedFrames.load();
+}
+
+/*!
+    Returns the maximum number of bytes waiting in the queue of the receive
+    thread, since connecting or the last resetReceiveQueueStatistics().
+ */
+qint64 CanAbstractSocket::receiveQueueHighWaterMark() const
+{
+    Q_D(const CanAbstractSocket);
+    return d->receiveQueueHighWaterMark.load();
+}
+
+void CanAbstractSocket::resetReceiveQueueStatistics()
+{
+    Q_D(CanAbstractSocket);
+    d->receiveQueueDroppedFrames.store(0);
+    d->receiveQueueHighWaterMark.store(0);
+}
+
 qint64 CanAbstractSocket::bytesAvailable() const
 {
+    Q_D(const CanAbstractSocket);
+
+    // an unbuffered socket leaves the frames in the socket during readyRead(),
+    // only the size of the next one is known without reading them
+    if (d->directReadPending)
+        return QIODevice::bytesAvailable() + d->pendingDirectReadSize();
     return QIODevice::bytesAvailable();
 }
 
 qint64 CanAbstractSocket::bytesToWrite() const
 {
     Q_D(const CanAbstractSocket);
-    return d->writeBuffer.size();
+    return d->writeBuffer.size() + d->queuedTransmitSize();
 }
 
 bool CanAbstractSocket::waitForReadyRead(int msecs)
@@ -242,10 +378,11 @@ bool CanAbstractSocket::waitForBytesWritten(int msecs)
 
 qint64 CanAbstractSocket::readData(char *data, qint64 maxSize)
 {
-    Q_UNUSED(data)
-    Q_UNUSED(maxSize)
     Q_D(CanAbstractSocket);
 
+    if (d->directRead && d->state == ConnectedState)
+        return d->readDirectly(data, maxSize);
+
     if (d->readBufferMaxSize && !d->isReadNotificationEnabled())
         d->setReadNotificationEnabled(true);
 
@@ -384,6 +521,29 @@ private:
     CanAbstractSocketPrivate *dptr;
 };
 
+class BackendNotifier : public QSocketNotifier
+{
+public:
+    BackendNotifier(CanAbstractSocketPrivate *d, qintptr eventDescriptor, QObject *parent)
+        : QSocketNotifier(eventDescriptor, QSocketNotifier::Read, parent)
+        , dptr(d)
+    {
+    }
+
+protected:
+    bool event(QEvent *e) Q_DECL_OVERRIDE
+    {
+        if (e->type() == QEvent::SockAct) {
+            dptr->backendNotification();
+            return true;
+        }
+        return QSocketNotifier::event(e);
+    }
+
+private:
+    CanAbstractSocketPrivate *dptr;
+};
+
 CanAbstractSocketPrivate::CanAbstractSocketPrivate(qint32 readChunkSize, qint64 initialBufferSize)
     : readChunkSize(readChunkSize)
     , readBufferMaxSize(0)
@@ -400,13 +560,29 @@ CanAbstractSocketPrivate::CanAbstractSocketPrivate(qint32 readChunkSize, qint64
     , readSocketNotifierStateSet(false)
     , emittedReadyRead(false)
     , emittedBytesWritten(false)
+    , directRead(false)
+    , directReadPending(false)
+    , receivedBytes(0)
     , pendingBytesWritten(0)
     , writeSequenceStarted(false)
+    , ioBackend(CanAbstractSocket::NotifierIoBackend)
+    , ioUring(Q_NULLPTR)
+    , backendNotifier(Q_NULLPTR)
+    , ioUringSentBytes(0)
+    , ioUringSendError(0)
+    , receiveThread(Q_NULLPTR)
+    , receiveQueueSize(CAN_RECEIVE_QUEUE_DEFAULT_SIZE)
+    , receiveThreadReadEnabled(false)
+    , receiveQueueDroppedFrames(0)
+    , receiveQueueHighWaterMark(0)
+    , reactorEntry(Q_NULLPTR)
 {
 }
 
 CanAbstractSocketPrivate::~CanAbstractSocketPrivate()
 {
+    if (reactorEntry)
+        reactorEntry->reactor->detach(reactorEntry, false);
 }
 
 int CanAbstractSocketPrivate::timeoutValue(int msecs, int elapsed)
@@ -425,6 +601,13 @@ bool CanAbstractSocketPrivate::connectToInterface(const QString &interfaceName)
 
 void CanAbstractSocketPrivate::disconnectFromInterface()
 {
+    // the ring goes first, closing it cancels the requests on the descriptor
+    stopIoUring();
+    stopReceiveThread();
+
+    if (reactorEntry)
+        reactorEntry->reactor->unregisterDescriptor(reactorEntry);
+
     if (readNotifier) {
         delete readNotifier;
         readNotifier = Q_NULLPTR;
@@ -505,18 +688,63 @@ void CanAbstractSocketPrivate::setError(const CanAbstractSocketErrorInfo &errorI
     emit q->error(error);
 }
 
-#include <QtCore/qdebug.h>
+/*
+    Sends the data right away from the memory of the caller if nothing is
+    queued and nothing was sent since the last bytesWritten(). Only what the
+    socket doesn't take is queued. The following writes of the same event
+    loop turn are queued and sent together by the write notification, which
+    also emits bytesWritten() for the data sent here.
+*/
 qint64 CanAbstractSocketPrivate::writeData(const char *data, qint64 maxSize)
 {
-    qDebug() << QByteArray(data, maxSize).toHex();
-    ::memcpy(writeBuffer.reserve(maxSize), data, maxSize);
-    if (!writeBuffer.isEmpty() && !isWriteNotificationEnabled())
+    qint64 writtenBytes = 0;
+    if (writeBuffer.isEmpty() && pendingBytesWritten == 0 && !ioUring) {
+        // errors are reported when the queued data is sent again
+        writtenBytes = qMax<qint64>(writeToSocket(data, maxSize), 0);
+        pendingBytesWritten += writtenBytes;
+    }
+
+    CAN_TRACE(WriteData, descriptor, maxSize, writtenBytes);
+
+    if (writtenBytes < maxSize)
+        ::memcpy(writeBuffer.reserve(maxSize - writtenBytes), data + writtenBytes, maxSize - writtenBytes);
+
+    if ((!writeBuffer.isEmpty() || pendingBytesWritten > 0) && !isWriteNotificationEnabled())
         setWriteNotificationEnabled(true);
     return maxSize;
 }
 
+// called when the write buffer ran empty, to move data queued elsewhere into it
+void CanAbstractSocketPrivate::refillWriteBuffer()
+{
+}
+
+// size of the data queued for writing besides the write buffer
+qint64 CanAbstractSocketPrivate::queuedTransmitSize() const
+{
+    return 0;
+}
+
+// moves all pending data into a single chunk, so that a frame written in
+// several pieces is not split between two chunks of the write buffer
+void CanAbstractSocketPrivate::linearizeWriteBuffer()
+{
+    const qint64 size = writeBuffer.size();
+    if (size == writeBuffer.nextDataBlockSize())
+        return;
+
+    QByteArray pending(size, Qt::Uninitialized);
+    writeBuffer.read(pending.data(), size);
+    ::memcpy(writeBuffer.reserve(size), pending.constData(), size);
+}
+
 bool CanAbstractSocketPrivate::waitForReadyRead(int msecs)
 {
+    if (ioUring)
+        return waitForIoUring(true, msecs);
+    if (receiveThread)
+        return waitForReceiveThread(msecs);
+
     QElapsedTimer stopWatch;
     stopWatch.start();
 
@@ -524,7 +752,9 @@ bool CanAbstractSocketPrivate::waitForReadyRead(int msecs)
         bool readyToRead = false;
         bool readyToWrite = false;
 
-        if (!waitForReadOrWrite(&readyToRead, &readyToWrite, true, !writeBuffer.isEmpty(),
+        // data written through still needs its bytesWritten()
+        if (!waitForReadOrWrite(&readyToRead, &readyToWrite, true,
+                                !writeBuffer.isEmpty() || pendingBytesWritten > 0,
                                 timeoutValue(msecs, stopWatch.elapsed()))) {
             return false;
         }
@@ -544,13 +774,21 @@ bool CanAbstractSocketPrivate::waitForBytesWritten(int msecs)
     if (writeBuffer.isEmpty() && pendingBytesWritten <= 0)
         return false;
 
+    if (ioUring)
+        return waitForIoUring(false, msecs);
+
+    // everything was written through, only bytesWritten() is left
+    if (writeBuffer.isEmpty())
+        return completeAsyncWrite();
+
     QElapsedTimer stopWatch;
     stopWatch.start();
 
     forever {
         bool readyToRead = false;
         bool readyToWrite = false;
-        if (!waitForReadOrWrite(&readyToRead, &readyToWrite, true, !writeBuffer.isEmpty(),
+        // the receive thread owns reading from the socket
+        if (!waitForReadOrWrite(&readyToRead, &readyToWrite, !receiveThread, !writeBuffer.isEmpty(),
                                 timeoutValue(msecs, stopWatch.elapsed()))) {
             return false;
         }
@@ -568,7 +806,47 @@ bool CanAbstractSocketPrivate::readNotification()
 {
     Q_Q(CanAbstractSocket);
 
-    // Always buffered, read data from the socket into the read buffer
+    CAN_TRACE(ReadNotification, descriptor, buffer.size(), directRead);
+
+    // Unbuffered sockets let the readyRead() handlers read the frames
+    // straight into their memory. The frames are only buffered if the
+    // handlers lag behind and leave them in the socket.
+    if (directRead && !emittedReadyRead && buffer.isEmpty()) {
+        const qint64 readBefore = receivedBytes;
+
+        directReadPending = true;
+        emittedReadyRead = true;
+        emit q->readyRead();
+        emittedReadyRead = false;
+        directReadPending = false;
+
+        if (receivedBytes != readBefore || state != CanAbstractSocket::ConnectedState)
+            return true;
+    }
+
+    // read data from the socket into the read buffer
+    const qint64 newBytes = readIntoBuffer();
+    if (newBytes < 0)
+        return false;
+
+    // only emit readyRead() when not recursing, and only if there is data available
+    const bool hasData = newBytes > 0;
+
+    if (!emittedReadyRead && hasData) {
+        emittedReadyRead = true;
+        emit q->readyRead();
+        emittedReadyRead = false;
+    }
+
+    return true;
+}
+
+/*
+    Reads a chunk from the socket into the read buffer and returns the number
+    of new bytes, or -1 if the buffer is full or reading failed.
+*/
+qint64 CanAbstractSocketPrivate::readIntoBuffer()
+{
     qint64 newBytes = buffer.size();
     qint64 bytesToRead = readChunkSize;
 
@@ -576,7 +854,7 @@ bool CanAbstractSocketPrivate::readNotification()
         bytesToRead = readBufferMaxSize - buffer.size();
         if (bytesToRead == 0) {
             setReadNotificationEnabled(false);
-            return false;
+            return -1;
         }
     }
 
@@ -592,7 +870,8 @@ bool CanAbstractSocketPrivate::readNotification()
             setReadNotificationEnabled(false);
         setError(error);
         buffer.chop(bytesToRead);
-        return false;
+        CAN_TRACE(ReadIntoBuffer, descriptor, -1, buffer.size());
+        return -1;
     }
     else if (bytesToRead == 0)
         // If data could be read, but buffer was too small, disable the read notifier
@@ -600,32 +879,66 @@ bool CanAbstractSocketPrivate::readNotification()
     else {
         // data was received
         buffer.chop(bytesToRead - readBytes);
-        newBytes = buffer.size() - newBytes;
+        receivedBytes += buffer.size() - newBytes;
     }
+    newBytes = buffer.size() - newBytes;
+    CAN_TRACE(ReadIntoBuffer, descriptor, newBytes, buffer.size());
+
+    checkReceiveStatistics();
 
     // If read buffer is full, disable the read notifier.
     if (readBufferMaxSize && buffer.size() == readBufferMaxSize)
         setReadNotificationEnabled(false);
 
-    // only emit readyRead() when not recursing, and only if there is data available
-    const bool hasData = newBytes > 0;
+    return newBytes;
+}
 
-    if (!emittedReadyRead && hasData) {
-        emittedReadyRead = true;
-        emit q->readyRead();
-        emittedReadyRead = false;
+/*
+    Reads the frames of an unbuffered socket from the descriptor into the
+    memory of the caller of read(). Buffered frames go first to keep the
+    order, a read too small for the next frame buffers a chunk.
+*/
+qint64 CanAbstractSocketPrivate::readDirectly(char *data, qint64 maxSize)
+{
+    if (!buffer.isEmpty())
+        return buffer.read(data, maxSize);
+
+    const qint64 readBytes = readFromSocket(data, maxSize);
+    CAN_TRACE(ReadDirect, descriptor, maxSize, readBytes);
+
+    if (readBytes < 0) {
+        CanAbstractSocketErrorInfo error = getSystemError();
+        if (error.errorCode != CanAbstractSocket::SocketResourceError)
+            error.errorCode = CanAbstractSocket::ReadError;
+        setError(error);
+        return -1;
     }
 
-    return true;
+    if (readBytes > 0) {
+        receivedBytes += readBytes;
+        checkReceiveStatistics();
+        return readBytes;
+    }
+
+    if (maxSize < readChunkSize && readIntoBuffer() > 0)
+        return buffer.read(data, maxSize);
+
+    // the socket is drained, bytesAvailable() stops reporting frames
+    directReadPending = false;
+    return 0;
 }
 
 bool CanAbstractSocketPrivate::startAsyncWrite()
 {
+    if (ioUring)
+        return startIoUringWrite();
+
     if (writeBuffer.isEmpty() || writeSequenceStarted)
         return true;
 
     // Attempt to write it all in one chunk.
     qint64 writtenBytes = writeToSocket(writeBuffer.readPointer(), writeBuffer.nextDataBlockSize());
+    CAN_TRACE(WriteToSocket, descriptor, writeBuffer.size(), writtenBytes);
     if (writtenBytes < 0) {
         CanAbstractSocketErrorInfo error = getSystemError();
         if (error.errorCode != CanAbstractSocket::SocketResourceError)
@@ -649,6 +962,7 @@ bool CanAbstractSocketPrivate::completeAsyncWrite()
 
     if (pendingBytesWritten > 0) {
         if (!emittedBytesWritten) {
+            CAN_TRACE(BytesWritten, descriptor, pendingBytesWritten, writeBuffer.size());
             emittedBytesWritten = true;
             emit q->bytesWritten(pendingBytesWritten);
             pendingBytesWritten = 0;
@@ -658,6 +972,10 @@ bool CanAbstractSocketPrivate::completeAsyncWrite()
 
     writeSequenceStarted = false;
 
+    // scheduled transmit queues hand over their next frames
+    if (writeBuffer.isEmpty())
+        refillWriteBuffer();
+
     if (writeBuffer.isEmpty()) {
         setWriteNotificationEnabled(false);
         return true;
@@ -668,6 +986,12 @@ bool CanAbstractSocketPrivate::completeAsyncWrite()
 
 bool CanAbstractSocketPrivate::isReadNotificationEnabled() const
 {
+    if (ioUring)
+        return ioUring->isReceiveArmed();
+    if (receiveThread)
+        return receiveThreadReadEnabled;
+    if (reactorEntry)
+        return reactorEntry->readEnabled;
     return readNotifier && readNotifier->isEnabled();
 }
 
@@ -675,6 +999,28 @@ void CanAbstractSocketPrivate::setReadNotificationEnabled(bool enable)
 {
     Q_Q(CanAbstractSocket);
 
+    CAN_TRACE(ReadNotifierEnabled, descriptor, enable, buffer.size());
+
+    if (ioUring) {
+        // a multishot receive can't be paused, it is only not armed again
+        if (enable && !ioUring->isReceiveArmed())
+            startIoUringReceive();
+        return;
+    }
+
+    if (receiveThread) {
+        receiveThreadReadEnabled = enable;
+        // data may be queued already, without another wake-up
+        if (enable)
+            receiveThread->wakeUp();
+        return;
+    }
+
+    if (reactorEntry) {
+        reactorEntry->reactor->setReadEnabled(reactorEntry, enable);
+        return;
+    }
+
     if (readNotifier) {
         readNotifier->setEnabled(enable);
     } else if (enable) {
@@ -685,6 +1031,8 @@ void CanAbstractSocketPrivate::setReadNotificationEnabled(bool enable)
 
 bool CanAbstractSocketPrivate::isWriteNotificationEnabled() const
 {
+    if (reactorEntry)
+        return reactorEntry->writeEnabled;
     return writeNotifier && writeNotifier->isEnabled();
 }
 
@@ -692,6 +1040,13 @@ void CanAbstractSocketPrivate::setWriteNotificationEnabled(bool enable)
 {
     Q_Q(CanAbstractSocket);
 
+    CAN_TRACE(WriteNotifierEnabled, descriptor, enable, writeBuffer.size());
+
+    if (reactorEntry) {
+        reactorEntry->reactor->setWriteEnabled(reactorEntry, enable);
+        return;
+    }
+
     if(writeNotifier) {
         writeNotifier->setEnabled(enable);
     } else if (enable) {
@@ -748,3 +1103,569 @@ qint64 CanAbstractSocketPrivate::writeToSocket(const char *data, qint64 maxSize)
     Q_UNUSED(maxSize);
     return -1;
 }
+
+// whether readFromSocket() can fill the memory of the caller of read() in unbuffered mode
+bool CanAbstractSocketPrivate::canReadDirectly() const
+{
+    return false;
+}
+
+// size of the next unit read() takes from the socket in unbuffered mode, 0 if none is waiting
+qint64 CanAbstractSocketPrivate::pendingDirectReadSize() const
+{
+    return 0;
+}
+
+// size of the receive buffers of the io_uring backend, 0 if the socket type can't use it
+int CanAbstractSocketPrivate::receiveUnitSize() const
+{
+    return 0;
+}
+
+// called for each unit received with the io_uring backend, returns -1 to drop it
+int CanAbstractSocketPrivate::completeReceivedUnit(char *data, int length)
+{
+    Q_UNUSED(data);
+    return length;
+}
+
+// size of the next unit to send with the io_uring backend, 0 if it is
+// incomplete or -1 if the data can't be sent
+qint64 CanAbstractSocketPrivate::transmitUnitSize(const char *data, qint64 maxSize) const
+{
+    Q_UNUSED(data);
+    return maxSize;
+}
+
+// number of frames (or messages) in \a data read by readFromSocket(), for the drop counter
+qint64 CanAbstractSocketPrivate::receivedUnitCount(const char *data, qint64 size) const
+{
+    Q_UNUSED(data);
+    return size > 0 ? 1 : 0;
+}
+
+// time in microseconds the receive thread spins on an empty socket, 0 to block right away
+int CanAbstractSocketPrivate::busyPollTime() const
+{
+    return 0;
+}
+
+// cpu the receive thread is pinned to, -1 for none
+int CanAbstractSocketPrivate::receiveThreadCpu() const
+{
+    return -1;
+}
+
+// called in the thread of the socket after received data was moved into the read buffer
+void CanAbstractSocketPrivate::checkReceiveStatistics()
+{
+}
+
+bool CanAbstractSocketPrivate::backendNotification()
+{
+    if (ioUring)
+        return ioUringNotification();
+    if (receiveThread)
+        return receiveThreadNotification();
+    return false;
+}
+
+bool CanAbstractSocketPrivate::startReceiveThread()
+{
+    Q_Q(CanAbstractSocket);
+
+    if (readChunkSize <= 0)
+        return false;
+
+    // one slot per readFromSocket() call
+    const qint64 wantedSlots = qMax<qint64>(receiveQueueSize / readChunkSize, 2);
+    int slotCount = 2;
+    while (slotCount < wantedSlots && slotCount < (1 << 20))
+        slotCount <<= 1;
+
+    receiveQueueDroppedFrames.store(0);
+    receiveQueueHighWaterMark.store(0);
+
+    CanReceiveThread *thread = new CanReceiveThread(this, slotCount, readChunkSize);
+    thread->setBusyPoll(busyPollTime(), receiveThreadCpu());
+    if (!thread->startReceiving()) {
+        delete thread;
+        return false;
+    }
+
+    receiveThread = thread;
+    receiveThreadReadEnabled = false;
+    backendNotifier = new BackendNotifier(this, receiveThread->eventDescriptor(), q);
+    return true;
+}
+
+void CanAbstractSocketPrivate::stopReceiveThread()
+{
+    if (!receiveThread)
+        return;
+
+    delete backendNotifier;
+    backendNotifier = Q_NULLPTR;
+
+    delete receiveThread;
+    receiveThread = Q_NULLPTR;
+    receiveThreadReadEnabled = false;
+}
+
+/*
+    Suspends the receive thread before a change of what readFromSocket()
+    depends on. Returns \c true if it has to be resumed afterwards.
+*/
+bool CanAbstractSocketPrivate::suspendReceiveThread()
+{
+    return receiveThread && receiveThread->suspend();
+}
+
+/*
+    Resumes the suspended receive thread. If the read chunk size changed
+    meanwhile, the data it queued is moved into the read buffer and a thread
+    with slots of the new size takes over.
+*/
+void CanAbstractSocketPrivate::resumeReceiveThread()
+{
+    Q_Q(CanAbstractSocket);
+
+    if (!receiveThread)
+        return;
+
+    if (receiveThread->slotSize() == readChunkSize) {
+        receiveThread->resume();
+        return;
+    }
+
+    qint64 newBytes = 0;
+    qint64 size;
+    while (const char *data = receiveThread->peek(&size)) {
+        ::memcpy(buffer.reserve(size), data, size);
+        receiveThread->release(size);
+        newBytes += size;
+    }
+    receivedBytes += newBytes;
+
+    // falls back to the read notifier if the new thread can't be started
+    const bool readEnabled = isReadNotificationEnabled();
+    stopReceiveThread();
+    startReceiveThread();
+    setReadNotificationEnabled(readEnabled);
+
+    if (newBytes > 0)
+        QMetaObject::invokeMethod(q, "readyRead", Qt::QueuedConnection);
+}
+
+/*
+    Moves the data queued by the receive thread into the read buffer and
+    emits readyRead() once for all of it.
+*/
+bool CanAbstractSocketPrivate::receiveThreadNotification(bool *received)
+{
+    Q_Q(CanAbstractSocket);
+
+    receiveThread->acknowledge();
+
+    qint64 newBytes = 0;
+    while (receiveThreadReadEnabled) {
+        if (readBufferMaxSize && buffer.size() >= readBufferMaxSize) {
+            // drained again once readData() enables reading
+            receiveThreadReadEnabled = false;
+            break;
+        }
+
+        qint64 size;
+        const char *data = receiveThread->peek(&size);
+        if (!data)
+            break;
+
+        ::memcpy(buffer.reserve(size), data, size);
+        receiveThread->release(size);
+        newBytes += size;
+    }
+    receivedBytes += newBytes;
+    CAN_TRACE(ReadIntoBuffer, descriptor, newBytes, buffer.size());
+
+    checkReceiveStatistics();
+
+    bool ok = true;
+    if (const int receiveError = receiveThread->receiveError()) {
+        CanAbstractSocketErrorInfo error = getSystemError(receiveError);
+        if (error.errorCode != CanAbstractSocket::SocketResourceError)
+            error.errorCode = CanAbstractSocket::ReadError;
+        setError(error);
+        ok = false;
+    }
+
+    if (received)
+        *received = newBytes > 0;
+
+    if (!emittedReadyRead && newBytes > 0) {
+        emittedReadyRead = true;
+        emit q->readyRead();
+        emittedReadyRead = false;
+    }
+
+    return ok;
+}
+
+bool CanAbstractSocketPrivate::waitForReceiveThread(int msecs)
+{
+    QElapsedTimer stopWatch;
+    stopWatch.start();
+
+    forever {
+        if (!receiveThreadReadEnabled)
+            return false;
+
+        // data queued before the last wake-up was acknowledged doesn't signal again
+        if (receiveThread)
+            receiveThread->spinForData();
+
+        bool received = false;
+        if (!receiveThreadNotification(&received))
+            return false;
+        if (received)
+            return true;
+
+        if (!receiveThread)
+            return false;
+
+        const int eventDescriptor = receiveThread->eventDescriptor();
+        const bool checkWrite = !writeBuffer.isEmpty();
+
+        fd_set fdread;
+        FD_ZERO(&fdread);
+        FD_SET(eventDescriptor, &fdread);
+
+        fd_set fdwrite;
+        FD_ZERO(&fdwrite);
+        if (checkWrite)
+            FD_SET(descriptor, &fdwrite);
+
+        const int timeout = timeoutValue(msecs, stopWatch.elapsed());
+        struct timeval tv;
+        tv.tv_sec = timeout / 1000;
+        tv.tv_usec = (timeout % 1000) * 1000;
+
+        const int ret = ::select(qMax<int>(eventDescriptor, descriptor) + 1, &fdread, &fdwrite, 0,
+                                 timeout < 0 ? 0 : &tv);
+        if (ret < 0) {
+            setError(getSystemError());
+            return false;
+        }
+        if (ret == 0) {
+            setError(CanAbstractSocketErrorInfo(CanAbstractSocket::SocketTimeoutError));
+            return false;
+        }
+
+        if (checkWrite && FD_ISSET(descriptor, &fdwrite) && !completeAsyncWrite())
+            return false;
+    }
+    return false;
+}
+
+#ifdef CANSOCKET_HAVE_IOURING
+
+bool CanAbstractSocketPrivate::startIoUring()
+{
+    Q_Q(CanAbstractSocket);
+
+    const int unitSize = receiveUnitSize();
+    if (unitSize <= 0)
+        return false;
+
+    CanIoUring *ring = new CanIoUring;
+    if (!ring->setup(descriptor, unitSize, CAN_IOURING_RECEIVE_BUFFERS)) {
+        delete ring;
+        return false;
+    }
+
+    ioUring = ring;
+    backendNotifier = new BackendNotifier(this, ioUring->eventDescriptor(), q);
+    return true;
+}
+
+void CanAbstractSocketPrivate::stopIoUring()
+{
+    if (ioUring) {
+        delete backendNotifier;
+        backendNotifier = Q_NULLPTR;
+
+        delete ioUring;
+        ioUring = Q_NULLPTR;
+    }
+
+    ioUringSendBuffer.clear();
+    ioUringSentBytes = 0;
+    ioUringSendError = 0;
+}
+
+bool CanAbstractSocketPrivate::startIoUringReceive()
+{
+    if (!ioUring->armReceive() || !ioUring->submit()) {
+        CanAbstractSocketErrorInfo error = getSystemError();
+        if (error.errorCode != CanAbstractSocket::SocketResourceError)
+            error.errorCode = CanAbstractSocket::ReadError;
+        setError(error);
+        return false;
+    }
+    return true;
+}
+
+/*
+    Queues the complete units of the first write buffer block as one chain of
+    linked sends. The chain stops at the first failed send, so the completions
+    account for an exact prefix of the write buffer.
+*/
+bool CanAbstractSocketPrivate::startIoUringWrite()
+{
+    // a chain is in flight, its completions continue the write sequence
+    if (writeBuffer.isEmpty() || ioUring->sendsInFlight() > 0) {
+        setWriteNotificationEnabled(false);
+        return true;
+    }
+
+    const char *data = writeBuffer.readPointer();
+    const qint64 blockSize = writeBuffer.nextDataBlockSize();
+
+    qint64 unitSizes[CAN_IOURING_MAX_SENDS];
+    qint64 chainSize = 0;
+    int unitCount = 0;
+
+    while (unitCount < CAN_IOURING_MAX_SENDS) {
+        const qint64 unitSize = transmitUnitSize(data + chainSize, blockSize - chainSize);
+        if (unitSize < 0) {
+            if (unitCount > 0)
+                break;
+            setError(CanAbstractSocketErrorInfo(CanAbstractSocket::WriteError));
+            return false;
+        }
+        if (unitSize == 0)
+            break;
+        unitSizes[unitCount++] = unitSize;
+        chainSize += unitSize;
+    }
+
+    if (unitCount == 0) {
+        if (writeBuffer.size() > blockSize) {
+            // the first unit is split between two chunks of the write buffer
+            linearizeWriteBuffer();
+            return startIoUringWrite();
+        }
+        setWriteNotificationEnabled(false);
+        return true;
+    }
+
+    // the write buffer may reallocate while the sends are in flight
+    ioUringSendBuffer = QByteArray(data, chainSize);
+    ioUringSentBytes = 0;
+    ioUringSendError = 0;
+
+    const char *unit = ioUringSendBuffer.constData();
+    for (int i = 0; i < unitCount; ++i) {
+        ioUring->queueSend(unit, unitSizes[i], i + 1 < unitCount);
+        unit += unitSizes[i];
+    }
+
+    if (!ioUring->submit()) {
+        CanAbstractSocketErrorInfo error = getSystemError();
+        if (error.errorCode != CanAbstractSocket::SocketResourceError)
+            error.errorCode = CanAbstractSocket::WriteError;
+        setError(error);
+        return false;
+    }
+
+    setWriteNotificationEnabled(false);
+    return true;
+}
+
+/*
+    Reaps all completions of the ring: received units are appended to the
+    read buffer and a finished send chain frees its prefix of the write
+    buffer. Emits readyRead() and bytesWritten() once per call.
+*/
+bool CanAbstractSocketPrivate::ioUringNotification(bool *received, bool *written)
+{
+    Q_Q(CanAbstractSocket);
+
+    ioUring->clearEvent();
+
+    const qint64 oldSize = buffer.size();
+    int receiveError = 0;
+
+    CanIoUringCompletion completion;
+    while (ioUring->nextCompletion(&completion)) {
+        if (completion.operation == CanIoUring::ReceiveOperation) {
+            if (completion.result > 0) {
+                char *ptr = buffer.reserve(completion.result);
+                ::memcpy(ptr, completion.buffer, completion.result);
+                if (completeReceivedUnit(ptr, completion.result) < 0)
+                    buffer.chop(completion.result);
+            } else if (completion.result < 0 && completion.result != -ENOBUFS
+                       && completion.result != -ECANCELED) {
+                // running out of provided buffers only ends the multishot receive
+                receiveError = -completion.result;
+            }
+            ioUring->recycleBuffer(completion.bufferId);
+        } else if (completion.operation == CanIoUring::SendOperation) {
+            if (completion.result > 0)
+                ioUringSentBytes += completion.result;
+            else if (completion.result < 0 && completion.result != -ECANCELED && !ioUringSendError)
+                ioUringSendError = -completion.result;
+        }
+    }
+
+    bool ok = true;
+    const qint64 newBytes = buffer.size() - oldSize;
+    receivedBytes += newBytes;
+
+    bool sendsCompleted = false;
+    bool continueWrite = false;
+    if (ioUring->sendsInFlight() == 0 && !ioUringSendBuffer.isEmpty()) {
+        writeBuffer.free(ioUringSentBytes);
+        pendingBytesWritten += ioUringSentBytes;
+        ioUringSendBuffer.clear();
+        ioUringSentBytes = 0;
+        sendsCompleted = true;
+
+        if (ioUringSendError == ENOBUFS || ioUringSendError == EAGAIN) {
+            // device queue is full, continue once the socket is writable
+            setWriteNotificationEnabled(true);
+        } else if (ioUringSendError) {
+            CanAbstractSocketErrorInfo error = getSystemError(ioUringSendError);
+            if (error.errorCode != CanAbstractSocket::SocketResourceError)
+                error.errorCode = CanAbstractSocket::WriteError;
+            setError(error);
+            ok = false;
+        } else {
+            continueWrite = true;
+        }
+        ioUringSendError = 0;
+    }
+
+    if (receiveError) {
+        CanAbstractSocketErrorInfo error = getSystemError(receiveError);
+        if (error.errorCode != CanAbstractSocket::SocketResourceError)
+            error.errorCode = CanAbstractSocket::ReadError;
+        setError(error);
+        ok = false;
+    }
+
+    // arm the receive again unless the read buffer is full, readData() arms it later
+    if ((openMode & QIODevice::ReadOnly) && !ioUring->isReceiveArmed()
+            && !(readBufferMaxSize && buffer.size() >= readBufferMaxSize)) {
+        ok = startIoUringReceive() && ok;
+    }
+
+    checkReceiveStatistics();
+
+    if (received)
+        *received = newBytes > 0;
+    if (written)
+        *written = sendsCompleted && pendingBytesWritten > 0;
+
+    if (!emittedReadyRead && newBytes > 0) {
+        emittedReadyRead = true;
+        emit q->readyRead();
+        emittedReadyRead = false;
+    }
+
+    // emits bytesWritten() and sends the rest of the write buffer,
+    // unless the socket was closed from a slot
+    if (continueWrite && ioUring && !completeAsyncWrite())
+        ok = false;
+
+    return ok;
+}
+
+bool CanAbstractSocketPrivate::waitForIoUring(bool forRead, int msecs)
+{
+    QElapsedTimer stopWatch;
+    stopWatch.start();
+
+    forever {
+        const int eventDescriptor = ioUring->eventDescriptor();
+        const bool checkWrite = isWriteNotificationEnabled();
+
+        fd_set fdread;
+        FD_ZERO(&fdread);
+        FD_SET(eventDescriptor, &fdread);
+
+        fd_set fdwrite;
+        FD_ZERO(&fdwrite);
+        if (checkWrite)
+            FD_SET(descriptor, &fdwrite);
+
+        const int timeout = timeoutValue(msecs, stopWatch.elapsed());
+        struct timeval tv;
+        tv.tv_sec = timeout / 1000;
+        tv.tv_usec = (timeout % 1000) * 1000;
+
+        const int ret = ::select(qMax<int>(eventDescriptor, descriptor) + 1, &fdread, &fdwrite, 0,
+                                 timeout < 0 ? 0 : &tv);
+        if (ret < 0) {
+            setError(getSystemError());
+            return false;
+        }
+        if (ret == 0) {
+            setError(CanAbstractSocketErrorInfo(CanAbstractSocket::SocketTimeoutError));
+            return false;
+        }
+
+        // submits the pending writes
+        if (checkWrite && FD_ISSET(descriptor, &fdwrite) && !completeAsyncWrite())
+            return false;
+
+        if (FD_ISSET(eventDescriptor, &fdread)) {
+            bool received = false;
+            bool written = false;
+            if (!ioUringNotification(&received, &written))
+                return false;
+            if (forRead ? received : written)
+                return true;
+        }
+
+        if (!ioUring)
+            return false;
+    }
+    return false;
+}
+
+#else
+
+bool CanAbstractSocketPrivate::startIoUring()
+{
+    return false;
+}
+
+void CanAbstractSocketPrivate::stopIoUring()
+{
+}
+
+bool CanAbstractSocketPrivate::startIoUringReceive()
+{
+    return false;
+}
+
+bool CanAbstractSocketPrivate::startIoUringWrite()
+{
+    return false;
+}
+
+bool CanAbstractSocketPrivate::ioUringNotification(bool *received, bool *written)
+{
+    Q_UNUSED(received);
+    Q_UNUSED(written);
+    return false;
+}
+
+bool CanAbstractSocketPrivate::waitForIoUring(bool forRead, int msecs)
+{
+    Q_UNUSED(forRead);
+    Q_UNUSED(msecs);
+    return false;
+}
+
+#endif // CANSOCKET_HAVE_IOURING
@@ -41,6 +41,7 @@ public:
         Tp16Socket,
         Tp20Socket,
         IsoTpSocket,
+        PacketSocket,
         UnkownCanSocketType = -1
     };
     Q_ENUM(SocketType)
@@ -68,6 +69,13 @@ public:
     };
     Q_ENUM(SocketState)
 
+    enum IoBackend {
+        NotifierIoBackend,
+        IoUringIoBackend,
+        ReceiveThreadIoBackend
+    };
+    Q_ENUM(IoBackend)
+
     CanAbstractSocket(SocketType socketType, QObject *parent = Q_NULLPTR);
     virtual ~CanAbstractSocket();
 
@@ -94,6 +102,15 @@ public:
     virtual void setReadBufferSize(qint64 size);
     qint64 readBufferSize() const;
 
+    void setIoBackend(IoBackend backend);
+    IoBackend ioBackend() const;
+
+    void setReceiveQueueSize(qint64 size);
+    qint64 receiveQueueSize() const;
+    quint64 receiveQueueDroppedFrames() const;
+    qint64 receiveQueueHighWaterMark() const;
+    void resetReceiveQueueStatistics();
+
     qint64 bytesAvailable() const Q_DECL_OVERRIDE;
     qint64 bytesToWrite() const Q_DECL_OVERRIDE;
 
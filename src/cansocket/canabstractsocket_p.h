@@ -25,6 +25,11 @@
 #include "private/qiodevice_p.h"
 
 #include "qsocketnotifier.h"
+#include "qatomic.h"
+
+class CanIoUring;
+class CanReceiveThread;
+struct CanSocketReactorEntry;
 
 class CanAbstractSocketErrorInfo
 {
@@ -45,7 +50,7 @@ public:
     CanAbstractSocketPrivate(qint32 readChunkSize, qint64 initialBufferSize);
     virtual ~CanAbstractSocketPrivate();
 
-    const qint32 readChunkSize;
+    qint32 readChunkSize;
 
     static int timeoutValue(int msecs, int elapsed);
 
@@ -56,7 +61,10 @@ public:
 
     void setError(const CanAbstractSocketErrorInfo &errorInfo);
 
-    qint64 writeData(const char *data, qint64 maxSize);
+    virtual qint64 writeData(const char *data, qint64 maxSize);
+    virtual void refillWriteBuffer();
+    virtual qint64 queuedTransmitSize() const;
+    void linearizeWriteBuffer();
 
     bool waitForReadyRead(int msecs);
     bool waitForBytesWritten(int msecs);
@@ -70,7 +78,9 @@ public:
 
     QString interfaceName;
 
-    bool readNotification();
+    virtual bool readNotification();
+    qint64 readIntoBuffer();
+    qint64 readDirectly(char *data, qint64 maxSize);
     bool startAsyncWrite();
     bool completeAsyncWrite();
 
@@ -86,6 +96,33 @@ public:
     virtual qint64 readFromSocket(char *data, qint64 maxSize);
     virtual qint64 writeToSocket(const char *data, qint64 maxSize);
 
+    bool startIoUring();
+    void stopIoUring();
+    bool startIoUringReceive();
+    bool startIoUringWrite();
+    bool ioUringNotification(bool *received = Q_NULLPTR, bool *written = Q_NULLPTR);
+    bool waitForIoUring(bool forRead, int msecs);
+
+    virtual bool canReadDirectly() const;
+    virtual qint64 pendingDirectReadSize() const;
+    virtual int receiveUnitSize() const;
+    virtual int completeReceivedUnit(char *data, int length);
+    virtual qint64 transmitUnitSize(const char *data, qint64 maxSize) const;
+
+    bool backendNotification();
+
+    bool startReceiveThread();
+    void stopReceiveThread();
+    bool suspendReceiveThread();
+    void resumeReceiveThread();
+    bool receiveThreadNotification(bool *received = Q_NULLPTR);
+    bool waitForReceiveThread(int msecs);
+
+    virtual qint64 receivedUnitCount(const char *data, qint64 size) const;
+    virtual int busyPollTime() const;
+    virtual void checkReceiveStatistics();
+    virtual int receiveThreadCpu() const;
+
     qintptr descriptor;
 
     QSocketNotifier *readNotifier;
@@ -98,9 +135,31 @@ public:
     bool emittedReadyRead;
     bool emittedBytesWritten;
 
+    // unbuffered mode, readData() reads from the descriptor, frames are
+    // pending in the socket while the direct readyRead() is emitted
+    bool directRead;
+    bool directReadPending;
+
+    qint64 receivedBytes;
+
     qint64 pendingBytesWritten;
     bool writeSequenceStarted;
 
+    CanAbstractSocket::IoBackend ioBackend;
+    CanIoUring *ioUring;
+    QSocketNotifier *backendNotifier;
+    QByteArray ioUringSendBuffer;
+    qint64 ioUringSentBytes;
+    int ioUringSendError;
+
+    CanReceiveThread *receiveThread;
+    qint64 receiveQueueSize;
+    bool receiveThreadReadEnabled;
+    QAtomicInteger<quint64> receiveQueueDroppedFrames;
+    QAtomicInteger<qint64> receiveQueueHighWaterMark;
+
+    CanSocketReactorEntry *reactorEntry;
+
 };
 
 #endif // CANABSTRACTSOCKET_P_H
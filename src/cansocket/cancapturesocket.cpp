@@ -0,0 +1,613 @@
+/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "cancapturesocket.h"
+#include "canabstractsocket.h"
+#include "canabstractsocket_p.h"
+#include "cancapturesocket_p.h"
+#include "canframe_p.h"
+
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/can.h>
+#include <linux/filter.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define CAN_CAPTURE_DEFAULT_BLOCK_SIZE 131072 // 128 kB, ~1300 FD frames
+#define CAN_CAPTURE_DEFAULT_BLOCK_COUNT 32
+#define CAN_CAPTURE_DEFAULT_BLOCK_TIMEOUT 10 // ms until a partially filled block is retired
+#define CAN_CAPTURE_FRAME_SIZE 256 // packet header, address and FD frame, aligned
+
+/*!
+    \class CanCaptureSocket
+
+    \brief The CanCaptureSocket class receives CAN frames through a memory
+    mapped AF_PACKET (TPACKET_V3) ring.
+
+    \reentrant
+    \ingroup cansocket
+    \inmodule cansocket-qt-lib
+
+    The kernel fills blocks of the ring with the frames of the interface and
+    hands a block over to the application once it is full or its timeout
+    expired. Frames are accessed in place through CanCaptureBlock and
+    CanCaptureFrame, no data is copied into the QIODevice read buffer.
+    A block has to be given back with releaseBlock() before the kernel can
+    reuse it, blocks are released in the order they were taken.
+
+    The socket is receive only and meant for logging whole buses; readyRead()
+    is emitted when a block is ready.
+
+    Classic and FD frames are captured, the kernel drops every other packet
+    before it reaches the ring. CAN XL frames are not captured and not
+    counted by droppedFrames(), use a CanRawSocket with XL frames enabled
+    for XL buses.
+ */
+
+static inline const struct tpacket3_hdr *packetHeader(const void *packet)
+{
+    return static_cast<const struct tpacket3_hdr *>(packet);
+}
+
+static inline const struct sockaddr_ll *packetAddress(const void *packet)
+{
+    return reinterpret_cast<const struct sockaddr_ll *>(static_cast<const char *>(packet)
+                                                        + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+}
+
+static inline bool isCanPacket(const void *packet)
+{
+    const quint32 snapLength = packetHeader(packet)->tp_snaplen;
+
+    if (packetAddress(packet)->sll_hatype != ARPHRD_CAN)
+        return false;
+#ifdef CANFD_MTU
+    if (snapLength == CANFD_MTU)
+        return true;
+#endif
+    return snapLength == CAN_MTU;
+}
+
+/*
+    A packet socket receives a single protocol, or all of them, while classic
+    and FD frames have protocols of their own. Instead of ETH_P_ALL and a
+    check of every Ethernet packet of the host in user space, the socket
+    accepts only the CAN protocols in the kernel.
+*/
+static bool attachCanProtocolFilter(int fd)
+{
+#ifdef ETH_P_CANFD
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_CAN, 1, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_CANFD, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+        BPF_STMT(BPF_RET | BPF_K, 0)
+    };
+#else
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_CAN, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+        BPF_STMT(BPF_RET | BPF_K, 0)
+    };
+#endif
+
+    struct sock_fprog fprog;
+    fprog.len = sizeof(code) / sizeof(code[0]);
+    fprog.filter = code;
+    return ::setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) != -1;
+}
+
+static inline struct tpacket_block_desc *blockDescriptor(const void *block)
+{
+    return static_cast<struct tpacket_block_desc *>(const_cast<void *>(block));
+}
+
+CanCaptureFrame::CanCaptureFrame()
+    : header(Q_NULLPTR)
+    , remaining(0)
+{
+}
+
+// points to the first CAN packet at or after packet
+CanCaptureFrame::CanCaptureFrame(const void *packet, int packetCount)
+    : header(Q_NULLPTR)
+    , remaining(0)
+{
+    const char *current = static_cast<const char *>(packet);
+
+    while (packetCount > 0) {
+        if (isCanPacket(current)) {
+            header = current;
+            remaining = packetCount;
+            return;
+        }
+        if (--packetCount > 0)
+            current += packetHeader(current)->tp_next_offset;
+    }
+}
+
+const char *CanCaptureFrame::data() const
+{
+    return static_cast<const char *>(header) + packetHeader(header)->tp_mac;
+}
+
+int CanCaptureFrame::size() const
+{
+    return packetHeader(header)->tp_snaplen;
+}
+
+uint CanCaptureFrame::id() const
+{
+    quint32 canId;
+    ::memcpy(&canId, data(), sizeof(canId));
+    return canId;
+}
+
+uint CanCaptureFrame::canId() const
+{
+    return id() & CAN_EFF_MASK;
+}
+
+int CanCaptureFrame::dataLength() const
+{
+    return static_cast<quint8>(data()[offsetof(struct can_frame, can_dlc)]);
+}
+
+const char *CanCaptureFrame::payload() const
+{
+    return data() + offsetof(struct can_frame, data);
+}
+
+bool CanCaptureFrame::isFdFrame() const
+{
+#ifdef CANFD_MTU
+    return size() == CANFD_MTU;
+#else
+    return false;
+#endif
+}
+
+qint64 CanCaptureFrame::timestamp() const
+{
+    return qint64(packetHeader(header)->tp_sec) * 1000000000 + packetHeader(header)->tp_nsec;
+}
+
+int CanCaptureFrame::interfaceIndex() const
+{
+    return packetAddress(header)->sll_ifindex;
+}
+
+/*!
+    Copies the frame out of the ring, use it for frames that have to outlive
+    the release of their block.
+ */
+CanFrame CanCaptureFrame::toCanFrame() const
+{
+    const uint rawId = id();
+
+    CanFrame frame;
+    if (rawId & CAN_ERR_FLAG)
+        frame.setFrameType(CanFrame::ErrorFrame);
+    else if (rawId & CAN_RTR_FLAG)
+        frame.setFrameType(CanFrame::RtrFrame);
+    else if (isFdFrame())
+        frame.setFrameType(CanFrame::FdFrame);
+    else
+        frame.setFrameType(CanFrame::DataFrame);
+
+    frame.setId(rawId);
+    frame.setDataLength(dataLength());
+    frame.setData(payload(), frame.maxDataLength());
+    if (isFdFrame())
+        frame.setFdFrameFlags(static_cast<CanFrame::CanFdFrameFlags>(static_cast<quint8>(data()[offsetof(struct canfd_frame, flags)])));
+    frame.setTimestamp(timestamp(), CanFrame::SoftwareTimestamp);
+    frame.setInterfaceIndex(interfaceIndex());
+
+    return frame;
+}
+
+CanCaptureFrame CanCaptureFrame::next() const
+{
+    if (!header || remaining <= 1)
+        return CanCaptureFrame();
+
+    return CanCaptureFrame(static_cast<const char *>(header) + packetHeader(header)->tp_next_offset,
+                           remaining - 1);
+}
+
+CanCaptureBlock::CanCaptureBlock()
+    : block(Q_NULLPTR)
+    , index(-1)
+{
+}
+
+int CanCaptureBlock::frameCount() const
+{
+    return blockDescriptor(block)->hdr.bh1.num_pkts;
+}
+
+quint64 CanCaptureBlock::sequenceNumber() const
+{
+    return blockDescriptor(block)->hdr.bh1.seq_num;
+}
+
+CanCaptureFrame CanCaptureBlock::firstFrame() const
+{
+    if (!block || frameCount() == 0)
+        return CanCaptureFrame();
+
+    return CanCaptureFrame(static_cast<const char *>(block) + blockDescriptor(block)->hdr.bh1.offset_to_first_pkt,
+                           frameCount());
+}
+
+CanCaptureSocket::CanCaptureSocket(QObject *parent)
+    : CanAbstractSocket(PacketSocket, *new CanCaptureSocketPrivate, parent)
+{
+}
+
+CanCaptureSocket::~CanCaptureSocket()
+{
+}
+
+bool CanCaptureSocket::connectToInterface(const QString &interfaceName, OpenMode mode)
+{
+    if (mode & QIODevice::WriteOnly) {
+        setSocketError(CanAbstractSocket::UnsupportedSocketOperationError, tr("Capture socket is receive only"));
+        return false;
+    }
+
+    return CanAbstractSocket::connectToInterface(interfaceName, mode);
+}
+
+void CanCaptureSocket::setSocketOption(CanCaptureSocket::CanCaptureSocketOption option, const QVariant &value)
+{
+    Q_D(CanCaptureSocket);
+    d->setSocketOption(option, value);
+}
+
+QVariant CanCaptureSocket::socketOption(CanCaptureSocket::CanCaptureSocketOption option)
+{
+    Q_D(CanCaptureSocket);
+    return d->socketOption(option);
+}
+
+void CanCaptureSocket::setBlockSize(int bytes)
+{
+    setSocketOption(CanCaptureSocket::BlockSizeOption, QVariant::fromValue(bytes));
+}
+
+int CanCaptureSocket::blockSize()
+{
+    return socketOption(CanCaptureSocket::BlockSizeOption).toInt();
+}
+
+void CanCaptureSocket::setBlockCount(int count)
+{
+    setSocketOption(CanCaptureSocket::BlockCountOption, QVariant::fromValue(count));
+}
+
+int CanCaptureSocket::blockCount()
+{
+    return socketOption(CanCaptureSocket::BlockCountOption).toInt();
+}
+
+void CanCaptureSocket::setBlockTimeout(int msecs)
+{
+    setSocketOption(CanCaptureSocket::BlockTimeoutOption, QVariant::fromValue(msecs));
+}
+
+int CanCaptureSocket::blockTimeout()
+{
+    return socketOption(CanCaptureSocket::BlockTimeoutOption).toInt();
+}
+
+/*!
+    Returns the oldest ready block that was not handed out yet, or an invalid
+    block if the kernel is still filling it.
+ */
+CanCaptureBlock CanCaptureSocket::nextBlock()
+{
+    Q_D(CanCaptureSocket);
+    return d->nextBlock();
+}
+
+void CanCaptureSocket::releaseBlock(CanCaptureBlock &block)
+{
+    Q_D(CanCaptureSocket);
+    d->releaseBlock(block);
+}
+
+/*!
+    Returns the number of frames the kernel dropped because no block of the
+    ring was free.
+ */
+quint64 CanCaptureSocket::droppedFrames()
+{
+    Q_D(CanCaptureSocket);
+    return d->droppedFrames();
+}
+
+CanCaptureSocketPrivate::CanCaptureSocketPrivate()
+    : CanAbstractSocketPrivate(0, 0)
+    , blockSize(CAN_CAPTURE_DEFAULT_BLOCK_SIZE)
+    , blockCount(CAN_CAPTURE_DEFAULT_BLOCK_COUNT)
+    , blockTimeout(CAN_CAPTURE_DEFAULT_BLOCK_TIMEOUT)
+    , ring(Q_NULLPTR)
+    , releaseIndex(0)
+    , heldBlocks(0)
+    , dropCount(0)
+{
+}
+
+CanCaptureSocketPrivate::~CanCaptureSocketPrivate()
+{
+}
+
+bool CanCaptureSocketPrivate::connectToInterface(const QString &interfaceName)
+{
+    struct ifreq ifr;
+    struct sockaddr_ll addr;
+    struct tpacket_req3 req;
+    int version = TPACKET_V3;
+
+    // no protocol until bind(), so nothing is queued before the filter is attached
+    descriptor = ::socket(AF_PACKET, SOCK_RAW, 0);
+
+    if (descriptor == -1) {
+        setError(getSystemError());
+        return false;
+    }
+
+    if (!attachCanProtocolFilter(descriptor)) {
+        setError(getSystemError());
+        return false;
+    }
+
+    if (::fcntl(descriptor, F_SETFL , O_NONBLOCK) == -1) {
+        setError(getSystemError());
+        return false;
+    }
+
+    ::memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    // ETH_P_ALL only to receive both CAN protocols, the filter drops the rest
+    addr.sll_protocol = htons(ETH_P_ALL);
+
+    if (interfaceName.isEmpty())
+        addr.sll_ifindex = 0;
+    else {
+        ::strcpy(ifr.ifr_name, interfaceName.toLocal8Bit().constData());
+        if (::ioctl(descriptor, SIOCGIFINDEX, &ifr) == -1) {
+            setError(getSystemError());
+            return false;
+        }
+        addr.sll_ifindex = ifr.ifr_ifindex;
+    }
+
+    if (::setsockopt(descriptor, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) {
+        setError(getSystemError());
+        return false;
+    }
+
+    ::memset(&req, 0, sizeof(req));
+    req.tp_block_size = blockSize;
+    req.tp_block_nr = blockCount;
+    req.tp_frame_size = CAN_CAPTURE_FRAME_SIZE;
+    req.tp_frame_nr = (blockSize / CAN_CAPTURE_FRAME_SIZE) * blockCount;
+    req.tp_retire_blk_tov = blockTimeout;
+
+    if (::setsockopt(descriptor, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1) {
+        setError(getSystemError());
+        return false;
+    }
+
+    void *mapped = ::mmap(Q_NULLPTR, size_t(blockSize) * blockCount, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, descriptor, 0);
+    if (mapped == MAP_FAILED) {
+        setError(getSystemError());
+        return false;
+    }
+    ring = static_cast<char *>(mapped);
+    releaseIndex = 0;
+    heldBlocks = 0;
+    dropCount = 0;
+
+    if (::bind(descriptor, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        setError(getSystemError());
+        return false;
+    }
+
+    return true;
+}
+
+void CanCaptureSocketPrivate::disconnectFromInterface()
+{
+    if (ring) {
+        ::munmap(ring, size_t(blockSize) * blockCount);
+        ring = Q_NULLPTR;
+    }
+    releaseIndex = 0;
+    heldBlocks = 0;
+
+    CanAbstractSocketPrivate::disconnectFromInterface();
+}
+
+bool CanCaptureSocketPrivate::setSocketOption(CanCaptureSocket::CanCaptureSocketOption option, const QVariant &value)
+{
+    Q_Q(CanCaptureSocket);
+
+    if (!value.canConvert<int>())
+        return false;
+
+    // ring geometry is applied on the next connect
+    const int newValue = value.toInt();
+
+    switch (option) {
+    case CanCaptureSocket::BlockSizeOption:
+        if (newValue <= 0 || newValue % ::getpagesize() != 0 || newValue % CAN_CAPTURE_FRAME_SIZE != 0) {
+            setError(CanAbstractSocketErrorInfo(CanAbstractSocket::UnsupportedSocketOperationError,
+                                                CanCaptureSocket::tr("Block size must be a multiple of the page size and of %1 bytes")
+                                                .arg(CAN_CAPTURE_FRAME_SIZE)));
+            break;
+        }
+        if (newValue != blockSize) {
+            blockSize = newValue;
+            emit q->blockSizeChanged();
+        }
+        return true;
+    case CanCaptureSocket::BlockCountOption:
+        if (newValue <= 0) {
+            setError(CanAbstractSocketErrorInfo(CanAbstractSocket::UnsupportedSocketOperationError));
+            break;
+        }
+        if (newValue != blockCount) {
+            blockCount = newValue;
+            emit q->blockCountChanged();
+        }
+        return true;
+    case CanCaptureSocket::BlockTimeoutOption:
+        if (newValue < 0) {
+            setError(CanAbstractSocketErrorInfo(CanAbstractSocket::UnsupportedSocketOperationError));
+            break;
+        }
+        if (newValue != blockTimeout) {
+            blockTimeout = newValue;
+            emit q->blockTimeoutChanged();
+        }
+        return true;
+    }
+
+    return false;
+}
+
+QVariant CanCaptureSocketPrivate::socketOption(CanCaptureSocket::CanCaptureSocketOption option)
+{
+    QVariant result;
+
+    switch (option) {
+    case CanCaptureSocket::BlockSizeOption:
+        result.setValue(blockSize);
+        break;
+    case CanCaptureSocket::BlockCountOption:
+        result.setValue(blockCount);
+        break;
+    case CanCaptureSocket::BlockTimeoutOption:
+        result.setValue(blockTimeout);
+        break;
+    }
+
+    return result;
+}
+
+bool CanCaptureSocketPrivate::isBlockReady(int index) const
+{
+    const struct tpacket_block_desc *block = blockDescriptor(ring + size_t(index) * blockSize);
+    return (__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) != 0;
+}
+
+bool CanCaptureSocketPrivate::readNotification()
+{
+    Q_Q(CanCaptureSocket);
+
+    const int index = (releaseIndex + heldBlocks) % blockCount;
+
+    if (!ring || heldBlocks == blockCount || !isBlockReady(index)) {
+        // only blocks held by the application are ready, wait for a release
+        setReadNotificationEnabled(false);
+        return false;
+    }
+
+    if (!emittedReadyRead) {
+        emittedReadyRead = true;
+        emit q->readyRead();
+        emittedReadyRead = false;
+    }
+
+    // the block was not taken, don't spin on it until nextBlock() is called
+    if (heldBlocks < blockCount && index == (releaseIndex + heldBlocks) % blockCount)
+        setReadNotificationEnabled(false);
+
+    return true;
+}
+
+CanCaptureBlock CanCaptureSocketPrivate::nextBlock()
+{
+    CanCaptureBlock block;
+
+    if (!ring)
+        return block;
+
+    if (!isReadNotificationEnabled())
+        setReadNotificationEnabled(true);
+
+    const int index = (releaseIndex + heldBlocks) % blockCount;
+    if (heldBlocks == blockCount || !isBlockReady(index))
+        return block;
+
+    block.block = ring + size_t(index) * blockSize;
+    block.index = index;
+    ++heldBlocks;
+
+    return block;
+}
+
+void CanCaptureSocketPrivate::releaseBlock(CanCaptureBlock &block)
+{
+    if (!ring || !block.isValid())
+        return;
+
+    if (block.index != releaseIndex) {
+        setError(CanAbstractSocketErrorInfo(CanAbstractSocket::OperationError,
+                                            CanCaptureSocket::tr("Capture blocks must be released in order")));
+        return;
+    }
+
+    __atomic_store_n(&blockDescriptor(block.block)->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+
+    releaseIndex = (releaseIndex + 1) % blockCount;
+    --heldBlocks;
+    block = CanCaptureBlock();
+
+    if (!isReadNotificationEnabled())
+        setReadNotificationEnabled(true);
+}
+
+quint64 CanCaptureSocketPrivate::droppedFrames()
+{
+    struct tpacket_stats_v3 stats;
+    socklen_t length = sizeof(stats);
+
+    // the kernel resets its counters on every read
+    if (descriptor != -1
+            && ::getsockopt(descriptor, SOL_PACKET, PACKET_STATISTICS, &stats, &length) == 0)
+        dropCount += stats.tp_drops;
+
+    return dropCount;
+}
+
+#include "moc_cancapturesocket.cpp"
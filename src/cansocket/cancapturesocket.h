@@ -0,0 +1,127 @@
+/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#ifndef CANCAPTURESOCKET_H
+#define CANCAPTURESOCKET_H
+
+#include <CanSocket/cansocketglobal.h>
+#include <CanSocket/canabstractsocket.h>
+#include <CanSocket/canframe.h>
+
+class CanCaptureSocketPrivate;
+
+class CANSOCKET_EXPORT CanCaptureFrame
+{
+public:
+    CanCaptureFrame();
+
+    bool isValid() const { return header != Q_NULLPTR; }
+
+    const char *data() const;
+    int size() const;
+
+    uint id() const;
+    uint canId() const;
+    int dataLength() const;
+    const char *payload() const;
+
+    bool isFdFrame() const;
+    qint64 timestamp() const;
+    int interfaceIndex() const;
+
+    CanFrame toCanFrame() const;
+
+    CanCaptureFrame next() const;
+
+private:
+    friend class CanCaptureBlock;
+    CanCaptureFrame(const void *header, int remaining);
+
+    const void *header;
+    int remaining;
+};
+
+class CANSOCKET_EXPORT CanCaptureBlock
+{
+public:
+    CanCaptureBlock();
+
+    bool isValid() const { return block != Q_NULLPTR; }
+
+    int frameCount() const;
+    quint64 sequenceNumber() const;
+
+    CanCaptureFrame firstFrame() const;
+
+private:
+    friend class CanCaptureSocketPrivate;
+
+    const void *block;
+    int index;
+};
+
+class CANSOCKET_EXPORT CanCaptureSocket : public CanAbstractSocket
+{
+    Q_OBJECT
+
+    Q_PROPERTY(int blockSize READ blockSize WRITE setBlockSize NOTIFY blockSizeChanged)
+    Q_PROPERTY(int blockCount READ blockCount WRITE setBlockCount NOTIFY blockCountChanged)
+    Q_PROPERTY(int blockTimeout READ blockTimeout WRITE setBlockTimeout NOTIFY blockTimeoutChanged)
+
+public:
+    enum CanCaptureSocketOption {
+        BlockSizeOption,
+        BlockCountOption,
+        BlockTimeoutOption
+    };
+    Q_ENUM(CanCaptureSocketOption)
+
+    explicit CanCaptureSocket(QObject *parent = Q_NULLPTR);
+    virtual ~CanCaptureSocket();
+
+    bool connectToInterface(const QString &interfaceName,
+                            OpenMode mode = QIODevice::ReadOnly) Q_DECL_OVERRIDE;
+
+    void setSocketOption(CanCaptureSocketOption option, const QVariant &value);
+    QVariant socketOption(CanCaptureSocketOption option);
+
+    void setBlockSize(int bytes);
+    int blockSize();
+
+    void setBlockCount(int count);
+    int blockCount();
+
+    void setBlockTimeout(int msecs);
+    int blockTimeout();
+
+    CanCaptureBlock nextBlock();
+    void releaseBlock(CanCaptureBlock &block);
+
+    quint64 droppedFrames();
+
+Q_SIGNALS:
+    void blockSizeChanged();
+    void blockCountChanged();
+    void blockTimeoutChanged();
+
+private:
+    Q_DISABLE_COPY(CanCaptureSocket)
+    Q_DECLARE_PRIVATE(CanCaptureSocket)
+};
+
+#endif // CANCAPTURESOCKET_H
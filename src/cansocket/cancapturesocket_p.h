@@ -0,0 +1,57 @@
+/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#ifndef CANCAPTURESOCKET_P_H
+#define CANCAPTURESOCKET_P_H
+
+#include <CanSocket/cancapturesocket.h>
+#include <private/canabstractsocket_p.h>
+
+class CanCaptureSocketPrivate : CanAbstractSocketPrivate
+{
+    Q_DECLARE_PUBLIC(CanCaptureSocket)
+
+public:
+    CanCaptureSocketPrivate();
+    virtual ~CanCaptureSocketPrivate();
+
+    bool connectToInterface(const QString &interfaceName) Q_DECL_OVERRIDE;
+    void disconnectFromInterface() Q_DECL_OVERRIDE;
+
+    bool setSocketOption(CanCaptureSocket::CanCaptureSocketOption option, const QVariant &value);
+    QVariant socketOption(CanCaptureSocket::CanCaptureSocketOption option);
+
+    bool readNotification() Q_DECL_OVERRIDE;
+
+    bool isBlockReady(int index) const;
+    CanCaptureBlock nextBlock();
+    void releaseBlock(CanCaptureBlock &block);
+
+    quint64 droppedFrames();
+
+    int blockSize;
+    int blockCount;
+    int blockTimeout;
+
+    char *ring;
+    int releaseIndex;
+    int heldBlocks;
+    quint64 dropCount;
+};
+
+#endif // CANCAPTURESOCKET_P_H
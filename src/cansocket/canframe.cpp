@@ -21,6 +21,10 @@
 
 #include <qdebug.h>
 #include <qdatastream.h>
+#include <qhash.h>
+#include <qreadwritelock.h>
+
+#include <net/if.h>
 
 #ifndef QT_NO_DATASTREAM
 
@@ -29,37 +33,92 @@ QDataStream &operator<<(QDataStream &stream, const CanFrame &frame)
     if (!frame.isValid())
         return stream;
 
+    if (frame.isXlFrame()) {
+        // struct canxl_frame up to the end of the payload
+        stream << frame.d->id
+               << frame.d->flags
+               << frame.d->sdt
+               << frame.d->dlen
+               << frame.d->af;
+        stream.writeRawData(frame.d->data.constData(), frame.d->dlen);
+        return stream;
+    }
+
     stream << frame.d->id
-           << frame.d->dlen
+           << static_cast<quint8>(frame.d->dlen)
            << frame.d->flags
            << frame.d->res0
            << frame.d->res1;
 
-    for (int i = 0; i < frame.d->data.length(); ++i) {
-        stream << (qint8)frame.d->data[i];
-    }
+    stream.writeRawData(frame.d->data.constData(), frame.d->data.size());
 
     return stream;
 }
 
 QDataStream &operator>>(QDataStream &stream, CanFrame &frame)
 {
+    // can_dlc or len of classic and fd frames, flags of XL frames
+    quint8 lengthOrFlags;
     stream >> frame.d->id
-            >> frame.d->dlen
-            >> frame.d->flags
-            >> frame.d->res0
-            >> frame.d->res1;
-
-    int dataLength = dataLengthFromResBytes(frame.d->res0, frame.d->res1);
-
-    if (dataLength) {
-        frame.d->data = QVector<char>(dataLength, '0');
-        qint8 idata;
-        for (int i = 0; i < dataLength; ++i) {
-            stream >> idata;
-            frame.d->data[i] = idata;
+           >> lengthOrFlags;
+
+    int dataLength;
+    bool trailer;
+
+    if (lengthOrFlags & CANXL_XLF) {
+        quint16 xlDataLength;
+        stream >> frame.d->sdt
+               >> xlDataLength
+               >> frame.d->af;
+
+        dataLength = xlDataLength;
+        trailer = lengthOrFlags & CAN_XL_TRAILER_FLAG;
+
+        if (dataLength >= CANXL_MIN_DLEN && dataLength <= CANXL_MAX_DLEN) {
+            frame.d->dlen = xlDataLength;
+            frame.d->flags = lengthOrFlags & ~CAN_XL_TRAILER_FLAG;
+            frame.d->res0 = 0;
+            frame.d->res1 = 0;
+            frame.d->data.resize(CANXL_MAX_DLEN);
+            stream.readRawData(frame.d->data.data(), dataLength);
+            ::memset(frame.d->data.data() + dataLength, 0, CANXL_MAX_DLEN - dataLength);
+        }
+        else
+            dataLength = -1;
+    }
+    else {
+        frame.d->dlen = lengthOrFlags;
+        stream >> frame.d->flags
+               >> frame.d->res0
+               >> frame.d->res1;
+
+        dataLength = dataLengthFromResBytes(frame.d->res0, frame.d->res1);
+        trailer = hasTrailerFromResBytes(frame.d->res1);
+
+        if (dataLength > 0) {
+            frame.d->res1 &= ~CAN_RES1_TRAILER_FLAG;
+            frame.d->sdt = 0;
+            frame.d->af = 0;
+            frame.d->data.resize(dataLength);
+            stream.readRawData(frame.d->data.data(), dataLength);
         }
     }
+
+    if (dataLength > 0) {
+        // receive metadata appended by the socket
+        if (trailer) {
+            stream >> frame.d->timestamp
+                   >> frame.d->timestampSource;
+            stream.skipRawData(sizeof(CanFrameTrailer::reserved));
+            stream >> frame.d->interfaceIndex;
+        }
+        else {
+            frame.d->timestamp = 0;
+            frame.d->timestampSource = CanFrame::NoTimestamp;
+            frame.d->interfaceIndex = 0;
+        }
+        frame.d->updateType();
+    }
     else {
         frame.setCanId(static_cast<uint>(CanFrame::UnknownCanFrameError));
         frame.toErrorFrame();
@@ -70,6 +129,142 @@ QDataStream &operator>>(QDataStream &stream, CanFrame &frame)
 
 #endif //QT_NO_DATASTREAM
 
+/*
+    Takes the frame from a record of the read buffer of CanRawSocket, as the
+    data stream does but without a stream in between. Returns the size of the
+    record, 0 if size doesn't hold it completely. An invalid record ends up as
+    unknown error frame, consuming its header only.
+*/
+qint64 CanFrameData::fromRecord(const char *record, qint64 size)
+{
+    if (size < CAN_RAW_HEADER_SIZE)
+        return 0;
+
+    // can_dlc or len of classic and fd frames, flags of XL frames
+    const quint8 lengthOrFlags = record[CAN_LEN_BYTE];
+    const bool xlFrame = lengthOrFlags & CANXL_XLF;
+    const qint64 headerSize = xlFrame ? CANXL_HDR_SIZE : CAN_RAW_HEADER_SIZE;
+    int dataLength;
+    bool trailer;
+
+    if (xlFrame) {
+        dataLength = xlDataLengthFromRecord(record);
+        if (dataLength < CANXL_MIN_DLEN || dataLength > CANXL_MAX_DLEN)
+            dataLength = -1;
+        trailer = lengthOrFlags & CAN_XL_TRAILER_FLAG;
+    }
+    else {
+        dataLength = dataLengthFromResBytes(record[RES0_BYTE], record[RES1_BYTE]);
+        trailer = hasTrailerFromResBytes(record[RES1_BYTE]);
+    }
+
+    if (size < headerSize)
+        return 0;
+
+    ::memcpy(&id, record, sizeof(id));
+
+    if (dataLength < 0) {
+        id = (id & ~CAN_EFF_MASK) | CanFrame::UnknownCanFrameError;
+        flags = 0;
+        sdt = 0;
+        af = 0;
+        timestamp = 0;
+        timestampSource = CanFrame::NoTimestamp;
+        interfaceIndex = 0;
+        toErrorFrame();
+        return headerSize;
+    }
+
+    const qint64 recordSize = headerSize + dataLength + (trailer ? sizeof(CanFrameTrailer) : 0);
+    if (size < recordSize)
+        return 0;
+
+    if (xlFrame) {
+        dlen = dataLength;
+        flags = lengthOrFlags & ~CAN_XL_TRAILER_FLAG;
+        sdt = record[CANXL_SDT_BYTE];
+        ::memcpy(&af, record + CANXL_AF_BYTE, sizeof(af));
+        res0 = 0;
+        res1 = 0;
+        data.resize(CANXL_MAX_DLEN);
+        ::memcpy(data.data(), record + headerSize, dataLength);
+        ::memset(data.data() + dataLength, 0, CANXL_MAX_DLEN - dataLength);
+    }
+    else {
+        dlen = lengthOrFlags;
+        flags = record[CAN_FLAGS_BYTE];
+        res0 = record[RES0_BYTE];
+        res1 = record[RES1_BYTE] & ~CAN_RES1_TRAILER_FLAG;
+        sdt = 0;
+        af = 0;
+        data.resize(dataLength);
+        ::memcpy(data.data(), record + headerSize, dataLength);
+    }
+
+    // receive metadata appended by the socket
+    if (trailer) {
+        CanFrameTrailer frameTrailer;
+        ::memcpy(&frameTrailer, record + headerSize + dataLength, sizeof(frameTrailer));
+        timestamp = frameTrailer.timestamp;
+        timestampSource = frameTrailer.timestampSource;
+        interfaceIndex = frameTrailer.interfaceIndex;
+    }
+    else {
+        timestamp = 0;
+        timestampSource = CanFrame::NoTimestamp;
+        interfaceIndex = 0;
+    }
+
+    updateType();
+    return recordSize;
+}
+
+// size of the record of a valid frame written by toRecord()
+qint64 CanFrameData::recordSize(bool trailer) const
+{
+    const qint64 trailerSize = trailer ? sizeof(CanFrameTrailer) : 0;
+    if (type == CanFrame::XlFrame)
+        return CANXL_HDR_SIZE + dlen + trailerSize;
+    return CAN_RAW_HEADER_SIZE + data.size() + trailerSize;
+}
+
+/*
+    Writes the frame as the data stream does. The trailer with the receive
+    metadata is flagged and appended on request, as by the socket.
+*/
+void CanFrameData::toRecord(char *record, bool trailer) const
+{
+    qint64 payloadEnd;
+
+    ::memcpy(record, &id, sizeof(id));
+
+    if (type == CanFrame::XlFrame) {
+        record[CANXL_FLAGS_BYTE] = flags | (trailer ? CAN_XL_TRAILER_FLAG : 0);
+        record[CANXL_SDT_BYTE] = sdt;
+        ::memcpy(record + CANXL_LEN_BYTE, &dlen, sizeof(dlen));
+        ::memcpy(record + CANXL_AF_BYTE, &af, sizeof(af));
+        ::memcpy(record + CANXL_HDR_SIZE, data.constData(), dlen);
+        payloadEnd = CANXL_HDR_SIZE + dlen;
+    }
+    else {
+        record[CAN_LEN_BYTE] = static_cast<quint8>(dlen);
+        record[CAN_FLAGS_BYTE] = flags;
+        record[RES0_BYTE] = res0;
+        record[RES1_BYTE] = res1 | (trailer ? CAN_RES1_TRAILER_FLAG : 0);
+        ::memcpy(record + CAN_RAW_HEADER_SIZE, data.constData(), data.size());
+        payloadEnd = CAN_RAW_HEADER_SIZE + data.size();
+    }
+
+    if (trailer) {
+        CanFrameTrailer frameTrailer;
+        ::memset(&frameTrailer, 0, sizeof(frameTrailer));
+        frameTrailer.timestamp = timestamp;
+        frameTrailer.timestampSource = timestampSource;
+        frameTrailer.interfaceIndex = interfaceIndex;
+        ::memcpy(record + payloadEnd, &frameTrailer, sizeof(frameTrailer));
+    }
+}
+
 #ifndef QT_NO_DEBUG_STREAM
 QDebug operator<<(QDebug dbg, const CanFrame &frame)
 {
@@ -82,12 +277,55 @@ QDebug operator<<(QDebug dbg, const CanFrame &frame)
         dbg << QByteArray("ERRORFRAME");
     else if (frame.isRtrFrame())
         dbg << QByteArray("RTRFRAME");
+    else if (frame.isXlFrame())
+        dbg << QByteArray("XLFRAME")
+            << QString::number(frame.sduType(), 16)
+            << frame.virtualCanId()
+            << QString::number(frame.acceptanceField(), 16);
+
+    if (frame.hasTimestamp())
+        dbg << QString::fromLatin1("%1.%2").arg(frame.timestamp() / 1000000000)
+                                          .arg(frame.timestamp() % 1000000000, 9, 10, QLatin1Char('0'));
+
+    if (frame.interfaceIndex() > 0)
+        dbg << frame.interfaceName();
 
     return dbg;
 }
 
 #endif //QT_NO_DEBUG_STREAM
 
+// Interface names are looked up once per index, frames of a multi interface
+// socket would otherwise need an ioctl each.
+class CanInterfaceNameCache
+{
+public:
+    QString name(int index)
+    {
+        {
+            QReadLocker locker(&lock);
+            QHash<int, QString>::const_iterator it = names.constFind(index);
+            if (it != names.constEnd())
+                return it.value();
+        }
+
+        char buffer[IF_NAMESIZE];
+        if (!::if_indextoname(index, buffer))
+            return QString(); // not cached, the interface may show up later
+
+        const QString interfaceName = QString::fromLocal8Bit(buffer);
+        QWriteLocker locker(&lock);
+        names.insert(index, interfaceName);
+        return interfaceName;
+    }
+
+private:
+    QReadWriteLock lock;
+    QHash<int, QString> names;
+};
+
+Q_GLOBAL_STATIC(CanInterfaceNameCache, interfaceNameCache)
+
 
 CanFrame::CanFrame()
     : d(new CanFrameData)
@@ -104,6 +342,30 @@ CanFrame::CanFrame(CanFrame::CanFrameType type)
 CanFrame::CanFrame(const CanFrame &rhs)
     : d(rhs.d)
 {
+    // an editor classifies the frame again only when it goes away
+    if (d.constData()->editors) {
+        d.detach();
+        d->updateType();
+    }
+}
+
+/*!
+    \fn CanFrame::CanFrame(CanFrame &&rhs)
+
+    Moves the frame data of \a rhs into the new frame, without touching the
+    reference count. The moved-from frame may only be assigned to or
+    destroyed afterwards.
+ */
+
+CanFrame &CanFrame::operator =(const CanFrame &rhs)
+{
+    d = rhs.d;
+    // an editor classifies the frame again only when it goes away
+    if (d.constData()->editors) {
+        d.detach();
+        d->updateType();
+    }
+    return *this;
 }
 
 CanFrame::~CanFrame()
@@ -117,7 +379,7 @@ void CanFrame::swap(CanFrame &other)
 
 bool CanFrame::isValid() const
 {
-    return frameType() != UnknownFrame;
+    return d->type != UnknownFrame;
 }
 
 bool CanFrame::isEmpty() const
@@ -135,32 +397,42 @@ void CanFrame::clear()
     d->clear();
 }
 
-int CanFrame::maxDataLength() const
+static inline int maxDataLengthOf(CanFrame::CanFrameType type)
 {
-    if (isDataFrame())
+    switch (type) {
+    case CanFrame::DataFrame:
+    case CanFrame::ErrorFrame:
         return CAN_MAX_DLEN;
-    else if (isFdFrame())
+    case CanFrame::FdFrame:
         return CANFD_MAX_DLEN;
-    else if (isErrorFrame())
-        return CAN_MAX_DLEN;
-    else if (isRtrFrame())
+    case CanFrame::RtrFrame:
         return 0;
-    else
+    case CanFrame::XlFrame:
+        return CANXL_MAX_DLEN;
+    default:
         return -1;
+    }
+}
+
+int CanFrame::maxDataLength() const
+{
+    return maxDataLengthOf(d->type);
 }
 
 int CanFrame::maxDataTransferUnit() const
 {
-    if (isDataFrame())
+    switch (d->type) {
+    case DataFrame:
+    case ErrorFrame:
+    case RtrFrame:
         return CAN_MTU;
-    else if (isFdFrame())
+    case FdFrame:
         return CANFD_MTU;
-    else if (isErrorFrame())
-        return CAN_MTU;
-    else if (isRtrFrame())
-        return CAN_MTU;
-    else
+    case XlFrame:
+        return CANXL_MTU;
+    default:
         return -1;
+    }
 }
 
 void CanFrame::setFrameType(CanFrameType frameType)
@@ -178,43 +450,47 @@ void CanFrame::setFrameType(CanFrameType frameType)
     case CanFrame::RtrFrame:
         d->toRtrFrame();
         break;
+    case CanFrame::XlFrame:
+        d->toXlFrame();
+        break;
     default:
         clear();
     }
 }
 
+/*!
+    Returns the type of the frame. The type is kept up to date by every
+    function changing the frame, so this and the isDataFrame() family are
+    a single load.
+ */
 CanFrame::CanFrameType CanFrame::frameType() const
 {
-    if (isDataFrame())
-        return CanFrame::DataFrame;
-    else if (isFdFrame())
-        return CanFrame::FdFrame;
-    else if (isErrorFrame())
-        return CanFrame::ErrorFrame;
-    else if (isRtrFrame())
-        return CanFrame::RtrFrame;
-    else
-        return CanFrame::UnknownFrame;
+    return d->type;
 }
 
 bool CanFrame::isDataFrame() const
 {
-    return d->isDataFrame();
+    return d->type == DataFrame;
 }
 
 bool CanFrame::isFdFrame() const
 {
-    return d->isFdFrame();
+    return d->type == FdFrame;
 }
 
 bool CanFrame::isErrorFrame() const
 {
-    return d->isErrorFrame();
+    return d->type == ErrorFrame;
 }
 
 bool CanFrame::isRtrFrame() const
 {
-    return d->isRtrFrame();
+    return d->type == RtrFrame;
+}
+
+bool CanFrame::isXlFrame() const
+{
+    return d->type == XlFrame;
 }
 
 void CanFrame::toDataFrame()
@@ -237,6 +513,17 @@ void CanFrame::toRtrFrame()
     d->toRtrFrame();
 }
 
+/*!
+    Converts the frame to a CAN XL frame. The identifier keeps its 11 bit
+    priority, the payload up to 2048 bytes and at least 1 byte.
+
+    \sa setSduType(), setVirtualCanId(), setAcceptanceField()
+ */
+void CanFrame::toXlFrame()
+{
+    d->toXlFrame();
+}
+
 bool CanFrame::operator ==(const CanFrame &rhs) const
 {
     return d == rhs.d;
@@ -252,22 +539,30 @@ bool CanFrame::operator <(const CanFrame &rhs) const
     return (canId() & CAN_EFF_MASK) < (rhs.canId() & CAN_EFF_MASK);
 }
 
+// the priority of XL frames, the virtual CAN network id isn't part of it
+static inline uint canIdMask(const CanFrameData *d)
+{
+    return (d->flags & CANXL_XLF) ? CANXL_PRIO_MASK : CAN_EFF_MASK;
+}
+
 uint CanFrame::canId() const
 {
-    return d->id & CAN_EFF_MASK;
+    return d->id & canIdMask(d.constData());
 }
 
 void CanFrame::setCanId(uint id)
 {
-    if ((d->id & CAN_EFF_MASK) != (id & CAN_EFF_MASK)) {
-        d->id &= ~CAN_EFF_MASK;
-        d->id |= id & CAN_EFF_MASK;
+    const uint mask = canIdMask(d.constData());
+    if ((d->id & mask) != (id & mask)) {
+        d->id &= ~mask;
+        d->id |= id & mask;
     }
 }
 
 void CanFrame::setId(uint id)
 {
     d->id = id;
+    d->updateType();
 }
 
 uint CanFrame::id() const
@@ -281,6 +576,10 @@ void CanFrame::setFrameFormat(CanFrameFormat format)
         d->setEffFlag(true);
     else if (format == StandardFrameFormat && d->effFlag() == true)
         d->setEffFlag(false);
+    else
+        return;
+
+    d->updateType();
 }
 
 
@@ -292,20 +591,29 @@ CanFrame::CanFrameFormat CanFrame::frameFormat() const
     return CanFrame::StandardFrameFormat;
 }
 
-bool CanFrame::setDataLength(int bytes)
+// the payload length the type of the frame allows
+static inline bool isValidDataLength(const CanFrameData *d, int bytes)
 {
-    if (!isValid())
+    if (d->type == CanFrame::UnknownFrame)
         return false;
-    else if (dataLength() == bytes)
+    else if (d->dlen == bytes)
         return true;
-    else if (isRtrFrame() || isErrorFrame())
+    else if (d->type == CanFrame::RtrFrame || d->type == CanFrame::ErrorFrame)
+        return false;
+    else if (d->type == CanFrame::XlFrame && bytes < CANXL_MIN_DLEN)
         return false;
-    else if (bytes >= 0 && bytes <= maxDataLength()) {
-        d->dlen = bytes;
-        return true;
-    }
     else
+        return bytes >= 0 && bytes <= maxDataLengthOf(d->type);
+}
+
+bool CanFrame::setDataLength(int bytes)
+{
+    if (!isValidDataLength(d.constData(), bytes))
         return false;
+
+    if (d.constData()->dlen != bytes)
+        d->dlen = bytes;
+    return true;
 }
 
 int CanFrame::dataLength() const
@@ -327,14 +635,81 @@ CanFrame::CanFdFrameFlags CanFrame::fdFrameFlags() const
     return static_cast<CanFrame::CanFdFrameFlags>(d->flags);
 }
 
+bool CanFrame::setXlFrameFlags(CanXlFrameFlags flags)
+{
+    if (frameType() != XlFrame)
+        return false;
+
+    d->flags = CANXL_XLF | (static_cast<quint8>(flags) & CANXL_SEC);
+    return true;
+}
+
+CanFrame::CanXlFrameFlags CanFrame::xlFrameFlags() const
+{
+    if (!isXlFrame())
+        return NoXlFrameFlag;
+    return static_cast<CanFrame::CanXlFrameFlags>(d->flags & CANXL_SEC);
+}
+
+bool CanFrame::setSduType(quint8 type)
+{
+    if (frameType() != XlFrame)
+        return false;
+
+    d->sdt = type;
+    return true;
+}
+
+/*!
+    Returns the service data unit type of a CAN XL frame, which tells the
+    receiver how to interpret the payload.
+ */
+quint8 CanFrame::sduType() const
+{
+    return d->sdt;
+}
+
+bool CanFrame::setVirtualCanId(quint8 vcid)
+{
+    if (frameType() != XlFrame)
+        return false;
+
+    d->id = (d->id & ~CANXL_VCID_MASK) | (uint(vcid) << CANXL_VCID_OFFSET);
+    return true;
+}
+
+/*!
+    Returns the virtual CAN network id of a CAN XL frame. Kernels before
+    Linux 6.9 don't pass it, frames are sent and received with id 0 there.
+ */
+quint8 CanFrame::virtualCanId() const
+{
+    if (!isXlFrame())
+        return 0;
+    return (d->id & CANXL_VCID_MASK) >> CANXL_VCID_OFFSET;
+}
+
+bool CanFrame::setAcceptanceField(quint32 field)
+{
+    if (frameType() != XlFrame)
+        return false;
+
+    d->af = field;
+    return true;
+}
+
+quint32 CanFrame::acceptanceField() const
+{
+    return d->af;
+}
+
 void CanFrame::setData(const char *data, int len)
 {
     if (len == -1 || len > maxDataLength())
         len = maxDataLength();
 
-    for (int i = 0; i < len; ++i) {
-        d->data[i] = data[i];
-    }
+    if (len > 0)
+        ::memcpy(d->data.data(), data, len);
 }
 
 
@@ -391,3 +766,269 @@ CanFrame::CanFrameErrors CanFrame::error() const
 
     return errors;
 }
+
+void CanFrame::setTimestamp(qint64 nsecs, TimestampSource source)
+{
+    d->timestamp = nsecs;
+    d->timestampSource = static_cast<quint8>(source);
+}
+
+/*!
+    Returns the receive time of the frame in nanoseconds. Software timestamps
+    count from the Unix epoch, hardware timestamps from the epoch of the
+    device clock.
+
+    \sa timestampSource(), CanRawSocket::setTimestamping()
+ */
+qint64 CanFrame::timestamp() const
+{
+    return d->timestamp;
+}
+
+CanFrame::TimestampSource CanFrame::timestampSource() const
+{
+    return static_cast<CanFrame::TimestampSource>(d->timestampSource);
+}
+
+void CanFrame::setInterfaceIndex(int index)
+{
+    d->interfaceIndex = index;
+}
+
+/*!
+    Returns the index of the interface the frame was received on, or 0 if it
+    is unknown.
+
+    \sa interfaceName(), CanRawSocket::setReceiveInterfaceIndex()
+ */
+int CanFrame::interfaceIndex() const
+{
+    return d->interfaceIndex;
+}
+
+/*!
+    Returns the name of the interface the frame was received on, or an empty
+    string if it is unknown. Names are cached per index, so an interface
+    renamed while the application runs keeps its old name.
+ */
+QString CanFrame::interfaceName() const
+{
+    if (d->interfaceIndex <= 0)
+        return QString();
+    return interfaceNameCache()->name(d->interfaceIndex);
+}
+
+/*!
+    \class CanFrameEditor
+
+    Changes a frame in place with a single detach. The frame data is made
+    unshared when the editor is created, the setters then write to it
+    without the reference count check every setter of CanFrame does, and a
+    changed id classifies the frame again once, when the editor goes away.
+
+    A copy of the frame made while an editor exists gets frame data of its
+    own, it keeps the state of the frame at the time of the copy. The frame
+    itself must not be assigned to or destroyed before the editor.
+ */
+CanFrameEditor::CanFrameEditor(CanFrame &frame)
+    : d(frame.d.data())
+    , payload(d->data.data())
+    , idChanged(false)
+{
+    ++d->editors;
+}
+
+CanFrameEditor::~CanFrameEditor()
+{
+    --d->editors;
+    if (idChanged)
+        d->updateType();
+}
+
+void CanFrameEditor::setId(uint id)
+{
+    d->id = id;
+    idChanged = true;
+}
+
+void CanFrameEditor::setCanId(uint id)
+{
+    const uint mask = canIdMask(d);
+    d->id = (d->id & ~mask) | (id & mask);
+}
+
+bool CanFrameEditor::setDataLength(int bytes)
+{
+    if (!isValidDataLength(d, bytes))
+        return false;
+
+    d->dlen = bytes;
+    return true;
+}
+
+void CanFrameEditor::setData(const char *data, int len)
+{
+    const int maxLength = maxDataLengthOf(d->type);
+    if (len == -1 || len > maxLength)
+        len = maxLength;
+
+    if (len > 0)
+        ::memcpy(payload, data, len);
+}
+
+void CanFrameEditor::setTimestamp(qint64 nsecs, CanFrame::TimestampSource source)
+{
+    d->timestamp = nsecs;
+    d->timestampSource = static_cast<quint8>(source);
+}
+
+void CanFrameEditor::setInterfaceIndex(int index)
+{
+    d->interfaceIndex = index;
+}
+
+/*!
+    \class CanFrameView
+
+    Reads a frame in place from its record in the read buffer of a
+    CanRawSocket, without copying it into a CanFrame. A view is valid only
+    as long as the record it points to, see CanRawSocket::peekFrames().
+
+    The type is classified from the record the same way as when reading a
+    CanFrame, a record which would be read as unknown frame is invalid.
+ */
+
+// metadata the socket appended to the record, null if there is none
+static inline const char *recordTrailer(const char *record)
+{
+    if (isXlFrameRecord(record)) {
+        if (!(record[CANXL_FLAGS_BYTE] & CAN_XL_TRAILER_FLAG))
+            return Q_NULLPTR;
+        return record + CANXL_HDR_SIZE + xlDataLengthFromRecord(record);
+    }
+
+    const quint8 res1 = record[RES1_BYTE];
+    if (!hasTrailerFromResBytes(res1))
+        return Q_NULLPTR;
+    return record + (res1 & ~CAN_RES1_TRAILER_FLAG);
+}
+
+bool CanFrameView::isValid() const
+{
+    return record && frameType() != CanFrame::UnknownFrame;
+}
+
+CanFrame::CanFrameType CanFrameView::frameType() const
+{
+    if (!record)
+        return CanFrame::UnknownFrame;
+
+    const uint rawId = id();
+    const bool errFlag = rawId & CAN_ERR_FLAG;
+    const bool rtrFlag = rawId & CAN_RTR_FLAG;
+
+    if (isXlFrameRecord(record)) {
+        const int dlen = xlDataLengthFromRecord(record);
+        if (dlen >= CANXL_MIN_DLEN && dlen <= CANXL_MAX_DLEN
+                && !errFlag && !rtrFlag && !(rawId & CAN_EFF_FLAG))
+            return CanFrame::XlFrame;
+        return CanFrame::UnknownFrame;
+    }
+
+    const quint8 dlen = record[CAN_LEN_BYTE];
+
+    switch (dataLengthFromResBytes(record[RES0_BYTE], record[RES1_BYTE])) {
+    case CAN_MAX_DLEN:
+        if (!errFlag && !rtrFlag && dlen <= CAN_MAX_DLEN)
+            return CanFrame::DataFrame;
+        if (errFlag && !rtrFlag && dlen == CAN_MAX_DLEN)
+            return CanFrame::ErrorFrame;
+        if (!errFlag && rtrFlag && dlen == 0)
+            return CanFrame::RtrFrame;
+        return CanFrame::UnknownFrame;
+#ifdef CANFD_MTU
+    case CANFD_MAX_DLEN:
+        if (!errFlag && !rtrFlag && dlen <= CANFD_MAX_DLEN)
+            return CanFrame::FdFrame;
+        return CanFrame::UnknownFrame;
+#endif
+    default:
+        return CanFrame::UnknownFrame;
+    }
+}
+
+uint CanFrameView::id() const
+{
+    quint32 rawId;
+    ::memcpy(&rawId, record, sizeof(rawId));
+    return rawId;
+}
+
+uint CanFrameView::canId() const
+{
+    return id() & (isXlFrameRecord(record) ? CANXL_PRIO_MASK : CAN_EFF_MASK);
+}
+
+int CanFrameView::dataLength() const
+{
+    if (isXlFrameRecord(record))
+        return xlDataLengthFromRecord(record);
+    return static_cast<quint8>(record[CAN_LEN_BYTE]);
+}
+
+const char *CanFrameView::data() const
+{
+    return record + (isXlFrameRecord(record) ? CANXL_HDR_SIZE : CAN_RAW_HEADER_SIZE);
+}
+
+qint64 CanFrameView::timestamp() const
+{
+    const char *trailer = recordTrailer(record);
+    if (!trailer)
+        return 0;
+
+    qint64 nsecs;
+    ::memcpy(&nsecs, trailer + offsetof(CanFrameTrailer, timestamp), sizeof(nsecs));
+    return nsecs;
+}
+
+CanFrame::TimestampSource CanFrameView::timestampSource() const
+{
+    const char *trailer = recordTrailer(record);
+    if (!trailer)
+        return CanFrame::NoTimestamp;
+
+    return static_cast<CanFrame::TimestampSource>(trailer[offsetof(CanFrameTrailer, timestampSource)]);
+}
+
+int CanFrameView::interfaceIndex() const
+{
+    const char *trailer = recordTrailer(record);
+    if (!trailer)
+        return 0;
+
+    qint32 index;
+    ::memcpy(&index, trailer + offsetof(CanFrameTrailer, interfaceIndex), sizeof(index));
+    return index;
+}
+
+/*!
+    Returns the size of the record in the read buffer, including the
+    metadata appended by the socket.
+ */
+int CanFrameView::size() const
+{
+    return int(receivedRecordSize(record));
+}
+
+/*!
+    Copies the frame out of the read buffer, use it for frames that have to
+    outlive the consumption of their record.
+ */
+CanFrame CanFrameView::toCanFrame() const
+{
+    CanFrame frame;
+    if (record)
+        frame.d->fromRecord(record, size());
+    return frame;
+}
@@ -21,6 +21,7 @@
 
 #include <QtCore/qshareddata.h>
 #include <QtCore/qmetatype.h>
+#include <QtCore/qstring.h>
 
 #include <cansocketglobal.h>
 
@@ -36,6 +37,15 @@ class CanFrameData;
     CANSOCKET_EXPORT QDebug operator<<(QDebug, const CanFrame &);
 #endif //QT_NO_DEBUG_STREAM
 
+struct CanFramePoolStatistics
+{
+    quint64 hits;
+    quint64 misses;
+    qint64 framesInUse;
+    qint64 peakFramesInUse;
+    qint64 pooledFrames;
+};
+
 class CANSOCKET_EXPORT CanFrame
 {
     Q_GADGET
@@ -45,6 +55,7 @@ public:
         FdFrame,
         ErrorFrame,
         RtrFrame,
+        XlFrame,
 
         UnknownFrame = -1,
     };
@@ -99,9 +110,29 @@ public:
     Q_FLAG(CanFdFrameFlag)
     Q_DECLARE_FLAGS(CanFdFrameFlags, CanFdFrameFlag)
 
+    enum CanXlFrameFlag {
+        NoXlFrameFlag = 0x00,
+        SimpleExtendedContentFlag = 0x01
+    };
+    Q_FLAG(CanXlFrameFlag)
+    Q_DECLARE_FLAGS(CanXlFrameFlags, CanXlFrameFlag)
+
+    enum TimestampSource {
+        NoTimestamp,
+        SoftwareTimestamp,
+        HardwareTimestamp,
+        RawHardwareTimestamp
+    };
+    Q_ENUM(TimestampSource)
+
     CanFrame();
     CanFrame(CanFrameType type);
     CanFrame(const CanFrame &rhs);
+#ifdef Q_COMPILER_RVALUE_REFS
+    CanFrame(CanFrame &&rhs) Q_DECL_NOTHROW : d(std::move(rhs.d)) {}
+    CanFrame &operator =(CanFrame &&rhs) Q_DECL_NOTHROW { swap(rhs); return *this; }
+#endif
+    CanFrame &operator =(const CanFrame &rhs);
     ~CanFrame();
 
     void swap(CanFrame &other);
@@ -122,11 +153,13 @@ public:
     bool isFdFrame() const;
     bool isErrorFrame() const;
     bool isRtrFrame() const;
+    bool isXlFrame() const;
 
     void toDataFrame();
     void toFdFrame();
     void toErrorFrame();
     void toRtrFrame();
+    void toXlFrame();
 
     bool operator ==(const CanFrame &rhs) const;
     bool operator !=(const CanFrame &rhs) const { return !operator==(rhs); }
@@ -148,6 +181,18 @@ public:
     bool setFdFrameFlags(CanFdFrameFlags flags);
     CanFdFrameFlags fdFrameFlags() const;
 
+    bool setXlFrameFlags(CanXlFrameFlags flags);
+    CanXlFrameFlags xlFrameFlags() const;
+
+    bool setSduType(quint8 type);
+    quint8 sduType() const;
+
+    bool setVirtualCanId(quint8 vcid);
+    quint8 virtualCanId() const;
+
+    bool setAcceptanceField(quint32 field);
+    quint32 acceptanceField() const;
+
     void setData(const char* data, int len = -1);
 
     char *data();
@@ -160,19 +205,92 @@ public:
 
     CanFrameErrors error() const;
 
+    void setTimestamp(qint64 nsecs, TimestampSource source = SoftwareTimestamp);
+    qint64 timestamp() const;
+    TimestampSource timestampSource() const;
+    bool hasTimestamp() const { return timestampSource() != NoTimestamp; }
+
+    void setInterfaceIndex(int index);
+    int interfaceIndex() const;
+    QString interfaceName() const;
+
+    static void reservePool(int frames);
+    static CanFramePoolStatistics poolStatistics();
+    static void resetPoolStatistics();
+
 protected:
     QSharedDataPointer<CanFrameData> d;
 
 private:
     friend CANSOCKET_EXPORT QDataStream &operator<<(QDataStream &, const CanFrame &);
     friend CANSOCKET_EXPORT QDataStream &operator>>(QDataStream &, CanFrame &);
+    friend class CanRawSocketPrivate;
+    friend class CanFrameCodec;
+    friend class CanFrameEditor;
+    friend class CanFrameView;
 };
 Q_DECLARE_SHARED(CanFrame)
 
+class CANSOCKET_EXPORT CanFrameEditor
+{
+public:
+    explicit CanFrameEditor(CanFrame &frame);
+    ~CanFrameEditor();
+
+    void setId(uint id);
+    void setCanId(uint id);
+    bool setDataLength(int bytes);
+    void setData(const char *data, int len);
+
+    inline char *data() { return payload; }
+    inline char &operator[](int i) { return payload[i]; }
+
+    void setTimestamp(qint64 nsecs, CanFrame::TimestampSource source = CanFrame::SoftwareTimestamp);
+    void setInterfaceIndex(int index);
+
+private:
+    Q_DISABLE_COPY(CanFrameEditor)
+
+    CanFrameData *d;
+    char *payload;
+    bool idChanged;
+};
+
+class CANSOCKET_EXPORT CanFrameView
+{
+public:
+    CanFrameView() : record(Q_NULLPTR) {}
+    explicit CanFrameView(const char *record) : record(record) {}
+
+    bool isNull() const { return record == Q_NULLPTR; }
+    bool isValid() const;
+
+    CanFrame::CanFrameType frameType() const;
+
+    uint id() const;
+    uint canId() const;
+    int dataLength() const;
+    const char *data() const;
+
+    qint64 timestamp() const;
+    CanFrame::TimestampSource timestampSource() const;
+    int interfaceIndex() const;
+
+    const char *rawData() const { return record; }
+    int size() const;
+
+    CanFrame toCanFrame() const;
+
+private:
+    const char *record;
+};
+Q_DECLARE_TYPEINFO(CanFrameView, Q_PRIMITIVE_TYPE);
+
 Q_DECLARE_OPERATORS_FOR_FLAGS(CanFrame::CanFrameErrors)
 Q_DECLARE_OPERATORS_FOR_FLAGS(CanFrame::CanFrameIdMasks)
 Q_DECLARE_OPERATORS_FOR_FLAGS(CanFrame::CanFrameIdFlags)
 Q_DECLARE_OPERATORS_FOR_FLAGS(CanFrame::CanFdFrameFlags)
+Q_DECLARE_OPERATORS_FOR_FLAGS(CanFrame::CanXlFrameFlags)
 
 Q_DECLARE_METATYPE(CanFrame)
 Q_DECLARE_METATYPE(CanFrame::CanFrameErrors)
@@ -20,12 +20,15 @@
 #define CANFRAME_P
 
 #include <QtCore/qshareddata.h>
-#include <QtCore/qvector.h>
+
+#include <CanSocket/canframe.h>
 
 #ifdef Q_OS_LINUX
 #   include <linux/can.h>
 #   include <linux/can/raw.h>
 #   include <linux/can/error.h>
+#   include <stdlib.h>
+#   include <string.h>
 #else
 #   error Unsupported OS
 #endif
@@ -42,6 +45,85 @@
 #   define CAN_MAX_DLEN 8
 #endif
 
+// CAN XL arrived with Linux 6.2, older headers get the layout of struct canxl_frame
+#ifndef CANXL_XLF
+#   define CANXL_XLF 0x80
+#   define CANXL_SEC 0x01
+#   define CANXL_MIN_DLEN 1
+#   define CANXL_MAX_DLEN 2048
+#   define CANXL_HDR_SIZE 12
+#   define CANXL_MTU (CANXL_HDR_SIZE + CANXL_MAX_DLEN)
+#   define CANXL_PRIO_MASK CAN_SFF_MASK
+#endif
+
+#ifndef CANXL_VCID_OFFSET
+#   define CANXL_VCID_OFFSET 16
+#   define CANXL_VCID_MASK (0xFF << CANXL_VCID_OFFSET)
+#endif
+
+//length, flags and reserved bytes according to can.h
+#define CAN_LEN_BYTE 4
+#define CAN_FLAGS_BYTE 5
+#define RES0_BYTE 6
+#define RES1_BYTE 7
+
+#define CAN_RAW_HEADER_SIZE 8 // id and the bytes telling the frame type and length
+
+// offsets in struct canxl_frame, the flags share the position of can_dlc
+#define CANXL_FLAGS_BYTE 4
+#define CANXL_SDT_BYTE 5
+#define CANXL_LEN_BYTE 6
+#define CANXL_AF_BYTE 8
+
+// Frames received with metadata (e.g. timestamps) are followed by a
+// CanFrameTrailer in the read buffer, which is flagged in the RES1 byte.
+// CAN XL frames have no reserved bytes, their trailer is flagged by an
+// unused bit of the XL flags, which never reaches the kernel.
+#define CAN_RES1_TRAILER_FLAG 0x80
+#define CAN_XL_TRAILER_FLAG 0x40
+
+struct CanFrameTrailer
+{
+    qint64 timestamp;
+    quint8 timestampSource;
+    quint8 reserved[3];
+    qint32 interfaceIndex;
+};
+
+inline bool hasTrailerFromResBytes(const quint8 &res1)
+{
+    return (res1 & CAN_RES1_TRAILER_FLAG) != 0;
+}
+
+// byte 4 is can_dlc or len of classic and FD frames, which never reach the XL flag
+inline bool isXlFrameRecord(const char *data)
+{
+    return (static_cast<quint8>(data[CANXL_FLAGS_BYTE]) & CANXL_XLF) != 0;
+}
+
+inline int xlDataLengthFromRecord(const char *data)
+{
+    quint16 len;
+    ::memcpy(&len, data + CANXL_LEN_BYTE, sizeof(len));
+    return len;
+}
+
+// size of the tagged frame at data together with its trailer
+inline qint64 receivedRecordSize(const char *data)
+{
+    if (isXlFrameRecord(data)) {
+        qint64 recordSize = CANXL_HDR_SIZE + xlDataLengthFromRecord(data);
+        if (data[CANXL_FLAGS_BYTE] & CAN_XL_TRAILER_FLAG)
+            recordSize += sizeof(CanFrameTrailer);
+        return recordSize;
+    }
+
+    const quint8 res1 = data[RES1_BYTE];
+    qint64 recordSize = res1 & ~CAN_RES1_TRAILER_FLAG;
+    if (hasTrailerFromResBytes(res1))
+        recordSize += sizeof(CanFrameTrailer);
+    return recordSize;
+}
 
 inline quint8 res0FromCanMtu(int mtu)
 {
@@ -71,8 +153,10 @@ inline quint8 res1FromCanMtu(int mtu)
     }
 }
 
-inline int dataLengthFromResBytes(const quint8 &res0, const quint8 &res1)
+inline int dataLengthFromResBytes(const quint8 &res0, quint8 res1)
 {
+    res1 &= ~CAN_RES1_TRAILER_FLAG;
+
     if (res0 == CAN_MAX_DLEN && res1 == CAN_MTU)
         return CAN_MAX_DLEN;
 #ifdef CANFD_MTU
@@ -83,10 +167,122 @@ inline int dataLengthFromResBytes(const quint8 &res0, const quint8 &res1)
         return -1;
 }
 
+// payload of a canfd_frame, stored inline by every frame
+#define CAN_FRAME_INLINE_DLEN 64
+
+/*
+    Payload of a frame, kept inside the frame data up to the size of a
+    canfd_frame payload, so that creating, copying and converting classic
+    and FD frames allocates nothing besides the frame data. The payload of
+    CAN XL frames moves to a side buffer, which is kept for the next XL
+    payload once allocated. Grown bytes are zero, like those of a vector.
+*/
+class CanFramePayload
+{
+public:
+    CanFramePayload()
+        : payloadSize(0)
+        , xlData(Q_NULLPTR)
+    {
+    }
+
+    CanFramePayload(const CanFramePayload &other)
+        : payloadSize(0)
+        , xlData(Q_NULLPTR)
+    {
+        *this = other;
+    }
+
+    ~CanFramePayload()
+    {
+        ::free(xlData);
+    }
+
+    CanFramePayload &operator =(const CanFramePayload &other)
+    {
+        if (this == &other)
+            return *this;
+
+        if (other.payloadSize > CAN_FRAME_INLINE_DLEN)
+            reserveSideBuffer();
+        payloadSize = other.payloadSize;
+        ::memcpy(data(), other.constData(), payloadSize);
+        return *this;
+    }
+
+    inline int size() const { return payloadSize; }
+    inline int length() const { return payloadSize; }
+    inline bool isEmpty() const { return payloadSize == 0; }
+
+    inline char *data() { return payloadSize > CAN_FRAME_INLINE_DLEN ? xlData : inlineData; }
+    inline const char *data() const { return constData(); }
+    inline const char *constData() const { return payloadSize > CAN_FRAME_INLINE_DLEN ? xlData : inlineData; }
+
+    inline char &operator [](int i) { Q_ASSERT(i >= 0 && i < payloadSize); return data()[i]; }
+    inline const char &operator [](int i) const { return at(i); }
+    inline const char &at(int i) const { Q_ASSERT(i >= 0 && i < payloadSize); return constData()[i]; }
+
+    inline void clear() { payloadSize = 0; }
+
+    inline void fill(char value) { ::memset(data(), value, payloadSize); }
+
+    void resize(int size)
+    {
+        Q_ASSERT(size >= 0 && size <= CANXL_MAX_DLEN);
+
+        char *target = inlineData;
+        if (size > CAN_FRAME_INLINE_DLEN) {
+            reserveSideBuffer();
+            if (payloadSize <= CAN_FRAME_INLINE_DLEN)
+                ::memcpy(xlData, inlineData, payloadSize);
+            target = xlData;
+        }
+        else if (payloadSize > CAN_FRAME_INLINE_DLEN) {
+            ::memcpy(inlineData, xlData, size);
+        }
+
+        if (size > payloadSize)
+            ::memset(target + payloadSize, 0, size - payloadSize);
+        payloadSize = size;
+    }
+
+private:
+    inline void reserveSideBuffer()
+    {
+        if (!xlData) {
+            xlData = static_cast<char *>(::malloc(CANXL_MAX_DLEN));
+            Q_CHECK_PTR(xlData);
+        }
+    }
+
+    int payloadSize;
+    char *xlData;
+    Q_DECL_ALIGN(8) char inlineData[CAN_FRAME_INLINE_DLEN];
+};
+
+/*
+    Memory of CanFrameData. Freed frame data goes to a cache of the thread,
+    which exchanges batches with a shared pool, so that frames created and
+    destroyed at bus rate don't go through malloc(). Pooled memory is kept
+    until the library is unloaded.
+*/
+class CanFramePool
+{
+public:
+    static void *allocate(size_t size);
+    static void release(void *block, size_t size);
+
+    static void reserve(int blocks);
+    static CanFramePoolStatistics statistics();
+    static void resetStatistics();
+};
 
 class CanFrameData : public QSharedData
 {
 public:
+    static void *operator new(size_t size) { return CanFramePool::allocate(size); }
+    static void operator delete(void *block, size_t size) { CanFramePool::release(block, size); }
+
     CanFrameData()
         : QSharedData()
         , id(0)
@@ -94,7 +290,14 @@ public:
         , flags(0)
         , res0(0)
         , res1(0)
+        , sdt(0)
+        , af(0)
         , data()
+        , timestamp(0)
+        , timestampSource(0)
+        , editors(0)
+        , interfaceIndex(0)
+        , type(CanFrame::UnknownFrame)
     {
     }
 
@@ -105,7 +308,14 @@ public:
         , flags(other.flags)
         , res0(other.res0)
         , res1(other.res1)
+        , sdt(other.sdt)
+        , af(other.af)
         , data(other.data)
+        , timestamp(other.timestamp)
+        , timestampSource(other.timestampSource)
+        , editors(0)
+        , interfaceIndex(other.interfaceIndex)
+        , type(other.type)
     {
     }
 
@@ -119,7 +329,13 @@ public:
         flags = 0;
         res0 = 0;
         res1 = 0;
+        sdt = 0;
+        af = 0;
         data.clear();
+        timestamp = 0;
+        timestampSource = 0;
+        interfaceIndex = 0;
+        type = CanFrame::UnknownFrame;
     }
 
     inline void setErrFlag(bool err)
@@ -146,6 +362,18 @@ public:
             id &= ~CAN_EFF_FLAG;
     }
 
+    // the virtual CAN network id shares the id with the priority of XL frames
+    inline void dropXlFields()
+    {
+        if (!(flags & CANXL_XLF))
+            return;
+
+        id &= CANXL_PRIO_MASK;
+        flags = 0;
+        sdt = 0;
+        af = 0;
+    }
+
     inline bool errFlag() const {
         return (id & CAN_ERR_FLAG) != 0;
     }
@@ -182,6 +410,18 @@ public:
     }
 
 
+    inline bool isXlFrame() const {
+        return (dlen >= CANXL_MIN_DLEN
+                && dlen <= CANXL_MAX_DLEN
+                && (flags & CANXL_XLF)
+                && res0 == 0
+                && res1 == 0
+                && data.size() == CANXL_MAX_DLEN
+                && !errFlag()
+                && !rtrFlag()
+                && !effFlag());
+    }
+
     inline bool isErrorFrame() const {
         return (dlen == CAN_MAX_DLEN
                 && res0 == res0FromCanMtu(CAN_MTU)
@@ -200,7 +440,25 @@ public:
                 && rtrFlag());
     }
 
+    // classifies the frame again, every mutator of the fields checked by the
+    // predicates above calls it, so that reading the type is a single load
+    inline void updateType() {
+        if (isDataFrame())
+            type = CanFrame::DataFrame;
+        else if (isFdFrame())
+            type = CanFrame::FdFrame;
+        else if (isErrorFrame())
+            type = CanFrame::ErrorFrame;
+        else if (isRtrFrame())
+            type = CanFrame::RtrFrame;
+        else if (isXlFrame())
+            type = CanFrame::XlFrame;
+        else
+            type = CanFrame::UnknownFrame;
+    }
+
     inline void toDataFrame() {
+        dropXlFields();
 
         if (dlen > CAN_MAX_DLEN)
             dlen = CAN_MAX_DLEN;
@@ -216,14 +474,20 @@ public:
             setRtrFlag(false);
         else if (errFlag())
             setErrFlag(false);
+
+        updateType();
     }
 
 
     inline void toFdFrame() {
+        dropXlFields();
 #ifdef CANFD_MTU
         if (dlen > CANFD_MAX_DLEN)
             dlen = CANFD_MAX_DLEN;
 
+        // only bit rate switch and error state indicator are fd flags
+        flags &= CANFD_BRS | CANFD_ESI;
+
         res0 = res0FromCanMtu(CANFD_MTU);
         res1 = res1FromCanMtu(CANFD_MTU);
 
@@ -233,13 +497,39 @@ public:
             setRtrFlag(false);
         else if (errFlag())
             setErrFlag(false);
-#else
-        return;
 #endif //CANFD_MTU
+
+        updateType();
     }
 
 
+    inline void toXlFrame() {
+
+        if (dlen < CANXL_MIN_DLEN)
+            dlen = CANXL_MIN_DLEN;
+        else if (dlen > CANXL_MAX_DLEN)
+            dlen = CANXL_MAX_DLEN;
+
+        // priority and virtual CAN network id, the CAN_*_FLAG bits are zero
+        if (flags & CANXL_XLF) {
+            id &= CANXL_PRIO_MASK | CANXL_VCID_MASK;
+            flags &= CANXL_XLF | CANXL_SEC;
+        }
+        else {
+            id &= CANXL_PRIO_MASK;
+            flags = CANXL_XLF;
+        }
+
+        res0 = 0;
+        res1 = 0;
+
+        data.resize(CANXL_MAX_DLEN);
+
+        updateType();
+    }
+
     inline void toErrorFrame() {
+        dropXlFields();
 
         if (dlen != CAN_MAX_DLEN)
             dlen = CAN_MAX_DLEN;
@@ -255,9 +545,12 @@ public:
             setRtrFlag(false);
         if (!errFlag())
             setErrFlag(true);
+
+        updateType();
     }
 
     inline void toRtrFrame() {
+        dropXlFields();
 
         if (dlen != 0)
             dlen = 0;
@@ -267,20 +560,43 @@ public:
         res0 = res0FromCanMtu(CAN_MTU);
         res1 = res1FromCanMtu(CAN_MTU);
 
-        data = QVector<char>(CAN_MAX_DLEN, '0');
+        data.resize(CAN_MAX_DLEN);
+        data.fill('0');
 
         if (!rtrFlag())
             setRtrFlag(true);
         if (errFlag())
             setErrFlag(false);
+
+        updateType();
+    }
+
+    // conversion from and to the tagged records of the CanRawSocket buffers
+    qint64 fromRecord(const char *record, qint64 size);
+    qint64 recordSize(bool trailer = false) const;
+    void toRecord(char *record, bool trailer = false) const;
+
+    inline bool hasReceiveMetadata() const {
+        return timestampSource != 0 || interfaceIndex != 0;
     }
 
     uint id;
-    quint8 dlen;
+    quint16 dlen;
     quint8 flags;
     quint8 res0;
     quint8 res1;
-    QVector<char> data;
+    quint8 sdt;
+    quint32 af;
+    CanFramePayload data;
+
+    qint64 timestamp;
+    quint8 timestampSource;
+    // CanFrameEditors writing to the data, copies made meanwhile detach
+    quint8 editors;
+    qint32 interfaceIndex;
+
+    // cached result of the predicates, see updateType()
+    CanFrame::CanFrameType type;
 };
 
 #endif // CANFRAME_P
@@ -0,0 +1,181 @@
+/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "canframecodec.h"
+#include "canframe_p.h"
+
+#include <QtCore/qdatastream.h>
+#include <QtCore/qiodevice.h>
+
+#include <limits>
+
+#ifndef QT_NO_DATASTREAM
+
+#define CAN_CODEC_MAGIC 0x464e4143 // "CANF" on little endian machines
+#define CAN_CODEC_MAGIC_SWAPPED 0x43414e46
+
+// header of a block of frames, the fields are native like the records
+struct CanFrameCodecHeader
+{
+    quint32 magic;
+    quint16 version;
+    quint16 headerSize;
+    quint32 frameCount;
+    quint32 dataSize;
+};
+
+/*!
+    \class CanFrameCodec
+
+    Serializes arrays of frames as one block: a versioned header followed by
+    the frames in the native canfd_frame and canxl_frame layouts, the same
+    records CanRawSocket keeps in its read buffer. Frames with a timestamp or
+    an interface index carry them in a trailer.
+
+    The block is written and read with writeRawData() and readRawData() as
+    a whole, instead of one stream operation per field. It is native like
+    the records, so it is only exchanged between machines of the same byte
+    order; readFrames() fails on a block of the other byte order.
+ */
+
+/*!
+    Writes the valid frames of \a frames, \a count in total, to \a stream as
+    one block. Invalid frames are skipped like by the stream operator.
+    Returns false if the stream can't take the block.
+ */
+bool CanFrameCodec::writeFrames(QDataStream &stream, const CanFrame *frames, int count)
+{
+    CanFrameCodecHeader header;
+    header.magic = CAN_CODEC_MAGIC;
+    header.version = CurrentVersion;
+    header.headerSize = sizeof(CanFrameCodecHeader);
+    header.frameCount = 0;
+
+    qint64 dataSize = 0;
+    for (int i = 0; i < count; ++i) {
+        const CanFrameData *d = frames[i].d.constData();
+        if (d->type == CanFrame::UnknownFrame)
+            continue;
+        dataSize += d->recordSize(d->hasReceiveMetadata());
+        ++header.frameCount;
+    }
+    header.dataSize = dataSize;
+
+    QByteArray block(dataSize, Qt::Uninitialized);
+    char *record = block.data();
+    for (int i = 0; i < count; ++i) {
+        const CanFrameData *d = frames[i].d.constData();
+        if (d->type == CanFrame::UnknownFrame)
+            continue;
+        const bool trailer = d->hasReceiveMetadata();
+        d->toRecord(record, trailer);
+        record += d->recordSize(trailer);
+    }
+
+    if (stream.writeRawData(reinterpret_cast<const char *>(&header), sizeof(header)) != sizeof(header)
+            || stream.writeRawData(block.constData(), block.size()) != block.size()) {
+        stream.setStatus(QDataStream::WriteFailed);
+        return false;
+    }
+    return true;
+}
+
+bool CanFrameCodec::writeFrames(QDataStream &stream, const QVector<CanFrame> &frames)
+{
+    return writeFrames(stream, frames.constData(), frames.size());
+}
+
+/*!
+    Reads the frames of one block from \a stream and appends them to
+    \a frames. Returns false if the block is corrupt, of a newer version or
+    of the other byte order.
+
+    Data written with the stream operator of CanFrame, which has no header,
+    is still read: without a block header every frame up to the end of the
+    stream is read with the stream operator, which needs the byte order of
+    \a stream set as it was for writing.
+ */
+bool CanFrameCodec::readFrames(QDataStream &stream, QVector<CanFrame> *frames)
+{
+    QIODevice *device = stream.device();
+    if (!device || !frames)
+        return false;
+
+    CanFrameCodecHeader header;
+    header.magic = 0;
+    if (device->peek(reinterpret_cast<char *>(&header.magic), sizeof(header.magic)) != sizeof(header.magic)
+            || header.magic != CAN_CODEC_MAGIC) {
+        if (header.magic == CAN_CODEC_MAGIC_SWAPPED) {
+            stream.setStatus(QDataStream::ReadCorruptData);
+            return false;
+        }
+
+        // frames of the stream operator
+        while (!stream.atEnd() && stream.status() == QDataStream::Ok) {
+            CanFrame frame;
+            stream >> frame;
+            if (stream.status() == QDataStream::Ok)
+                frames->append(frame);
+        }
+        return stream.status() == QDataStream::Ok;
+    }
+
+    if (stream.readRawData(reinterpret_cast<char *>(&header), sizeof(header)) != sizeof(header)
+            || header.version > CurrentVersion
+            || header.headerSize < sizeof(header)
+            || header.dataSize > quint32(std::numeric_limits<int>::max())
+            || header.frameCount > header.dataSize / CAN_RAW_HEADER_SIZE) {
+        stream.setStatus(QDataStream::ReadCorruptData);
+        return false;
+    }
+
+    // fields added by later versions of the header
+    const int extraHeaderSize = header.headerSize - sizeof(header);
+    if (extraHeaderSize > 0 && stream.skipRawData(extraHeaderSize) != extraHeaderSize) {
+        stream.setStatus(QDataStream::ReadPastEnd);
+        return false;
+    }
+
+    QByteArray block(header.dataSize, Qt::Uninitialized);
+    if (stream.readRawData(block.data(), block.size()) != block.size()) {
+        stream.setStatus(QDataStream::ReadPastEnd);
+        return false;
+    }
+
+    const int first = frames->size();
+    frames->resize(first + header.frameCount);
+    CanFrame *frame = frames->data() + first;
+
+    const char *record = block.constData();
+    qint64 leftSize = block.size();
+    for (quint32 i = 0; i < header.frameCount; ++i, ++frame) {
+        const qint64 recordSize = frame->d->fromRecord(record, leftSize);
+        if (recordSize <= 0
+                || recordSize != receivedRecordSize(record)
+                || frame->d->type == CanFrame::UnknownFrame) {
+            frames->resize(first);
+            stream.setStatus(QDataStream::ReadCorruptData);
+            return false;
+        }
+        record += recordSize;
+        leftSize -= recordSize;
+    }
+    return true;
+}
+
+#endif //QT_NO_DATASTREAM
@@ -0,0 +1,45 @@
+/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#ifndef CANFRAMECODEC_H
+#define CANFRAMECODEC_H
+
+#include <QtCore/qvector.h>
+
+#include <CanSocket/cansocketglobal.h>
+#include <CanSocket/canframe.h>
+
+#ifndef QT_NO_DATASTREAM
+
+class CANSOCKET_EXPORT CanFrameCodec
+{
+public:
+    enum Version {
+        Version1 = 1,
+
+        CurrentVersion = Version1
+    };
+
+    static bool writeFrames(QDataStream &stream, const CanFrame *frames, int count);
+    static bool writeFrames(QDataStream &stream, const QVector<CanFrame> &frames);
+    static bool readFrames(QDataStream &stream, QVector<CanFrame> *frames);
+};
+
+#endif //QT_NO_DATASTREAM
+
+#endif // CANFRAMECODEC_H
@@ -0,0 +1,308 @@
+/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "canframe.h"
+#include "canframe_p.h"
+
+#include <QtCore/qatomic.h>
+#include <QtCore/qmutex.h>
+
+#include <stdlib.h>
+
+#define CAN_FRAME_POOL_THREAD_CACHE 256 // blocks a thread keeps for itself
+#define CAN_FRAME_POOL_BATCH 64 // blocks moved between a thread cache and the shared pool
+
+struct CanFramePoolBlock
+{
+    CanFramePoolBlock *next;
+};
+
+class CanFrameSharedPool
+{
+public:
+    CanFrameSharedPool()
+        : freeList(Q_NULLPTR)
+        , freeBlocks(0)
+    {
+    }
+
+    ~CanFrameSharedPool()
+    {
+        while (freeList) {
+            CanFramePoolBlock *block = freeList;
+            freeList = block->next;
+            ::free(block);
+        }
+    }
+
+    // takes up to count blocks, returns the number taken
+    int take(CanFramePoolBlock **list, int count)
+    {
+        QMutexLocker locker(&mutex);
+
+        int taken = 0;
+        while (freeList && taken < count) {
+            CanFramePoolBlock *block = freeList;
+            freeList = block->next;
+            block->next = *list;
+            *list = block;
+            ++taken;
+        }
+        freeBlocks -= taken;
+        return taken;
+    }
+
+    void give(CanFramePoolBlock *first, CanFramePoolBlock *last, int count)
+    {
+        QMutexLocker locker(&mutex);
+        last->next = freeList;
+        freeList = first;
+        freeBlocks += count;
+    }
+
+    QMutex mutex;
+    CanFramePoolBlock *freeList;
+    int freeBlocks;
+
+    QAtomicInteger<quint64> hits;
+    QAtomicInteger<quint64> misses;
+    QAtomicInteger<qint64> allocatedBlocks;
+    QAtomicInteger<qint64> blocksInUse;
+    QAtomicInteger<qint64> peakBlocksInUse;
+};
+
+Q_GLOBAL_STATIC(CanFrameSharedPool, sharedPool)
+
+// trivially destructible, so that frames freed during the exit of a thread
+// still find it after the flusher below has run
+struct CanFrameThreadCache
+{
+    CanFramePoolBlock *freeList;
+    int freeBlocks;
+    bool finished;
+};
+
+static thread_local CanFrameThreadCache threadCache = { Q_NULLPTR, 0, false };
+
+// hands the cache of an exiting thread to the shared pool
+struct CanFrameThreadCacheFlusher
+{
+    ~CanFrameThreadCacheFlusher()
+    {
+        threadCache.finished = true;
+        if (!threadCache.freeList)
+            return;
+
+        if (sharedPool.isDestroyed()) {
+            while (threadCache.freeList) {
+                CanFramePoolBlock *block = threadCache.freeList;
+                threadCache.freeList = block->next;
+                ::free(block);
+            }
+        }
+        else {
+            CanFramePoolBlock *last = threadCache.freeList;
+            while (last->next)
+                last = last->next;
+            sharedPool()->give(threadCache.freeList, last, threadCache.freeBlocks);
+            threadCache.freeList = Q_NULLPTR;
+        }
+        threadCache.freeBlocks = 0;
+    }
+
+    inline void arm() {}
+};
+
+static thread_local CanFrameThreadCacheFlusher threadCacheFlusher;
+
+static inline void countAllocation(CanFrameSharedPool *pool, bool hit)
+{
+    if (hit)
+        pool->hits.fetchAndAddRelaxed(1);
+    else
+        pool->misses.fetchAndAddRelaxed(1);
+
+    const qint64 inUse = pool->blocksInUse.fetchAndAddRelaxed(1) + 1;
+    qint64 peak = pool->peakBlocksInUse.loadAcquire();
+    while (inUse > peak && !pool->peakBlocksInUse.testAndSetOrdered(peak, inUse, peak)) {
+    }
+}
+
+void *CanFramePool::allocate(size_t size)
+{
+    // frame data of a different size, which a subclass would have
+    if (size != sizeof(CanFrameData))
+        return ::operator new(size);
+
+    // frames created during static destruction, release() frees them like pool blocks
+    if (sharedPool.isDestroyed()) {
+        void *memory = ::malloc(sizeof(CanFrameData));
+        Q_CHECK_PTR(memory);
+        return memory;
+    }
+
+    CanFrameSharedPool *pool = sharedPool();
+
+    if (!threadCache.freeList && !threadCache.finished) {
+        threadCacheFlusher.arm();
+        threadCache.freeBlocks += pool->take(&threadCache.freeList, CAN_FRAME_POOL_BATCH);
+    }
+
+    if (threadCache.freeList) {
+        CanFramePoolBlock *block = threadCache.freeList;
+        threadCache.freeList = block->next;
+        --threadCache.freeBlocks;
+        countAllocation(pool, true);
+        return block;
+    }
+
+    // an exiting thread allocates from the shared pool directly
+    CanFramePoolBlock *block = Q_NULLPTR;
+    if (threadCache.finished && pool->take(&block, 1) == 1) {
+        countAllocation(pool, true);
+        return block;
+    }
+
+    void *memory = ::malloc(sizeof(CanFrameData));
+    Q_CHECK_PTR(memory);
+    pool->allocatedBlocks.fetchAndAddRelaxed(1);
+    countAllocation(pool, false);
+    return memory;
+}
+
+void CanFramePool::release(void *memory, size_t size)
+{
+    if (!memory)
+        return;
+
+    if (size != sizeof(CanFrameData)) {
+        ::operator delete(memory);
+        return;
+    }
+
+    if (sharedPool.isDestroyed()) {
+        ::free(memory);
+        return;
+    }
+
+    CanFrameSharedPool *pool = sharedPool();
+    pool->blocksInUse.fetchAndAddRelaxed(-1);
+
+    CanFramePoolBlock *block = static_cast<CanFramePoolBlock *>(memory);
+
+    if (threadCache.finished) {
+        pool->give(block, block, 1);
+        return;
+    }
+
+    if (!threadCache.freeList)
+        threadCacheFlusher.arm();
+
+    block->next = threadCache.freeList;
+    threadCache.freeList = block;
+    ++threadCache.freeBlocks;
+
+    // frames created by one thread and freed by another gather in the
+    // freeing thread, a batch goes back to the shared pool for the others
+    if (threadCache.freeBlocks > CAN_FRAME_POOL_THREAD_CACHE) {
+        CanFramePoolBlock *first = threadCache.freeList;
+        CanFramePoolBlock *last = first;
+        for (int i = 1; i < CAN_FRAME_POOL_BATCH; ++i)
+            last = last->next;
+        threadCache.freeList = last->next;
+        threadCache.freeBlocks -= CAN_FRAME_POOL_BATCH;
+        pool->give(first, last, CAN_FRAME_POOL_BATCH);
+    }
+}
+
+void CanFramePool::reserve(int blocks)
+{
+    CanFrameSharedPool *pool = sharedPool();
+    if (!pool)
+        return;
+
+    int missing;
+    {
+        QMutexLocker locker(&pool->mutex);
+        missing = blocks - pool->freeBlocks;
+    }
+
+    for (int i = 0; i < missing; ++i) {
+        CanFramePoolBlock *block = static_cast<CanFramePoolBlock *>(::malloc(sizeof(CanFrameData)));
+        if (!block)
+            break;
+        pool->allocatedBlocks.fetchAndAddRelaxed(1);
+        pool->give(block, block, 1);
+    }
+}
+
+CanFramePoolStatistics CanFramePool::statistics()
+{
+    CanFramePoolStatistics statistics = { 0, 0, 0, 0, 0 };
+
+    CanFrameSharedPool *pool = sharedPool();
+    if (!pool)
+        return statistics;
+
+    statistics.hits = pool->hits.loadAcquire();
+    statistics.misses = pool->misses.loadAcquire();
+    statistics.framesInUse = pool->blocksInUse.loadAcquire();
+    statistics.peakFramesInUse = pool->peakBlocksInUse.loadAcquire();
+    statistics.pooledFrames = pool->allocatedBlocks.loadAcquire() - statistics.framesInUse;
+    return statistics;
+}
+
+void CanFramePool::resetStatistics()
+{
+    CanFrameSharedPool *pool = sharedPool();
+    if (!pool)
+        return;
+
+    pool->hits.storeRelease(0);
+    pool->misses.storeRelease(0);
+    pool->peakBlocksInUse.storeRelease(pool->blocksInUse.loadAcquire());
+}
+
+/*!
+    Fills the pool of frame memory with at least \a frames frames, so that
+    as many frames can be created later without calling malloc(). Meant to
+    be called at startup, before frames are received at bus rate.
+
+    \sa poolStatistics()
+ */
+void CanFrame::reservePool(int frames)
+{
+    CanFramePool::reserve(frames);
+}
+
+/*!
+    Returns the statistics of the pool of frame memory: how many frames
+    were created from pooled memory and how many needed malloc(), since
+    the start or resetPoolStatistics(), and how many frames exist now and
+    existed at most. Pooled frames count the free memory of the shared pool
+    and of the caches of all threads.
+ */
+CanFramePoolStatistics CanFrame::poolStatistics()
+{
+    return CanFramePool::statistics();
+}
+
+void CanFrame::resetPoolStatistics()
+{
+    CanFramePool::resetStatistics();
+}
@@ -0,0 +1,348 @@
+/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "caniouring_p.h"
+
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CAN_IOURING_ENTRIES 64
+#define CAN_IOURING_BUFFER_GROUP 0
+
+static inline unsigned loadAcquire(const unsigned *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void storeRelease(unsigned *p, unsigned value)
+{
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+static inline int ioUringSetup(unsigned entries, struct io_uring_params *params)
+{
+    return ::syscall(__NR_io_uring_setup, entries, params);
+}
+
+static inline int ioUringEnter(int ringDescriptor, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return ::syscall(__NR_io_uring_enter, ringDescriptor, toSubmit, minComplete, flags, Q_NULLPTR, 0);
+}
+
+static inline int ioUringRegister(int ringDescriptor, unsigned opcode, void *arg, unsigned argCount)
+{
+    return ::syscall(__NR_io_uring_register, ringDescriptor, opcode, arg, argCount);
+}
+
+CanIoUring::CanIoUring()
+    : socketDescriptor(-1)
+    , ringDescriptor(-1)
+    , eventFd(-1)
+    , sqRing(MAP_FAILED)
+    , cqRing(MAP_FAILED)
+    , sqRingSize(0)
+    , cqRingSize(0)
+    , sqes(Q_NULLPTR)
+    , sqesSize(0)
+    , sqHead(Q_NULLPTR)
+    , sqTail(Q_NULLPTR)
+    , sqArray(Q_NULLPTR)
+    , sqMask(0)
+    , sqEntries(0)
+    , sqLocalTail(0)
+    , sqSubmitted(0)
+    , cqHead(Q_NULLPTR)
+    , cqTail(Q_NULLPTR)
+    , cqMask(0)
+    , cqes(Q_NULLPTR)
+    , bufferRing(Q_NULLPTR)
+    , bufferRingSize(0)
+    , buffers(Q_NULLPTR)
+    , bufferSize(0)
+    , bufferCount(0)
+    , receiveArmed(false)
+    , pendingSends(0)
+{
+}
+
+CanIoUring::~CanIoUring()
+{
+    close();
+}
+
+/*
+    Creates the ring for \a descriptor with \a receiveCount provided receive
+    buffers of \a receiveSize bytes each (\a receiveCount is a power of two).
+    Returns false with errno set if the kernel lacks the required features.
+*/
+bool CanIoUring::setup(int descriptor, int receiveSize, int receiveCount)
+{
+    struct io_uring_params params;
+    ::memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CLAMP;
+
+    socketDescriptor = descriptor;
+    ringDescriptor = ioUringSetup(CAN_IOURING_ENTRIES, &params);
+    if (ringDescriptor < 0) {
+        ringDescriptor = -1;
+        return false;
+    }
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        sqRingSize = cqRingSize = qMax(sqRingSize, cqRingSize);
+
+    sqRing = ::mmap(Q_NULLPTR, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ringDescriptor, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED)
+        goto error;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cqRing = sqRing;
+    } else {
+        cqRing = ::mmap(Q_NULLPTR, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ringDescriptor, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED)
+            goto error;
+    }
+
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = static_cast<struct io_uring_sqe *>(::mmap(Q_NULLPTR, sqesSize, PROT_READ | PROT_WRITE,
+                                                     MAP_SHARED | MAP_POPULATE, ringDescriptor, IORING_OFF_SQES));
+    if (sqes == MAP_FAILED) {
+        sqes = Q_NULLPTR;
+        goto error;
+    }
+
+    sqHead = reinterpret_cast<unsigned *>(static_cast<char *>(sqRing) + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned *>(static_cast<char *>(sqRing) + params.sq_off.tail);
+    sqArray = reinterpret_cast<unsigned *>(static_cast<char *>(sqRing) + params.sq_off.array);
+    sqMask = *reinterpret_cast<unsigned *>(static_cast<char *>(sqRing) + params.sq_off.ring_mask);
+    sqEntries = params.sq_entries;
+    sqLocalTail = sqSubmitted = *sqTail;
+
+    cqHead = reinterpret_cast<unsigned *>(static_cast<char *>(cqRing) + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned *>(static_cast<char *>(cqRing) + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned *>(static_cast<char *>(cqRing) + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe *>(static_cast<char *>(cqRing) + params.cq_off.cqes);
+
+    // provided buffers for the multishot receive, the ring and the buffers share one mapping
+    bufferSize = receiveSize;
+    bufferCount = receiveCount;
+    bufferRingSize = bufferCount * sizeof(struct io_uring_buf) + size_t(bufferCount) * bufferSize;
+    {
+        void *mapped = ::mmap(Q_NULLPTR, bufferRingSize, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapped == MAP_FAILED)
+            goto error;
+        bufferRing = static_cast<struct io_uring_buf_ring *>(mapped);
+        buffers = static_cast<char *>(mapped) + bufferCount * sizeof(struct io_uring_buf);
+    }
+
+    {
+        struct io_uring_buf_reg reg;
+        ::memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<quintptr>(bufferRing);
+        reg.ring_entries = bufferCount;
+        reg.bgid = CAN_IOURING_BUFFER_GROUP;
+        if (ioUringRegister(ringDescriptor, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+            goto error;
+    }
+
+    for (int i = 0; i < bufferCount; ++i)
+        recycleBuffer(i);
+
+    eventFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eventFd < 0 || ioUringRegister(ringDescriptor, IORING_REGISTER_EVENTFD, &eventFd, 1) < 0)
+        goto error;
+
+    return true;
+
+error:
+    const int setupError = errno;
+    close();
+    errno = setupError;
+    return false;
+}
+
+void CanIoUring::close()
+{
+    if (eventFd != -1) {
+        ::close(eventFd);
+        eventFd = -1;
+    }
+    if (bufferRing) {
+        ::munmap(bufferRing, bufferRingSize);
+        bufferRing = Q_NULLPTR;
+        buffers = Q_NULLPTR;
+    }
+    if (sqes) {
+        ::munmap(sqes, sqesSize);
+        sqes = Q_NULLPTR;
+    }
+    if (cqRing != MAP_FAILED && cqRing != sqRing)
+        ::munmap(cqRing, cqRingSize);
+    cqRing = MAP_FAILED;
+    if (sqRing != MAP_FAILED) {
+        ::munmap(sqRing, sqRingSize);
+        sqRing = MAP_FAILED;
+    }
+    // closing the ring cancels the requests still in flight
+    if (ringDescriptor != -1) {
+        ::close(ringDescriptor);
+        ringDescriptor = -1;
+    }
+    socketDescriptor = -1;
+    receiveArmed = false;
+    pendingSends = 0;
+}
+
+void CanIoUring::clearEvent()
+{
+    eventfd_t value;
+    ::eventfd_read(eventFd, &value);
+}
+
+struct io_uring_sqe *CanIoUring::nextSqe()
+{
+    if (sqLocalTail - loadAcquire(sqHead) >= sqEntries)
+        return Q_NULLPTR;
+
+    const unsigned index = sqLocalTail & sqMask;
+    struct io_uring_sqe *sqe = &sqes[index];
+    ::memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+    ++sqLocalTail;
+    return sqe;
+}
+
+bool CanIoUring::armReceive()
+{
+    if (receiveArmed)
+        return true;
+
+    struct io_uring_sqe *sqe = nextSqe();
+    if (!sqe) {
+        errno = EBUSY;
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = socketDescriptor;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = CAN_IOURING_BUFFER_GROUP;
+    sqe->user_data = ReceiveOperation;
+
+    receiveArmed = true;
+    return true;
+}
+
+bool CanIoUring::queueSend(const char *data, int size, bool linkNext)
+{
+    struct io_uring_sqe *sqe = nextSqe();
+    if (!sqe) {
+        errno = EBUSY;
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = socketDescriptor;
+    sqe->addr = reinterpret_cast<quintptr>(data);
+    sqe->len = size;
+    sqe->msg_flags = MSG_DONTWAIT;
+    if (linkNext)
+        sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = SendOperation;
+
+    ++pendingSends;
+    return true;
+}
+
+bool CanIoUring::submit()
+{
+    const unsigned toSubmit = sqLocalTail - sqSubmitted;
+    if (toSubmit == 0)
+        return true;
+
+    storeRelease(sqTail, sqLocalTail);
+
+    int ret;
+    do {
+        ret = ioUringEnter(ringDescriptor, toSubmit, 0, 0);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0)
+        return false;
+
+    sqSubmitted += ret;
+    return true;
+}
+
+bool CanIoUring::nextCompletion(CanIoUringCompletion *completion)
+{
+    const unsigned head = *cqHead;
+    if (head == loadAcquire(cqTail))
+        return false;
+
+    const struct io_uring_cqe *cqe = &cqes[head & cqMask];
+
+    completion->operation = cqe->user_data;
+    completion->result = cqe->res;
+    completion->buffer = Q_NULLPTR;
+    completion->bufferId = -1;
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        completion->bufferId = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        completion->buffer = buffers + size_t(completion->bufferId) * bufferSize;
+    }
+
+    if (cqe->user_data == ReceiveOperation) {
+        // the multishot receive ended (e.g. out of buffers) and has to be armed again
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            receiveArmed = false;
+    } else if (cqe->user_data == SendOperation) {
+        --pendingSends;
+    }
+
+    storeRelease(cqHead, head + 1);
+    return true;
+}
+
+void CanIoUring::recycleBuffer(int bufferId)
+{
+    if (bufferId < 0)
+        return;
+
+    // the entries overlay the ring header, bufs can't be used from C++ where
+    // the empty struct in __DECLARE_FLEX_ARRAY shifts the array by 8 bytes
+    const unsigned short tail = bufferRing->tail;
+    struct io_uring_buf *buffer = reinterpret_cast<struct io_uring_buf *>(bufferRing) + (tail & (bufferCount - 1));
+    buffer->addr = reinterpret_cast<quintptr>(buffers + size_t(bufferId) * bufferSize);
+    buffer->len = bufferSize;
+    buffer->bid = bufferId;
+
+    __atomic_store_n(&bufferRing->tail, static_cast<unsigned short>(tail + 1), __ATOMIC_RELEASE);
+}
@@ -0,0 +1,107 @@
+/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#ifndef CANIOURING_P_H
+#define CANIOURING_P_H
+
+#include <QtCore/qglobal.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+struct CanIoUringCompletion
+{
+    quint64 operation;
+    int result;
+    const char *buffer;
+    int bufferId;
+};
+
+// Minimal io_uring ring on top of the raw system calls, keeping one multishot
+// receive with provided buffers and chains of linked sends on one descriptor.
+// Completions are signaled through an eventfd, which fits a QSocketNotifier.
+class CanIoUring
+{
+public:
+    enum Operation {
+        ReceiveOperation = 1,
+        SendOperation = 2
+    };
+
+    CanIoUring();
+    ~CanIoUring();
+
+    bool setup(int descriptor, int receiveSize, int receiveCount);
+    void close();
+
+    bool isValid() const { return ringDescriptor != -1; }
+
+    int eventDescriptor() const { return eventFd; }
+    void clearEvent();
+
+    bool armReceive();
+    bool isReceiveArmed() const { return receiveArmed; }
+
+    bool queueSend(const char *data, int size, bool linkNext);
+    int sendsInFlight() const { return pendingSends; }
+
+    bool submit();
+    bool nextCompletion(CanIoUringCompletion *completion);
+    void recycleBuffer(int bufferId);
+
+private:
+    io_uring_sqe *nextSqe();
+
+    int socketDescriptor;
+    int ringDescriptor;
+    int eventFd;
+
+    void *sqRing;
+    void *cqRing;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    io_uring_sqe *sqes;
+    size_t sqesSize;
+
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqArray;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned sqLocalTail;
+    unsigned sqSubmitted;
+
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    io_uring_cqe *cqes;
+
+    io_uring_buf_ring *bufferRing;
+    size_t bufferRingSize;
+    char *buffers;
+    int bufferSize;
+    int bufferCount;
+
+    bool receiveArmed;
+    int pendingSends;
+
+    Q_DISABLE_COPY(CanIoUring)
+};
+
+#endif // CANIOURING_P_H
@@ -20,6 +20,7 @@
 #include "canabstractsocket.h"
 #include "canabstractsocket_p.h"
 #include "canisotpsocket_p.h"
+#include "cansockettrace_p.h"
 
 #include <private/qcore_unix_p.h>
 
@@ -346,7 +347,9 @@ bool CanIsoTpSocket::connectToInterface(const QString &interfaceName, uint txId,
 void CanIsoTpSocket::setSocketOption(CanIsoTpSocketOption option, const QVariant &value)
 {
     Q_D(CanIsoTpSocket);
-    d->setSocketOption(option, value);
+    const bool ok = d->setSocketOption(option, value);
+    CAN_TRACE(SocketOption, socketDescriptor(), option, ok);
+    Q_UNUSED(ok);
 }
 
 QVariant CanIsoTpSocket::socketOption(CanIsoTpSocketOption option)
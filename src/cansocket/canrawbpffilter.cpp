@@ -0,0 +1,284 @@
+/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+
+#include "canrawsocket.h"
+#include "canframe_p.h"
+
+#include <QtCore/qendian.h>
+
+#include <linux/can.h>
+#include <linux/filter.h>
+#include <string.h>
+
+#define CAN_BPF_ID_OFFSET 0
+#define CAN_BPF_LENGTH_OFFSET 4 // can_dlc of can_frame, len of canfd_frame, flags of canxl_frame
+#define CAN_BPF_DATA_OFFSET 8
+#define CAN_BPF_ACCEPT 0xffffffff // keep the whole frame
+#define CAN_BPF_MAX_PREDICATES 50 // keeps the jumps of a rule within 8 bits
+
+/*!
+    Creates a predicate on the payload byte at \a offset, which holds if the
+    byte masked with \a mask compares as \a comparison to \a value. Frames
+    with a payload shorter than \a offset + 1 never match.
+ */
+CanRawDataPredicate::CanRawDataPredicate(int offset, quint8 value, quint8 mask, Comparison comparison)
+    : byteOffset(offset)
+    , byteValue(value)
+    , byteMask(mask)
+    , byteComparison(comparison)
+{
+}
+
+bool CanRawDataPredicate::matches(const char *data, int dataLength) const
+{
+    if (byteOffset < 0 || byteOffset >= dataLength)
+        return false;
+
+    const bool equal = (static_cast<quint8>(data[byteOffset]) & byteMask) == (byteValue & byteMask);
+    return byteComparison == Equal ? equal : !equal;
+}
+
+struct CanRawBpfRule
+{
+    CanRawFilter filter;
+    QVector<CanRawDataPredicate> predicates;
+
+    bool operator ==(const CanRawBpfRule &rhs) const {
+        return filter == rhs.filter && predicates == rhs.predicates;
+    }
+};
+
+class CanRawBpfFilterData : public QSharedData
+{
+public:
+    CanRawBpfFilterData() : QSharedData(), rules() {}
+    ~CanRawBpfFilterData() {}
+
+    QVector<CanRawBpfRule> rules;
+};
+
+// CAN_RAW_FILTER semantics, the error flag doubles as inversion flag of the filter
+static inline bool idMatches(quint32 canId, const CanRawFilter &filter)
+{
+    const quint32 mask = filter.filterMask() & ~CAN_ERR_FLAG;
+    const bool match = (canId & mask) == (filter.filterId() & mask);
+    return (filter.filterId() & CAN_INV_FILTER) ? !match : match;
+}
+
+/*
+    Absolute word loads of BPF read in network byte order, so the constants
+    compared to the CAN identifier, which is stored in host byte order, are
+    swapped the same way.
+*/
+static inline quint32 loadedWord(quint32 value)
+{
+    return qFromBigEndian(value);
+}
+
+static inline struct sock_filter statement(quint16 code, quint32 k)
+{
+    struct sock_filter instruction = { code, 0, 0, k };
+    return instruction;
+}
+
+static inline struct sock_filter jump(quint16 code, quint32 k, quint8 jt, quint8 jf)
+{
+    struct sock_filter instruction = { code, jt, jf, k };
+    return instruction;
+}
+
+CanRawBpfFilter::CanRawBpfFilter()
+    : d(new CanRawBpfFilterData())
+{
+}
+
+/*!
+    Creates a filter with one rule for every filter of \a filters, which
+    accepts the same frames as CAN_RAW_FILTER does.
+ */
+CanRawBpfFilter::CanRawBpfFilter(const CanRawFilterArray &filters)
+    : d(new CanRawBpfFilterData())
+{
+    for (int i = 0; i < filters.size(); ++i)
+        addRule(filters.constData()[i]);
+}
+
+CanRawBpfFilter::CanRawBpfFilter(const CanRawBpfFilter &rhs)
+    : d(rhs.d)
+{
+}
+
+CanRawBpfFilter::~CanRawBpfFilter()
+{
+}
+
+void CanRawBpfFilter::swap(CanRawBpfFilter &other)
+{
+    qSwap(d, other.d);
+}
+
+/*!
+    Returns true if the filter has no rules. An empty filter is not attached
+    to the socket, so it accepts every frame.
+ */
+bool CanRawBpfFilter::isEmpty() const
+{
+    return d->rules.isEmpty();
+}
+
+int CanRawBpfFilter::ruleCount() const
+{
+    return d->rules.size();
+}
+
+/*!
+    Adds a rule which accepts the frames matching the identifier \a filter
+    for which all \a predicates hold. A frame is accepted if any rule accepts
+    it, error frames are always accepted and left to the error filter mask.
+ */
+void CanRawBpfFilter::addRule(const CanRawFilter &filter, const QVector<CanRawDataPredicate> &predicates)
+{
+    CanRawBpfRule rule;
+    rule.filter = filter;
+    rule.predicates = predicates;
+    d->rules.append(rule);
+}
+
+void CanRawBpfFilter::clear()
+{
+    d->rules.clear();
+}
+
+/*!
+    Returns true if the filter accepts the can_frame, canfd_frame or
+    canxl_frame of \a size bytes at \a frame. This is the reference for the
+    compiled program, it decides exactly like the kernel does.
+ */
+bool CanRawBpfFilter::matches(const char *frame, int size) const
+{
+    if (size < static_cast<int>(CAN_MTU))
+        return false;
+
+    quint32 canId;
+    ::memcpy(&canId, frame + CAN_BPF_ID_OFFSET, sizeof(canId));
+    if (canId & CAN_ERR_FLAG)
+        return true;
+    if (static_cast<quint8>(frame[CAN_BPF_LENGTH_OFFSET]) & CANXL_XLF)
+        return true;
+
+    const int dataLength = qMin<int>(static_cast<quint8>(frame[CAN_BPF_LENGTH_OFFSET]),
+                                     size - CAN_BPF_DATA_OFFSET);
+    const char *data = frame + CAN_BPF_DATA_OFFSET;
+
+    for (const CanRawBpfRule &rule : d->rules) {
+        if (!idMatches(canId, rule.filter))
+            continue;
+
+        bool match = true;
+        for (const CanRawDataPredicate &predicate : rule.predicates) {
+            if (!predicate.matches(data, dataLength)) {
+                match = false;
+                break;
+            }
+        }
+        if (match)
+            return true;
+    }
+    return false;
+}
+
+/*!
+    Returns the classic BPF program of the filter as array of struct
+    sock_filter, ready for SO_ATTACH_FILTER. Returns an empty array if the
+    filter is empty, a rule has more than 50 predicates or the program
+    exceeds BPF_MAXINSNS instructions.
+
+    Every rule is a straight sequence of tests, failing tests jump to the
+    next rule, so the program runs in time linear to its size.
+ */
+QByteArray CanRawBpfFilter::program() const
+{
+    if (d->rules.isEmpty())
+        return QByteArray();
+
+    QVector<struct sock_filter> instructions;
+
+    // error frames are selected by CAN_RAW_ERR_FILTER, the predicates
+    // address the payload of classic and fd frames, so XL frames pass
+    instructions.append(statement(BPF_LD | BPF_W | BPF_ABS, CAN_BPF_ID_OFFSET));
+    instructions.append(jump(BPF_JMP | BPF_JSET | BPF_K, loadedWord(CAN_ERR_FLAG), 2, 0));
+    instructions.append(statement(BPF_LD | BPF_B | BPF_ABS, CAN_BPF_LENGTH_OFFSET));
+    instructions.append(jump(BPF_JMP | BPF_JSET | BPF_K, CANXL_XLF, 0, 1));
+    instructions.append(statement(BPF_RET | BPF_K, CAN_BPF_ACCEPT));
+
+    for (const CanRawBpfRule &rule : d->rules) {
+        if (rule.predicates.size() > CAN_BPF_MAX_PREDICATES)
+            return QByteArray();
+
+        const quint32 mask = rule.filter.filterMask() & ~CAN_ERR_FLAG;
+        const bool inverted = rule.filter.filterId() & CAN_INV_FILTER;
+
+        // jumps to the next rule are patched once the length of the rule is known,
+        // the other branch of a test continues with the next instruction
+        QVector<int> exitsIfTrue;
+        QVector<int> exitsIfFalse;
+
+        instructions.append(statement(BPF_LD | BPF_W | BPF_ABS, CAN_BPF_ID_OFFSET));
+        instructions.append(statement(BPF_ALU | BPF_AND | BPF_K, loadedWord(mask)));
+        (inverted ? exitsIfTrue : exitsIfFalse).append(instructions.size());
+        instructions.append(jump(BPF_JMP | BPF_JEQ | BPF_K, loadedWord(rule.filter.filterId() & mask), 0, 0));
+
+        for (const CanRawDataPredicate &predicate : rule.predicates) {
+            if (predicate.offset() < 0 || predicate.offset() >= CANFD_MAX_DLEN)
+                return QByteArray();
+
+            instructions.append(statement(BPF_LD | BPF_B | BPF_ABS, CAN_BPF_LENGTH_OFFSET));
+            exitsIfFalse.append(instructions.size());
+            instructions.append(jump(BPF_JMP | BPF_JGT | BPF_K, predicate.offset(), 0, 0));
+
+            instructions.append(statement(BPF_LD | BPF_B | BPF_ABS, CAN_BPF_DATA_OFFSET + predicate.offset()));
+            if (predicate.mask() != 0xff)
+                instructions.append(statement(BPF_ALU | BPF_AND | BPF_K, predicate.mask()));
+            const bool equal = predicate.comparison() == CanRawDataPredicate::Equal;
+            (equal ? exitsIfFalse : exitsIfTrue).append(instructions.size());
+            instructions.append(jump(BPF_JMP | BPF_JEQ | BPF_K, predicate.value() & predicate.mask(), 0, 0));
+        }
+
+        instructions.append(statement(BPF_RET | BPF_K, CAN_BPF_ACCEPT));
+
+        const int end = instructions.size();
+        for (int exit : exitsIfTrue)
+            instructions[exit].jt = end - exit - 1;
+        for (int exit : exitsIfFalse)
+            instructions[exit].jf = end - exit - 1;
+    }
+
+    instructions.append(statement(BPF_RET | BPF_K, 0));
+
+    if (instructions.size() > BPF_MAXINSNS)
+        return QByteArray();
+
+    return QByteArray(reinterpret_cast<const char *>(instructions.constData()),
+                      instructions.size() * sizeof(struct sock_filter));
+}
+
+bool CanRawBpfFilter::operator ==(const CanRawBpfFilter &rhs) const
+{
+    return d->rules == rhs.d->rules;
+}
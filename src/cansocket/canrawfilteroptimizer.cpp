@@ -0,0 +1,437 @@
+/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+
+#include "canrawsocket.h"
+
+#include <QtCore/qhash.h>
+
+#include <linux/can.h>
+
+#include <algorithm>
+
+// Exact filters whose id and mask flags are equal, merged over the id bits.
+struct CanRawFilterGroup
+{
+    quint32 idFlags;
+    quint32 maskFlags;
+    quint32 idBits;
+    QVector<quint32> ids; // sorted, for the post filter
+};
+
+// id/mask pair over the id bits of a group, a bit outside of care is don't care
+struct CanRawFilterCube
+{
+    quint32 value;
+    quint32 care;
+};
+
+class CanRawFilterOptimizerData : public QSharedData
+{
+public:
+    CanRawFilterOptimizerData()
+        : QSharedData()
+        , maxOverAcceptance(0)
+        , originalFilterCount(0)
+        , filterCount(0)
+        , falsePositiveRate(0)
+        , postFilter(false)
+    {
+    }
+
+    qreal maxOverAcceptance;
+    int originalFilterCount;
+    int filterCount;
+    qreal falsePositiveRate;
+    bool postFilter;
+
+    QVector<CanRawFilterGroup> groups;
+    QVector<CanRawFilter> otherFilters;
+};
+
+static inline quint64 cubeSize(const CanRawFilterCube &cube, quint32 idBits)
+{
+    return Q_UINT64_C(1) << qPopulationCount(idBits & ~cube.care);
+}
+
+static inline bool cubeCovers(const CanRawFilterCube &cube, quint32 id)
+{
+    return (id & cube.care) == cube.value;
+}
+
+static inline CanRawFilterCube supercube(const CanRawFilterCube &a, const CanRawFilterCube &b)
+{
+    CanRawFilterCube cube;
+    cube.care = a.care & b.care & ~(a.value ^ b.value);
+    cube.value = a.value & cube.care;
+    return cube;
+}
+
+static inline quint64 coveredIds(const CanRawFilterCube &cube, const QVector<quint32> &ids)
+{
+    quint64 count = 0;
+    for (quint32 id : ids) {
+        if (cubeCovers(cube, id))
+            ++count;
+    }
+    return count;
+}
+
+// CAN_RAW_FILTER semantics, the error flag doubles as inversion flag of the filter
+static inline bool idMatches(quint32 canId, const CanRawFilter &filter)
+{
+    const quint32 mask = filter.filterMask() & ~CAN_ERR_FLAG;
+    const bool match = (canId & mask) == (filter.filterId() & mask);
+    return (filter.filterId() & CAN_INV_FILTER) ? !match : match;
+}
+
+/*
+    Quine-McCluskey: merges cubes differing in one cared bit until no merge
+    is left, the cubes never merged are the prime implicants of the id set.
+*/
+static QVector<CanRawFilterCube> primeImplicants(const QVector<quint32> &ids, quint32 idBits)
+{
+    QVector<CanRawFilterCube> primes;
+    QHash<quint64, bool> cubes; // (care << 32 | value) -> merged
+    for (quint32 id : ids)
+        cubes.insert((quint64(idBits) << 32) | id, false);
+
+    while (!cubes.isEmpty()) {
+        QHash<quint64, bool> merged;
+        for (QHash<quint64, bool>::iterator it = cubes.begin(); it != cubes.end(); ++it) {
+            const quint32 care = it.key() >> 32;
+            const quint32 value = quint32(it.key());
+            for (quint32 bits = care; bits; bits &= bits - 1) {
+                const quint32 bit = bits & (~bits + 1);
+                if (value & bit)
+                    continue; // the pair is found from the cube with the bit cleared
+                QHash<quint64, bool>::iterator partner = cubes.find((quint64(care) << 32) | (value | bit));
+                if (partner == cubes.end())
+                    continue;
+                it.value() = true;
+                partner.value() = true;
+                merged.insert((quint64(care & ~bit) << 32) | value, false);
+            }
+        }
+        for (QHash<quint64, bool>::const_iterator it = cubes.constBegin(); it != cubes.constEnd(); ++it) {
+            if (!it.value()) {
+                CanRawFilterCube cube;
+                cube.care = it.key() >> 32;
+                cube.value = quint32(it.key());
+                primes.append(cube);
+            }
+        }
+        cubes.swap(merged);
+    }
+    return primes;
+}
+
+// greedy set cover of the ids by the prime implicants, essential primes are picked first
+static QVector<CanRawFilterCube> coverIds(const QVector<quint32> &ids, const QVector<CanRawFilterCube> &primes)
+{
+    QVector<CanRawFilterCube> cover;
+    QVector<bool> covered(ids.size(), false);
+    QVector<bool> used(primes.size(), false);
+    int remaining = ids.size();
+
+    for (int i = 0; i < ids.size(); ++i) {
+        int only = -1;
+        for (int p = 0; p < primes.size(); ++p) {
+            if (!cubeCovers(primes.at(p), ids.at(i)))
+                continue;
+            only = only == -1 ? p : -2;
+            if (only == -2)
+                break;
+        }
+        if (only >= 0 && !used.at(only)) {
+            used[only] = true;
+            cover.append(primes.at(only));
+        }
+    }
+    for (int i = 0; i < ids.size(); ++i) {
+        for (const CanRawFilterCube &cube : cover) {
+            if (cubeCovers(cube, ids.at(i))) {
+                covered[i] = true;
+                --remaining;
+                break;
+            }
+        }
+    }
+
+    while (remaining > 0) {
+        int best = -1;
+        int bestCount = 0;
+        for (int p = 0; p < primes.size(); ++p) {
+            if (used.at(p))
+                continue;
+            int count = 0;
+            for (int i = 0; i < ids.size(); ++i) {
+                if (!covered.at(i) && cubeCovers(primes.at(p), ids.at(i)))
+                    ++count;
+            }
+            if (count > bestCount) {
+                best = p;
+                bestCount = count;
+            }
+        }
+        used[best] = true;
+        cover.append(primes.at(best));
+        for (int i = 0; i < ids.size(); ++i) {
+            if (!covered.at(i) && cubeCovers(primes.at(best), ids.at(i))) {
+                covered[i] = true;
+                --remaining;
+            }
+        }
+    }
+    return cover;
+}
+
+/*
+    Merges the pair of cubes adding the fewest ids outside of the set, as long
+    as the added ids stay within \a budget. Returns the number of ids outside
+    of the set, counted per cube, so overlapping cubes overestimate it.
+*/
+static quint64 widenCover(QVector<CanRawFilterCube> &cover, const QVector<quint32> &ids,
+                          quint32 idBits, quint64 budget)
+{
+    // ids outside of the set accepted by each cube
+    QVector<quint64> costs;
+    costs.reserve(cover.size());
+    for (const CanRawFilterCube &cube : cover)
+        costs.append(cubeSize(cube, idBits) - coveredIds(cube, ids));
+
+    quint64 extra = 0;
+    for (quint64 cost : costs)
+        extra += cost;
+
+    forever {
+        int bestA = -1;
+        int bestB = -1;
+        quint64 bestExtra = 0;
+        quint64 bestCost = 0;
+        CanRawFilterCube bestCube;
+
+        for (int a = 0; a < cover.size(); ++a) {
+            for (int b = a + 1; b < cover.size(); ++b) {
+                const CanRawFilterCube cube = supercube(cover.at(a), cover.at(b));
+                const quint64 size = cubeSize(cube, idBits);
+                const quint64 oldCost = costs.at(a) + costs.at(b);
+
+                // lower bound first, counting the covered ids is the expensive part
+                if (extra - oldCost + size > budget + quint64(ids.size()))
+                    continue;
+
+                const quint64 newExtra = extra - oldCost + size - coveredIds(cube, ids);
+                if (newExtra > budget)
+                    continue;
+                if (bestA == -1 || newExtra < bestExtra) {
+                    bestA = a;
+                    bestB = b;
+                    bestExtra = newExtra;
+                    bestCost = newExtra - (extra - oldCost);
+                    bestCube = cube;
+                }
+            }
+        }
+        if (bestA == -1)
+            break;
+
+        cover[bestA] = bestCube;
+        costs[bestA] = bestCost;
+        cover.remove(bestB);
+        costs.remove(bestB);
+
+        // cubes swallowed by the new one
+        for (int i = cover.size() - 1; i >= 0; --i) {
+            if (i != bestA && (cover.at(i).care & bestCube.care) == bestCube.care
+                    && cubeCovers(bestCube, cover.at(i).value)) {
+                cover.remove(i);
+                costs.remove(i);
+                if (i < bestA)
+                    --bestA;
+            }
+        }
+
+        extra = 0;
+        for (quint64 cost : costs)
+            extra += cost;
+    }
+    return extra;
+}
+
+/*!
+    Creates an optimizer which accepts up to \a maxOverAcceptance ids outside
+    of the filtered id set per id inside of it, 0 keeps the cover exact.
+ */
+CanRawFilterOptimizer::CanRawFilterOptimizer(qreal maxOverAcceptance)
+    : d(new CanRawFilterOptimizerData())
+{
+    d->maxOverAcceptance = qMax<qreal>(maxOverAcceptance, 0);
+}
+
+CanRawFilterOptimizer::CanRawFilterOptimizer(const CanRawFilterOptimizer &rhs)
+    : d(rhs.d)
+{
+}
+
+CanRawFilterOptimizer::~CanRawFilterOptimizer()
+{
+}
+
+CanRawFilterOptimizer &CanRawFilterOptimizer::operator =(const CanRawFilterOptimizer &rhs)
+{
+    d = rhs.d;
+    return *this;
+}
+
+void CanRawFilterOptimizer::setMaxOverAcceptance(qreal ratio)
+{
+    d->maxOverAcceptance = qMax<qreal>(ratio, 0);
+}
+
+qreal CanRawFilterOptimizer::maxOverAcceptance() const
+{
+    return d->maxOverAcceptance;
+}
+
+/*!
+    Returns a filter array accepting the same frames as \a filters with as few
+    entries as it finds.
+
+    Exact id filters, whose mask covers all id bits, are merged into id/mask
+    pairs over their prime implicants. Filters with the full mask including
+    the EFF and RTR flags are kept, the kernel looks them up in a hash table
+    instead of walking them. Masked and inverted filters are kept as well.
+
+    With an over-acceptance above 0 the merged pairs are widened further,
+    frames accepted by the kernel but not by \a filters are then removed by
+    accepts() in user space.
+ */
+CanRawFilterArray CanRawFilterOptimizer::optimize(const CanRawFilterArray &filters)
+{
+    d->groups.clear();
+    d->otherFilters.clear();
+    d->originalFilterCount = filters.size();
+
+    CanRawFilterArray result;
+
+    for (int i = 0; i < filters.size(); ++i) {
+        const CanRawFilter &filter = filters.constData()[i];
+        const quint32 id = filter.filterId();
+        const quint32 mask = filter.filterMask() & ~CAN_ERR_FLAG;
+        const quint32 idBits = (id & CAN_EFF_FLAG) ? CAN_EFF_MASK : CAN_SFF_MASK;
+        const quint32 flags = CAN_EFF_FLAG | CAN_RTR_FLAG;
+
+        if ((id & CAN_INV_FILTER) || (mask & idBits) != idBits
+                || (mask & flags) == flags) {
+            d->otherFilters.append(filter);
+            result.append(filter);
+            continue;
+        }
+
+        const quint32 groupBits = mask & CAN_EFF_MASK;
+        const quint32 idFlags = id & mask & ~CAN_EFF_MASK;
+        const quint32 maskFlags = mask & ~CAN_EFF_MASK;
+
+        int g = 0;
+        while (g < d->groups.size() && (d->groups.at(g).idFlags != idFlags
+                                        || d->groups.at(g).maskFlags != maskFlags
+                                        || d->groups.at(g).idBits != groupBits)) {
+            ++g;
+        }
+        if (g == d->groups.size()) {
+            CanRawFilterGroup group;
+            group.idFlags = idFlags;
+            group.maskFlags = maskFlags;
+            group.idBits = groupBits;
+            d->groups.append(group);
+        }
+        d->groups[g].ids.append(id & groupBits);
+    }
+
+    quint64 exactIds = 0;
+    quint64 extraIds = 0;
+
+    for (CanRawFilterGroup &group : d->groups) {
+        std::sort(group.ids.begin(), group.ids.end());
+        group.ids.erase(std::unique(group.ids.begin(), group.ids.end()), group.ids.end());
+
+        QVector<CanRawFilterCube> cover = coverIds(group.ids, primeImplicants(group.ids, group.idBits));
+        const quint64 budget = quint64(d->maxOverAcceptance * group.ids.size());
+        if (budget > 0)
+            extraIds += widenCover(cover, group.ids, group.idBits, budget);
+        exactIds += group.ids.size();
+
+        for (const CanRawFilterCube &cube : cover)
+            result.append(CanRawFilter(cube.value | group.idFlags, cube.care | group.maskFlags));
+    }
+
+    d->filterCount = result.size();
+    d->postFilter = extraIds > 0;
+    d->falsePositiveRate = extraIds > 0 ? qreal(extraIds) / (exactIds + extraIds) : 0;
+
+    return result;
+}
+
+int CanRawFilterOptimizer::originalFilterCount() const
+{
+    return d->originalFilterCount;
+}
+
+int CanRawFilterOptimizer::filterCount() const
+{
+    return d->filterCount;
+}
+
+/*!
+    Returns the share of ids accepted by the optimized filters which the
+    original filters reject. Overlapping widened filters are counted twice,
+    so the actual rate may be lower.
+ */
+qreal CanRawFilterOptimizer::falsePositiveRate() const
+{
+    return d->falsePositiveRate;
+}
+
+bool CanRawFilterOptimizer::needsPostFilter() const
+{
+    return d->postFilter;
+}
+
+/*!
+    Returns true if the original filters accept a frame with \a canId. Error
+    frames are always accepted, they are selected by the error filter mask.
+ */
+bool CanRawFilterOptimizer::accepts(uint canId) const
+{
+    if (canId & CAN_ERR_FLAG)
+        return true;
+
+    for (const CanRawFilterGroup &group : d->groups) {
+        if ((canId & group.maskFlags) != group.idFlags)
+            continue;
+        if (std::binary_search(group.ids.constBegin(), group.ids.constEnd(), canId & group.idBits))
+            return true;
+    }
+
+    for (const CanRawFilter &filter : d->otherFilters) {
+        if (idMatches(canId, filter))
+            return true;
+    }
+    return false;
+}
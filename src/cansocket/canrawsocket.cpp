@@ -21,23 +21,36 @@
 #include "canabstractsocket_p.h"
 #include "canrawsocket_p.h"
 #include "canframe_p.h"
+#include "cansockettrace_p.h"
 
 #include <QtCore/qshareddata.h>
 #include <QtCore/qmap.h>
+#include <QtCore/qtimer.h>
 
 #include <sys/socket.h>
 #include <net/if.h>
 #include <linux/can.h>
 #include <linux/can/raw.h>
+#include <linux/errqueue.h>
+#include <linux/filter.h>
+#include <linux/net_tstamp.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sched.h>
+#include <poll.h>
+#include <time.h>
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
 
 #define CAN_RAW_READ_CHUNK_SIZE 1152 // 72 CAN Frames or 16 FD CAN Frames
+#define CAN_RAW_XL_READ_CHUNK_SIZE (16 * (CANXL_MTU + sizeof(CanFrameTrailer))) // 16 XL frames of full length
 #define CAN_RAW_INITIAL_BUFFER_SIZE 18432 // x16
+#define CAN_RAW_MAX_BATCH_SIZE 72 // frames per recvmmsg() call, one chunk of CAN frames
+#define CAN_RAW_CONTROL_SIZE (CMSG_SPACE(sizeof(struct scm_timestamping)) + CMSG_SPACE(sizeof(quint32)))
+#define CAN_RAW_TRANSITION_GRACE 10000000 // ns frames received before a filter transition may take to reach the socket
+#define CAN_RAW_HARDWARE_CLOCK_WINDOW 1000000000 // ns over which the offset of the device clock is estimated
 
 #ifndef CAN_MTU
 #   define CAN_MTU sizeof(can_frame)
@@ -51,9 +64,8 @@
 #   define CAN_MAX_DLEN 8
 #endif
 
-//reserved bytes according to can.h
-#define RES0_BYTE 6
-#define RES1_BYTE 7
+#define CAN_RAW_MAX_RECORD_SIZE (CANXL_MTU + sizeof(CanFrameTrailer))
+#define CAN_RAW_SCHEDULED_BATCH_SIZE 16 // frames handed to the socket at a time in priority scheduling
 
 CanRawFilter::CanRawFilter(uint id, uint mask)
     : id(id)
@@ -173,7 +185,9 @@ CanRawSocket::~CanRawSocket()
 void CanRawSocket::setSocketOption(CanRawSocket::CanRawSocketOption option, const QVariant &value)
 {
     Q_D(CanRawSocket);
-    d->setSocketOption(option, value);
+    const bool ok = d->setSocketOption(option, value);
+    CAN_TRACE(SocketOption, socketDescriptor(), option, ok);
+    Q_UNUSED(ok);
 }
 
 QVariant CanRawSocket::socketOption(CanRawSocket::CanRawSocketOption option)
@@ -232,18 +246,514 @@ CanRawSocket::FlexibleDataRateFrames CanRawSocket::flexibleDataRateFrames()
     return socketOption(CanRawSocket::FlexibleDataRateFramesOption).value<CanRawSocket::FlexibleDataRateFrames>();
 }
 
+void CanRawSocket::setXlFrames(CanRawSocket::XlFrames xlFrames)
+{
+    setSocketOption(CanRawSocket::XlFramesOption, QVariant::fromValue(xlFrames));
+}
+
+/*!
+    Returns whether the socket reads and writes CAN XL frames, which needs
+    Linux 6.2 and a device with an MTU of at least CANXL_MIN_MTU. Enabling
+    XL frames enables FD frames in the kernel as well.
+
+    XL frames set before connecting are applied by connectToInterface().
+    With the io_uring backend they can't be changed while connected.
+
+    XL frames take only their header and payload in the read and write
+    buffers, a frame with a short payload doesn't occupy the 2060 bytes of
+    a full struct canxl_frame.
+
+    \sa CanFrame::toXlFrame()
+ */
+CanRawSocket::XlFrames CanRawSocket::xlFrames()
+{
+    return socketOption(CanRawSocket::XlFramesOption).value<CanRawSocket::XlFrames>();
+}
+
+void CanRawSocket::setBatchedReceive(CanRawSocket::BatchedReceive batchedReceive)
+{
+    setSocketOption(CanRawSocket::BatchedReceiveOption, QVariant::fromValue(batchedReceive));
+}
+
+CanRawSocket::BatchedReceive CanRawSocket::batchedReceive()
+{
+    return socketOption(CanRawSocket::BatchedReceiveOption).value<CanRawSocket::BatchedReceive>();
+}
+
+void CanRawSocket::setTimestamping(CanRawSocket::Timestamping timestamping)
+{
+    setSocketOption(CanRawSocket::TimestampingOption, QVariant::fromValue(timestamping));
+}
+
+/*!
+    Returns the kind of receive timestamps attached to the read frames.
+
+    Microsecond and nanosecond timestamping use SO_TIMESTAMP and SO_TIMESTAMPNS,
+    the other modes use SO_TIMESTAMPING. Hardware timestamps are only available
+    if the device driver supports them, otherwise the frames carry no timestamp.
+
+    RawHardwareTimestamping attaches the time of the device clock. As the
+    kernel no longer converts it since Linux 3.17, HardwareTimestamping
+    converts it to system time itself, with the offset between the clocks
+    estimated from the software receive times of the last one to two
+    seconds. Until a frame carried both times, a frame has the raw hardware
+    timestamp.
+
+    \sa CanFrame::timestamp()
+ */
+CanRawSocket::Timestamping CanRawSocket::timestamping()
+{
+    return socketOption(CanRawSocket::TimestampingOption).value<CanRawSocket::Timestamping>();
+}
+
+/*!
+    Sets the time in microseconds a receive thread spins on the empty socket
+    before it blocks, 0 disables busy polling.
+
+    A busy polling socket always reads on a receive thread, the owner waiting
+    in waitForReadyRead() spins on the received frames for the same time. The
+    thread is started on the next connectToInterface(). The value is also
+    passed to SO_BUSY_POLL, which only has an effect for devices with NAPI
+    polling and is silently ignored if the kernel refuses it.
+
+    \sa setBusyPollCpu()
+ */
+void CanRawSocket::setBusyPoll(int usecs)
+{
+    setSocketOption(CanRawSocket::BusyPollOption, usecs);
+}
+
+int CanRawSocket::busyPoll()
+{
+    return socketOption(CanRawSocket::BusyPollOption).toInt();
+}
+
+/*!
+    Pins the busy polling receive thread to \a cpu, -1 lets the scheduler
+    place it. Spinning on a cpu shared with other busy threads adds latency
+    instead of removing it.
+ */
+void CanRawSocket::setBusyPollCpu(int cpu)
+{
+    setSocketOption(CanRawSocket::BusyPollCpuOption, cpu);
+}
+
+int CanRawSocket::busyPollCpu()
+{
+    return socketOption(CanRawSocket::BusyPollCpuOption).toInt();
+}
+
+/*!
+    Sets the size of the kernel receive queue of the socket in bytes, 0 keeps
+    the system default. A larger queue absorbs longer bursts while the
+    application is busy.
+
+    The kernel doubles the value for its bookkeeping overhead. Sizes beyond
+    net.core.rmem_max need CAP_NET_ADMIN, otherwise they are capped.
+
+    \sa droppedFrames()
+ */
+void CanRawSocket::setReceiveBufferSize(int bytes)
+{
+    setSocketOption(CanRawSocket::ReceiveBufferSizeOption, bytes);
+}
+
+int CanRawSocket::receiveBufferSize()
+{
+    return socketOption(CanRawSocket::ReceiveBufferSizeOption).toInt();
+}
+
+/*!
+    Sets the size of the kernel send queue of the socket in bytes, 0 keeps
+    the system default. Sizes beyond net.core.wmem_max need CAP_NET_ADMIN.
+ */
+void CanRawSocket::setSendBufferSize(int bytes)
+{
+    setSocketOption(CanRawSocket::SendBufferSizeOption, bytes);
+}
+
+int CanRawSocket::sendBufferSize()
+{
+    return socketOption(CanRawSocket::SendBufferSizeOption).toInt();
+}
+
+/*!
+    Returns the number of frames the kernel dropped since the socket was
+    connected because the receive queue was full.
+
+    The count is taken from the SO_RXQ_OVFL control message of the received
+    frames, so drops are noticed with the next frame read after them. The
+    io_uring backend receives no control messages and doesn't count drops.
+
+    \sa framesDropped(), setReceiveBufferSize()
+ */
+quint64 CanRawSocket::droppedFrames()
+{
+    Q_D(CanRawSocket);
+    return d->droppedFrames.loadAcquire();
+}
+
+/*!
+    Sets the order in which written frames are handed to the socket to
+    \a scheduling.
+
+    With FifoTransmitScheduling, the default, frames are sent in the order
+    they were written. With PriorityTransmitScheduling every frame is queued
+    by its priority class, and the frames of the most urgent class are sent
+    first, the way the bus arbitrates. A bulk transfer of low priority then
+    doesn't hold back urgent frames written after it. Frames of the same
+    class keep their order.
+
+    The frames are handed to the socket in batches of 16, frames of the
+    current batch which the kernel doesn't accept yet are sent before any
+    frame queued later. Switching back to FifoTransmitScheduling moves the
+    queued frames to the write buffer in class order.
+
+    As the frames are classed when they are written, write() checks them
+    right away: it takes the frames before an invalid frame and returns
+    their size, a write starting with an invalid frame returns -1 with a
+    WriteError. With FifoTransmitScheduling the error is reported when the
+    frame is sent.
+
+    \sa setTransmitPriorityClass(), transmitStatistics()
+ */
+void CanRawSocket::setTransmitScheduling(CanRawSocket::TransmitScheduling scheduling)
+{
+    setSocketOption(CanRawSocket::TransmitSchedulingOption, QVariant::fromValue(scheduling));
+}
+
+CanRawSocket::TransmitScheduling CanRawSocket::transmitScheduling()
+{
+    return socketOption(CanRawSocket::TransmitSchedulingOption).value<CanRawSocket::TransmitScheduling>();
+}
+
+/*!
+    Queues the frames matching \a filter in \a priorityClass, from 0, the
+    most urgent, to TransmitPriorityClasses - 1. A frame matches a filter
+    like a received frame matches a CAN filter, the first matching filter
+    set decides.
+
+    Frames matching no filter are classed by their CAN id, with the three
+    most significant bits of the 11 bit base id, which decide the
+    arbitration of standard and extended frames alike.
+
+    \sa setTransmitPriorityClasses(), setTransmitScheduling()
+ */
+void CanRawSocket::setTransmitPriorityClass(const CanRawFilter &filter, int priorityClass)
+{
+    CanRawTransmitClass transmitClass;
+    transmitClass.filter = filter;
+    transmitClass.priorityClass = priorityClass;
+
+    setTransmitPriorityClasses(transmitPriorityClasses() << transmitClass);
+}
+
+void CanRawSocket::clearTransmitPriorityClasses()
+{
+    setTransmitPriorityClasses(CanRawTransmitClassArray());
+}
+
+/*!
+    Sets the priority classes of the frames written, in the order they are
+    matched, replacing the classes set before. Frames already queued keep
+    their class.
+
+    \sa setTransmitPriorityClass()
+ */
+void CanRawSocket::setTransmitPriorityClasses(const CanRawTransmitClassArray &classes)
+{
+    setSocketOption(CanRawSocket::TransmitPriorityClassesOption, QVariant::fromValue(classes));
+}
+
+CanRawTransmitClassArray CanRawSocket::transmitPriorityClasses()
+{
+    return socketOption(CanRawSocket::TransmitPriorityClassesOption).value<CanRawTransmitClassArray>();
+}
+
+/*!
+    Returns the statistics of \a priorityClass since the socket was created
+    or the statistics were reset: the number of frames handed to the socket,
+    the number of frames still queued, and the total and maximum time in
+    nanoseconds the frames spent in the queue.
+
+    \sa resetTransmitStatistics()
+ */
+CanRawTransmitStatistics CanRawSocket::transmitStatistics(int priorityClass)
+{
+    Q_D(CanRawSocket);
+
+    CanRawTransmitStatistics statistics;
+    ::memset(&statistics, 0, sizeof(statistics));
+    if (priorityClass < 0 || priorityClass >= TransmitPriorityClasses)
+        return statistics;
+
+    return d->transmitQueues.statistics[priorityClass];
+}
+
+// the frames still queued stay counted
+void CanRawSocket::resetTransmitStatistics()
+{
+    Q_D(CanRawSocket);
+
+    for (int i = 0; i < TransmitPriorityClasses; ++i) {
+        CanRawTransmitStatistics &statistics = d->transmitQueues.statistics[i];
+        statistics.frames = 0;
+        statistics.totalDelay = 0;
+        statistics.maxDelay = 0;
+    }
+}
+
+/*!
+    Reads up to \a maxCount frames from the read buffer into \a frames and
+    returns the number of frames read, or -1 if the socket isn't readable.
+
+    Frames are decoded straight from the buffered records, the same way as
+    by reading them with a QDataStream, but without streaming every field.
+    The data of a frame is reused when it isn't shared, so reading into the
+    same array again doesn't allocate.
+
+    Like read(), this doesn't wait for frames, see waitForReadyRead().
+
+    \sa writeFrames()
+ */
+qint64 CanRawSocket::readFrames(CanFrame *frames, qint64 maxCount)
+{
+    Q_D(CanRawSocket);
+    return d->readFrames(frames, maxCount);
+}
+
+/*!
+    Writes \a count frames of \a frames to the write buffer and returns the
+    number of frames written, or -1 if none could be written.
+
+    The frames are encoded straight into the buffer in the format of the
+    QDataStream operator. Writing stops at the first frame that is invalid
+    or that the socket can't send with its current options.
+
+    \sa readFrames()
+ */
+qint64 CanRawSocket::writeFrames(const CanFrame *frames, qint64 count)
+{
+    Q_D(CanRawSocket);
+    return d->writeFrames(frames, count);
+}
+
+/*!
+    Fills \a views with up to \a maxCount frames at the front of the read
+    buffer, without removing or copying them, and returns the number of
+    views, or -1 if the socket isn't readable.
+
+    The views point into the read buffer and stay valid until the frames
+    are consumed with consumeFrames() or read in any other way. A handler
+    of readyRead() processes the received frames in spans:
+
+    \code
+    CanFrameView views[64];
+    qint64 count;
+    while ((count = socket->peekFrames(views, 64)) > 0) {
+        for (qint64 i = 0; i < count; ++i)
+            process(views[i]);
+        socket->consumeFrames(count);
+    }
+    \endcode
+
+    A span ends where the buffer continues in another chunk of memory, so
+    fewer than \a maxCount views may be returned although more frames are
+    buffered.
+
+    \sa consumeFrames(), readFrames()
+ */
+qint64 CanRawSocket::peekFrames(CanFrameView *views, qint64 maxCount)
+{
+    Q_D(CanRawSocket);
+    return d->peekFrames(views, maxCount);
+}
+
+/*!
+    Removes \a count frames from the front of the read buffer and returns
+    the number of frames removed. It is used to release the frames handed
+    out by peekFrames(), whose views are invalid afterwards.
+
+    \sa peekFrames()
+ */
+qint64 CanRawSocket::consumeFrames(qint64 count)
+{
+    Q_D(CanRawSocket);
+    return d->consumeFrames(count);
+}
+
+/*!
+    Enables the optimization of the CAN filter before it is passed to the
+    kernel, which walks the filters of a socket for every frame. A negative
+    \a maxOverAcceptance disables it, 0 merges the exact id filters into the
+    fewest id/mask pairs found without changing the accepted frames.
+
+    A value above 0 allows the kernel to accept that many ids outside of the
+    filter per filtered id, in exchange for fewer entries. The frames let
+    through this way are dropped again while they are read.
+
+    \sa CanRawFilterOptimizer, kernelFilterCount(), filterFalsePositiveRate()
+ */
+void CanRawSocket::setFilterOptimization(qreal maxOverAcceptance)
+{
+    setSocketOption(FilterOptimizationOption, maxOverAcceptance);
+}
+
+qreal CanRawSocket::filterOptimization()
+{
+    return socketOption(FilterOptimizationOption).toReal();
+}
+
+// number of filters passed to the kernel for the current CAN filter
+int CanRawSocket::kernelFilterCount()
+{
+    Q_D(CanRawSocket);
+    if (d->filterOptimization < 0)
+        return d->canFilter.size();
+    return d->filterOptimizer.filterCount();
+}
+
+/*!
+    Returns the share of ids accepted by the kernel filters which the CAN
+    filter rejects, 0 unless the filter optimization over-accepts.
+
+    \sa postFilteredFrames()
+ */
+qreal CanRawSocket::filterFalsePositiveRate()
+{
+    Q_D(CanRawSocket);
+    if (d->filterOptimization < 0)
+        return 0;
+    return d->filterOptimizer.falsePositiveRate();
+}
+
+// number of frames accepted by the optimized kernel filters but dropped while reading
+quint64 CanRawSocket::postFilteredFrames()
+{
+    Q_D(CanRawSocket);
+    return d->postFilteredFrames.loadAcquire();
+}
+
+void CanRawSocket::setBpfFilter(const CanRawBpfFilter &filter)
+{
+    setSocketOption(BpfFilterOption, QVariant::fromValue(filter));
+}
+
+/*!
+    Returns the BPF filter attached to the socket.
+
+    The filter runs in the kernel after the CAN_RAW_FILTER identifier filter,
+    so frames rejected by the payload predicates are never copied to user
+    space. An empty filter detaches the program.
+
+    \sa CanRawBpfFilter::program(), setCanFilter()
+ */
+CanRawBpfFilter CanRawSocket::bpfFilter()
+{
+    return socketOption(BpfFilterOption).value<CanRawBpfFilter>();
+}
+
+void CanRawSocket::setReceiveInterfaceIndex(CanRawSocket::ReceiveInterfaceIndex interfaceIndex)
+{
+    setSocketOption(CanRawSocket::ReceiveInterfaceIndexOption, QVariant::fromValue(interfaceIndex));
+}
+
+/*!
+    Returns whether the read frames carry the index of the interface they
+    were received on.
+
+    Together with connectToInterface() on an empty interface name, which binds
+    the socket to all CAN interfaces, one socket receives the traffic of every
+    channel and CanFrame::interfaceIndex() tells the channels apart. Such a
+    socket has no interface to write to.
+
+    \sa CanFrame::interfaceName()
+ */
+CanRawSocket::ReceiveInterfaceIndex CanRawSocket::receiveInterfaceIndex()
+{
+    return socketOption(CanRawSocket::ReceiveInterfaceIndexOption).value<CanRawSocket::ReceiveInterfaceIndex>();
+}
+
+void CanRawSocket::setFilterTransition(CanRawSocket::FilterTransition transition)
+{
+    setSocketOption(CanRawSocket::FilterTransitionOption, QVariant::fromValue(transition));
+}
+
+/*!
+    Returns how setCanFilter() changes the filters of a connected socket.
+
+    The kernel exchanges the filters of a socket one by one, so a frame
+    arriving during setCanFilter() may be dropped although both filter sets
+    accept it. With LosslessFilterTransition a second socket is bound with the
+    new filters before the filters of the socket change. Frames received
+    before the second socket was bound are read with the old filters, frames
+    received from then on with the new ones, split by their kernel receive
+    timestamps. No frame is lost or read twice and the order is kept.
+
+    The frames of a transition are taken from both sockets as they arrive,
+    whether or not readBufferSize() leaves room for them, and are read as
+    usual afterwards. Frames the kernel drops because a receive queue is
+    full are counted by droppedFrames(). A filter set while a transition is
+    running replaces any filter waiting before it and goes through its own
+    transition once the running one is complete, setCanFilter() doesn't wait
+    for it.
+
+    The transition needs receive timestamps, they are enabled internally
+    while the mode is set, without adding them to the read frames unless
+    timestamping() asks for them. Sockets reading with the io_uring backend or
+    the receive thread change their filters immediately.
+ */
+CanRawSocket::FilterTransition CanRawSocket::filterTransition()
+{
+    return socketOption(CanRawSocket::FilterTransitionOption).value<CanRawSocket::FilterTransition>();
+}
+
 CanRawSocketPrivate::CanRawSocketPrivate(qint32 readChunkSize, qint64 initialBufferSize)
     : CanAbstractSocketPrivate(readChunkSize, initialBufferSize)
     , canFilter(1, CanRawFilter())
+    , filterOptimization(-1)
+    , postFilter(false)
+    , postFilteredFrames(0)
     , errorFilterMask(CanFrame::NoError)
     , loopback(CanRawSocket::EnabledLoopback)
     , receiveOwnMessages(CanRawSocket::DisabledOwnMessages)
     , flexibleDataRateFrames(CanRawSocket::DisabledFdFrames)
+    , xlFrames(CanRawSocket::DisabledXlFrames)
+    , batchedReceive(CanRawSocket::EnabledBatchedReceive)
+    , batchedReceiveSupported(true)
+    , batchedTransmitSupported(true)
+    , timestamping(CanRawSocket::DisabledTimestamping)
+    , receiveInterfaceIndex(CanRawSocket::DisabledInterfaceIndex)
+    , filterTransition(CanRawSocket::ImmediateFilterTransition)
+    , transmitScheduling(CanRawSocket::FifoTransmitScheduling)
+    , boundInterfaceIndex(0)
+    , transitionDescriptor(-1)
+    , transitionStart(0)
+    , transitionEnd(0)
+    , oldFramesDone(false)
+    , newFramesDone(false)
+    , oldPostFilter(false)
+    , transitionDropCount(0)
+    , filterPending(false)
+    , pendingPostFilter(false)
+    , receiveTime(0)
+    , busyPoll(0)
+    , busyPollCpu(-1)
+    , receiveBufferSize(0)
+    , sendBufferSize(0)
+    , kernelDropCount(0)
+    , hardwareClockWindowStart(0)
+    , hardwareClockOffset(0)
+    , previousHardwareClockOffset(0)
+    , droppedFrames(0)
+    , reportedDroppedFrames(0)
 {
 }
 
 CanRawSocketPrivate::~CanRawSocketPrivate()
 {
+    if (transitionDescriptor != -1)
+        ::close(transitionDescriptor);
 }
 
 bool CanRawSocketPrivate::connectToInterface(const QString &interfaceName)
@@ -275,14 +785,32 @@ bool CanRawSocketPrivate::connectToInterface(const QString &interfaceName)
         }
         addr.can_ifindex = ifr.ifr_ifindex;
     }
+    boundInterfaceIndex = addr.can_ifindex;
 
     if (!setSocketOption(CanRawSocket::CanFilterOption, QVariant::fromValue(canFilter))
             || !setSocketOption(CanRawSocket::ErrorFilterMaskOption, QVariant::fromValue(errorFilterMask))
+            || !setSocketOption(CanRawSocket::BpfFilterOption, QVariant::fromValue(bpfFilter))
             || !setSocketOption(CanRawSocket::LoopbackOption, QVariant::fromValue(loopback))
             || !setSocketOption(CanRawSocket::ReceiveOwnMessagesOption, QVariant::fromValue(receiveOwnMessages))
-            || !setSocketOption(CanRawSocket::FlexibleDataRateFramesOption, QVariant::fromValue(flexibleDataRateFrames))) {
+            || !setSocketOption(CanRawSocket::FlexibleDataRateFramesOption, QVariant::fromValue(flexibleDataRateFrames))
+            || !setSocketOption(CanRawSocket::XlFramesOption, QVariant::fromValue(xlFrames))
+            || !setSocketOption(CanRawSocket::TimestampingOption, QVariant::fromValue(timestamping))
+            || !setSocketOption(CanRawSocket::BusyPollOption, busyPoll)
+            || !setSocketOption(CanRawSocket::ReceiveBufferSizeOption, receiveBufferSize)
+            || !setSocketOption(CanRawSocket::SendBufferSizeOption, sendBufferSize)) {
+        return false;
+    }
+
+    // drop counter of the socket as control message of every received frame
+    const int dropCounter = 1;
+    if (::setsockopt(descriptor, SOL_SOCKET, SO_RXQ_OVFL, &dropCounter, sizeof(int)) == -1) {
+        setError(getSystemError());
         return false;
     }
+    kernelDropCount = 0;
+    hardwareClockWindowStart = 0;
+    droppedFrames.storeRelease(0);
+    reportedDroppedFrames = 0;
 
     if (::bind(descriptor, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
         setError(getSystemError());
@@ -292,7 +820,49 @@ bool CanRawSocketPrivate::connectToInterface(const QString &interfaceName)
     return true;
 }
 
+void CanRawSocketPrivate::disconnectFromInterface()
+{
+    finishFilterTransition();
+    mergedFrames.clear();
+    heldFrames.clear();
+    filterPending = false;
+    clearTransmitQueues();
+
+    CanAbstractSocketPrivate::disconnectFromInterface();
+}
+
+// options readFromSocket() depends on, the CAN filter and its optimization
+// replace the optimizer of the post filter
+static inline bool isReceiveOption(CanRawSocket::CanRawSocketOption option)
+{
+    switch (option) {
+    case CanRawSocket::CanFilterOption:
+    case CanRawSocket::FilterOptimizationOption:
+    case CanRawSocket::FlexibleDataRateFramesOption:
+    case CanRawSocket::XlFramesOption:
+    case CanRawSocket::BatchedReceiveOption:
+    case CanRawSocket::TimestampingOption:
+    case CanRawSocket::ReceiveInterfaceIndexOption:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+    A receive thread reads the socket with the receive options, it is
+    suspended while one of them changes.
+*/
 bool CanRawSocketPrivate::setSocketOption(CanRawSocket::CanRawSocketOption option, const QVariant &value)
+{
+    const bool suspended = isReceiveOption(option) && suspendReceiveThread();
+    const bool ok = applySocketOption(option, value);
+    if (suspended)
+        resumeReceiveThread();
+    return ok;
+}
+
+bool CanRawSocketPrivate::applySocketOption(CanRawSocket::CanRawSocketOption option, const QVariant &value)
 {
     Q_Q(CanRawSocket);
 
@@ -300,11 +870,7 @@ bool CanRawSocketPrivate::setSocketOption(CanRawSocket::CanRawSocketOption optio
     case CanRawSocket::CanFilterOption:
         if (value.canConvert<CanRawFilterArray>()) {
             CanRawFilterArray newCanFilter = value.value<CanRawFilterArray>();
-            if (::setsockopt(descriptor,
-                             SOL_CAN_RAW,
-                             CAN_RAW_FILTER,
-                             newCanFilter.data(),
-                             newCanFilter.size()*sizeof(CanRawFilter)) == -1 ) {
+            if (!applyCanFilter(newCanFilter)) {
                 setError(getSystemError());
                 break;
             }
@@ -315,6 +881,38 @@ bool CanRawSocketPrivate::setSocketOption(CanRawSocket::CanRawSocketOption optio
             return true;
         }
         break;
+    case CanRawSocket::FilterOptimizationOption:
+        if (value.canConvert<qreal>()) {
+            qreal newFilterOptimization = value.toReal();
+            if (newFilterOptimization < 0)
+                newFilterOptimization = -1;
+            if (newFilterOptimization != filterOptimization) {
+                const qreal oldFilterOptimization = filterOptimization;
+                filterOptimization = newFilterOptimization;
+                if (descriptor != -1 && !applyCanFilter(canFilter)) {
+                    filterOptimization = oldFilterOptimization;
+                    setError(getSystemError());
+                    break;
+                }
+                emit q->filterOptimizationChanged();
+            }
+            return true;
+        }
+        break;
+    case CanRawSocket::BpfFilterOption:
+        if (value.canConvert<CanRawBpfFilter>()) {
+            CanRawBpfFilter newBpfFilter = value.value<CanRawBpfFilter>();
+            if (!applyBpfFilter(descriptor, newBpfFilter)) {
+                setError(getSystemError());
+                break;
+            }
+            if (newBpfFilter != bpfFilter) {
+                bpfFilter = newBpfFilter;
+                emit q->bpfFilterChanged();
+            }
+            return true;
+        }
+        break;
     case CanRawSocket::ErrorFilterMaskOption:
         if (value.canConvert<CanFrame::CanFrameErrors>()) {
             CanFrame::CanFrameErrors newErrorFilterMask = value.value<CanFrame::CanFrameErrors>();
@@ -373,7 +971,8 @@ bool CanRawSocketPrivate::setSocketOption(CanRawSocket::CanRawSocketOption optio
         if (value.canConvert<int>()) {
             CanRawSocket::FlexibleDataRateFrames newFlexibleDataRateFrames = value.value<CanRawSocket::FlexibleDataRateFrames>();
 
-#ifndef CAN_RAW_FD_FRAMES
+            // the socket options are enum values, the MTU macros tell the kernel headers apart
+#ifndef CANFD_MTU
             if (newFlexibleDataRateFrames == CanRawSocket::EnabledFdFrames)
                 break;
 
@@ -381,26 +980,15 @@ bool CanRawSocketPrivate::setSocketOption(CanRawSocket::CanRawSocketOption optio
 
 #else
             //check if device supports fd frames
-            struct ifreq ifr;
-
-            ::strcpy(ifr.ifr_name, interfaceName.toLocal8Bit().constData());
-            if (::ioctl(descriptor, SIOCGIFINDEX, &ifr) < 0) {
+            const int mtu = deviceMtu();
+            if (mtu == -1) {
                 setError(getSystemError());
                 break;
             }
-            if (::ioctl(descriptor, SIOCGIFMTU, &ifr) == -1) {
-                if (newFlexibleDataRateFrames == CanRawSocket::EnabledFDFrames) {
-                    setError(getSystemError());
-                    break;
-                }
-                else
-                    return true;
-            }
-            else if (ifr.ifr_mtu != CANFD_MTU) {
-                if (newFlexibleDataRateFrames == CanRawSocket::EnabledFDFrames) {
-                    setError(CanAbstractSocketErrorInfo(CanAbstractSocket::UnsupportedSocketOperationError, CanRawSocket::tr("Device doesn't support flexible data rate frames")));
-                    break;
-                }
+            if (mtu < static_cast<int>(CANFD_MTU)
+                    && newFlexibleDataRateFrames == CanRawSocket::EnabledFdFrames) {
+                setError(CanAbstractSocketErrorInfo(CanAbstractSocket::UnsupportedSocketOperationError, CanRawSocket::tr("Device doesn't support flexible data rate frames")));
+                break;
             }
 
             if (::setsockopt(descriptor,
@@ -419,141 +1007,1343 @@ bool CanRawSocketPrivate::setSocketOption(CanRawSocket::CanRawSocketOption optio
 #endif
         }
         break;
+    case CanRawSocket::XlFramesOption:
+        if (value.canConvert<int>()) {
+            CanRawSocket::XlFrames newXlFrames = value.value<CanRawSocket::XlFrames>();
+            if (newXlFrames == CanRawSocket::UndefinedXlFrames)
+                break;
 
-    }
-
-    return false;
+#ifndef CANXL_MIN_MTU
+            if (newXlFrames == CanRawSocket::EnabledXlFrames) {
+                setError(CanAbstractSocketErrorInfo(CanAbstractSocket::UnsupportedSocketOperationError, CanRawSocket::tr("CAN XL frames need Linux 6.2")));
+                break;
+            }
 
-}
+            return true;
 
-QVariant CanRawSocketPrivate::socketOption(CanRawSocket::CanRawSocketOption option)
-{
-    QVariant result;
+#else
+            // stored until the socket is connected, the I/O backends size their buffers for it
+            if (descriptor == -1) {
+                if (newXlFrames != xlFrames) {
+                    xlFrames = newXlFrames;
+                    emit q->xlFramesChanged();
+                }
+                return true;
+            }
 
-    switch (option) {
-    case CanRawSocket::CanFilterOption:
-        result.setValue(canFilter);
-        break;
-    case CanRawSocket::ErrorFilterMaskOption:
-        result.setValue(errorFilterMask);
-        break;
-    case CanRawSocket::LoopbackOption:
-        result.setValue(loopback);
-        break;
-    case CanRawSocket::ReceiveOwnMessagesOption:
-        result.setValue(receiveOwnMessages);
-        break;
-    case CanRawSocket::FlexibleDataRateFramesOption:
-        result.setValue(flexibleDataRateFrames);
-        break;
-    }
+            // the receive buffers of io_uring have the size of a frame
+            if (ioUring && newXlFrames != xlFrames) {
+                setError(CanAbstractSocketErrorInfo(CanAbstractSocket::UnsupportedSocketOperationError, CanRawSocket::tr("CAN XL frames have to be set before connecting with io_uring")));
+                break;
+            }
 
-    return result;
-}
+            if (newXlFrames == CanRawSocket::EnabledXlFrames) {
+                const int mtu = deviceMtu();
+                if (mtu == -1) {
+                    setError(getSystemError());
+                    break;
+                }
+                if (mtu < static_cast<int>(CANXL_MIN_MTU)) {
+                    setError(CanAbstractSocketErrorInfo(CanAbstractSocket::UnsupportedSocketOperationError, CanRawSocket::tr("Device doesn't support CAN XL frames")));
+                    break;
+                }
+            }
 
-qint64 CanRawSocketPrivate::readFromSocket(char *data, qint64 maxSize)
-{
-    size_t frameSize = CAN_MTU;
-#ifdef CANFD_MTU
-    if (flexibleDataRateFrames == CanRawSocket::EnabledFdFrames)
-        frameSize = CANFD_MTU;
+            // kernels before Linux 6.2 don't know the option, they have no XL frames to disable
+            if (::setsockopt(descriptor,
+                             SOL_CAN_RAW,
+                             CAN_RAW_XL_FRAMES,
+                             &newXlFrames,
+                             sizeof(int)) == -1
+                    && (newXlFrames == CanRawSocket::EnabledXlFrames || errno != ENOPROTOOPT)) {
+                setError(getSystemError());
+                break;
+            }
+#ifdef CAN_RAW_XL_VCID_TX_PASS
+            // pass the virtual CAN network id in both directions, without
+            // the option the kernel drops received frames with an id
+            if (newXlFrames == CanRawSocket::EnabledXlFrames) {
+                struct can_raw_vcid_options vcidOptions;
+                ::memset(&vcidOptions, 0, sizeof(vcidOptions));
+                vcidOptions.flags = CAN_RAW_XL_VCID_TX_PASS | CAN_RAW_XL_VCID_RX_FILTER;
+                ::setsockopt(descriptor, SOL_CAN_RAW, CAN_RAW_XL_VCID_OPTS, &vcidOptions, sizeof(vcidOptions));
+            }
 #endif
+            // a full XL frame is larger than the read chunk of classic and fd frames,
+            // a suspended receive thread gets slots of the new size when it is resumed
+            readChunkSize = newXlFrames == CanRawSocket::EnabledXlFrames
+                    ? CAN_RAW_XL_READ_CHUNK_SIZE : CAN_RAW_READ_CHUNK_SIZE;
+
+            if (newXlFrames != xlFrames) {
+                xlFrames = newXlFrames;
+                emit q->xlFramesChanged();
+            }
+            return true;
+#endif
+        }
+        break;
+    case CanRawSocket::BatchedReceiveOption:
+        if (value.canConvert<int>()) {
+            CanRawSocket::BatchedReceive newBatchedReceive = value.value<CanRawSocket::BatchedReceive>();
+            if (newBatchedReceive == CanRawSocket::UndefinedBatchedReceive)
+                break;
+            if (newBatchedReceive != batchedReceive) {
+                batchedReceive = newBatchedReceive;
+                emit q->batchedReceiveChanged();
+            }
+            return true;
+        }
+        break;
+    case CanRawSocket::TimestampingOption:
+        if (value.canConvert<int>()) {
+            CanRawSocket::Timestamping newTimestamping = value.value<CanRawSocket::Timestamping>();
+            if (!applyTimestamping(descriptor, newTimestamping)) {
+                setError(getSystemError());
+                break;
+            }
+            if (newTimestamping != timestamping) {
+                timestamping = newTimestamping;
+                emit q->timestampingChanged();
+            }
+            return true;
+        }
+        break;
+    case CanRawSocket::BusyPollOption:
+        if (value.canConvert<int>()) {
+            int newBusyPoll = value.toInt();
+            if (newBusyPoll < 0)
+                break;
+#ifdef SO_BUSY_POLL
+            // needs CAP_NET_ADMIN to raise it above net.core.busy_read, the
+            // user space spinning of the receive thread works without it
+            if (descriptor != -1)
+                ::setsockopt(descriptor, SOL_SOCKET, SO_BUSY_POLL, &newBusyPoll, sizeof(int));
+#endif
+            if (newBusyPoll != busyPoll) {
+                busyPoll = newBusyPoll;
+                emit q->busyPollChanged();
+            }
+            return true;
+        }
+        break;
+    case CanRawSocket::BusyPollCpuOption:
+        if (value.canConvert<int>()) {
+            int newBusyPollCpu = value.toInt();
+            if (newBusyPollCpu < -1 || newBusyPollCpu >= CPU_SETSIZE)
+                break;
+            if (newBusyPollCpu != busyPollCpu) {
+                busyPollCpu = newBusyPollCpu;
+                emit q->busyPollCpuChanged();
+            }
+            return true;
+        }
+        break;
+    case CanRawSocket::ReceiveInterfaceIndexOption:
+        if (value.canConvert<int>()) {
+            CanRawSocket::ReceiveInterfaceIndex newInterfaceIndex = value.value<CanRawSocket::ReceiveInterfaceIndex>();
+            if (newInterfaceIndex == CanRawSocket::UndefinedInterfaceIndex)
+                break;
+            if (newInterfaceIndex != receiveInterfaceIndex) {
+                receiveInterfaceIndex = newInterfaceIndex;
+                emit q->receiveInterfaceIndexChanged();
+            }
+            return true;
+        }
+        break;
+    case CanRawSocket::ReceiveBufferSizeOption:
+        if (value.canConvert<int>()) {
+            int newReceiveBufferSize = value.toInt();
+            if (newReceiveBufferSize < 0)
+                break;
+            if (!applyBufferSize(descriptor, SO_RCVBUF, SO_RCVBUFFORCE, newReceiveBufferSize)) {
+                setError(getSystemError());
+                break;
+            }
+            if (newReceiveBufferSize != receiveBufferSize) {
+                receiveBufferSize = newReceiveBufferSize;
+                emit q->receiveBufferSizeChanged();
+            }
+            return true;
+        }
+        break;
+    case CanRawSocket::SendBufferSizeOption:
+        if (value.canConvert<int>()) {
+            int newSendBufferSize = value.toInt();
+            if (newSendBufferSize < 0)
+                break;
+            if (!applyBufferSize(descriptor, SO_SNDBUF, SO_SNDBUFFORCE, newSendBufferSize)) {
+                setError(getSystemError());
+                break;
+            }
+            if (newSendBufferSize != sendBufferSize) {
+                sendBufferSize = newSendBufferSize;
+                emit q->sendBufferSizeChanged();
+            }
+            return true;
+        }
+        break;
+    case CanRawSocket::FilterTransitionOption:
+        if (value.canConvert<int>()) {
+            CanRawSocket::FilterTransition newFilterTransition = value.value<CanRawSocket::FilterTransition>();
+            if (newFilterTransition == CanRawSocket::UndefinedFilterTransition)
+                break;
+            if (newFilterTransition != filterTransition) {
+                // the receive timestamps of the transition follow the mode
+                const CanRawSocket::FilterTransition oldFilterTransition = filterTransition;
+                filterTransition = newFilterTransition;
+                if (descriptor != -1 && !applyTimestamping(descriptor, timestamping)) {
+                    filterTransition = oldFilterTransition;
+                    setError(getSystemError());
+                    break;
+                }
+                emit q->filterTransitionChanged();
+            }
+            return true;
+        }
+        break;
+    case CanRawSocket::TransmitSchedulingOption:
+        if (value.canConvert<int>()) {
+            CanRawSocket::TransmitScheduling newTransmitScheduling = value.value<CanRawSocket::TransmitScheduling>();
+            if (newTransmitScheduling == CanRawSocket::UndefinedTransmitScheduling)
+                break;
+            if (newTransmitScheduling != transmitScheduling) {
+                transmitScheduling = newTransmitScheduling;
+                // queued frames keep their order, behind the frames of the write buffer
+                if (transmitScheduling == CanRawSocket::FifoTransmitScheduling) {
+                    moveTransmitQueues(-1);
+                    if (!partialTransmitRecord.isEmpty()) {
+                        ::memcpy(writeBuffer.reserve(partialTransmitRecord.size()),
+                                 partialTransmitRecord.constData(), partialTransmitRecord.size());
+                        partialTransmitRecord.clear();
+                    }
+                    if (!writeBuffer.isEmpty() && !isWriteNotificationEnabled())
+                        setWriteNotificationEnabled(true);
+                }
+                emit q->transmitSchedulingChanged();
+            }
+            return true;
+        }
+        break;
+    case CanRawSocket::TransmitPriorityClassesOption:
+        if (value.canConvert<CanRawTransmitClassArray>()) {
+            CanRawTransmitClassArray newClasses = value.value<CanRawTransmitClassArray>();
+            bool valid = true;
+            for (int i = 0; i < newClasses.size(); ++i) {
+                const int priorityClass = newClasses.at(i).priorityClass;
+                if (priorityClass < 0 || priorityClass >= CanRawSocket::TransmitPriorityClasses) {
+                    valid = false;
+                    break;
+                }
+            }
+            if (!valid) {
+                setError(CanAbstractSocketErrorInfo(CanAbstractSocket::UnsupportedSocketOperationError, CanRawSocket::tr("Invalid priority class")));
+                break;
+            }
+            if (newClasses != transmitQueues.classes) {
+                transmitQueues.classes = newClasses;
+                emit q->transmitPriorityClassesChanged();
+            }
+            return true;
+        }
+        break;
+    }
+
+    return false;
+
+}
+
+QVariant CanRawSocketPrivate::socketOption(CanRawSocket::CanRawSocketOption option)
+{
+    QVariant result;
+
+    switch (option) {
+    case CanRawSocket::CanFilterOption:
+        result.setValue(canFilter);
+        break;
+    case CanRawSocket::FilterOptimizationOption:
+        result.setValue(filterOptimization);
+        break;
+    case CanRawSocket::BpfFilterOption:
+        result.setValue(bpfFilter);
+        break;
+    case CanRawSocket::ErrorFilterMaskOption:
+        result.setValue(errorFilterMask);
+        break;
+    case CanRawSocket::LoopbackOption:
+        result.setValue(loopback);
+        break;
+    case CanRawSocket::ReceiveOwnMessagesOption:
+        result.setValue(receiveOwnMessages);
+        break;
+    case CanRawSocket::FlexibleDataRateFramesOption:
+        result.setValue(flexibleDataRateFrames);
+        break;
+    case CanRawSocket::XlFramesOption:
+        result.setValue(xlFrames);
+        break;
+    case CanRawSocket::BatchedReceiveOption:
+        result.setValue(batchedReceive);
+        break;
+    case CanRawSocket::TimestampingOption:
+        result.setValue(timestamping);
+        break;
+    case CanRawSocket::BusyPollOption:
+        result.setValue(busyPoll);
+        break;
+    case CanRawSocket::BusyPollCpuOption:
+        result.setValue(busyPollCpu);
+        break;
+    case CanRawSocket::ReceiveInterfaceIndexOption:
+        result.setValue(receiveInterfaceIndex);
+        break;
+    case CanRawSocket::ReceiveBufferSizeOption:
+        result.setValue(receiveBufferSize);
+        break;
+    case CanRawSocket::SendBufferSizeOption:
+        result.setValue(sendBufferSize);
+        break;
+    case CanRawSocket::FilterTransitionOption:
+        result.setValue(filterTransition);
+        break;
+    case CanRawSocket::TransmitSchedulingOption:
+        result.setValue(transmitScheduling);
+        break;
+    case CanRawSocket::TransmitPriorityClassesOption:
+        result.setValue(transmitQueues.classes);
+        break;
+    }
+
+    return result;
+}
+
+/* we add aditional data (max dlen and mtu) to reserved pading bytes
+    (__res0 and __res1, see can.h) in order to distinct between the two frame types.
+    CAN XL frames are told apart by their XL flag and keep their length field.
+*/
+static inline bool tagReceivedFrame(char *data, int length, size_t frameSize)
+{
+    if (frameSize == CANXL_MTU
+            && length >= static_cast<int>(CANXL_HDR_SIZE + CANXL_MIN_DLEN)
+            && isXlFrameRecord(data)) {
+        // received XL frame in XL mode, the kernel only copies the used payload
+        return length == static_cast<int>(CANXL_HDR_SIZE) + xlDataLengthFromRecord(data);
+    }
+    else if (length == CAN_MTU) {
+        // received can frame in can, canfd or XL mode
+        data[RES0_BYTE] = res0FromCanMtu(CAN_MTU);
+        data[RES1_BYTE] = res1FromCanMtu(CAN_MTU);
+        return true;
+    }
+#ifdef CANFD_MTU
+    else if (length == CANFD_MTU && static_cast<int>(frameSize) >= length) {
+        // received canfd frame in canfd or XL mode
+        data[RES0_BYTE] = res0FromCanMtu(CANFD_MTU);
+        data[RES1_BYTE] = res1FromCanMtu(CANFD_MTU);
+        return true;
+    }
+#endif
+    return false;
+}
+
+// MTU of the device of the socket, a socket bound to all interfaces finds out when writing
+int CanRawSocketPrivate::deviceMtu() const
+{
+    if (interfaceName.isEmpty())
+        return CANXL_MTU;
+
+    struct ifreq ifr;
+    ::strcpy(ifr.ifr_name, interfaceName.toLocal8Bit().constData());
+    if (::ioctl(descriptor, SIOCGIFMTU, &ifr) == -1)
+        return -1;
+
+    return ifr.ifr_mtu;
+}
+
+// space of a received frame, records in the read buffer may be shorter
+size_t CanRawSocketPrivate::receiveFrameSize() const
+{
+    if (xlFrames == CanRawSocket::EnabledXlFrames)
+        return CANXL_MTU;
+#ifdef CANFD_MTU
+    if (flexibleDataRateFrames == CanRawSocket::EnabledFdFrames)
+        return CANFD_MTU;
+#endif
+    return CAN_MTU;
+}
+
+bool CanRawSocketPrivate::applyTimestamping(int fd, CanRawSocket::Timestamping newTimestamping)
+{
+    int timestampFlag = 0;
+    int timestampNsFlag = 0;
+    int timestampingFlags = 0;
+
+    switch (newTimestamping) {
+    case CanRawSocket::DisabledTimestamping:
+        break;
+    case CanRawSocket::MicrosecondTimestamping:
+        timestampFlag = 1;
+        break;
+    case CanRawSocket::NanosecondTimestamping:
+        timestampNsFlag = 1;
+        break;
+    case CanRawSocket::SoftwareTimestamping:
+        timestampingFlags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+        break;
+    case CanRawSocket::HardwareTimestamping:
+        // the software receive time relates the raw hardware time to system time
+        timestampingFlags = SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE
+                | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+        break;
+    case CanRawSocket::RawHardwareTimestamping:
+        timestampingFlags = SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+        break;
+    default:
+        errno = EINVAL;
+        return false;
+    }
+
+    // the lossless filter transition splits the frames by their software receive time
+    if (filterTransition == CanRawSocket::LosslessFilterTransition) {
+        if (timestampingFlags)
+            timestampingFlags |= SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+        else if (!timestampFlag)
+            timestampNsFlag = 1;
+    }
+
+    if (::setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &timestampingFlags, sizeof(int)) == -1)
+        return false;
+
+    // disabling SO_TIMESTAMP or SO_TIMESTAMPNS clears both, the enabled one goes last
+    if (timestampFlag) {
+        return ::setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &timestampNsFlag, sizeof(int)) != -1
+                && ::setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, &timestampFlag, sizeof(int)) != -1;
+    }
+    return ::setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, &timestampFlag, sizeof(int)) != -1
+            && ::setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &timestampNsFlag, sizeof(int)) != -1;
+}
+
+/*
+    Sets the socket buffer \a option to \a size, the size is stored until
+    the socket is connected. The force variant lifts the system limit for
+    privileged processes, everybody else gets the capped size.
+*/
+bool CanRawSocketPrivate::applyBufferSize(int fd, int option, int forceOption, int size)
+{
+    if (fd == -1 || size == 0)
+        return true;
+
+    return ::setsockopt(fd, SOL_SOCKET, forceOption, &size, sizeof(int)) != -1
+            || ::setsockopt(fd, SOL_SOCKET, option, &size, sizeof(int)) != -1;
+}
+
+/*
+    Passes \a filter to the kernel, optimized if the filter optimization is
+    enabled. Over-accepting kernel filters enable the post filter of the read
+    frames.
+*/
+bool CanRawSocketPrivate::applyCanFilter(const CanRawFilterArray &filter)
+{
+    CanRawFilterArray kernelFilter = filter;
+    CanRawFilterOptimizer optimizer(qMax<qreal>(filterOptimization, 0));
+    if (filterOptimization >= 0)
+        kernelFilter = optimizer.optimize(filter);
+
+    if (canStartFilterTransition()) {
+        // one transition at a time, the filter waits for the running one,
+        // see scheduleTransitionRead()
+        if (transitionDescriptor != -1) {
+            filterPending = true;
+            pendingKernelFilter = kernelFilter;
+            pendingFilterOptimizer = optimizer;
+            pendingPostFilter = filterOptimization > 0 && optimizer.needsPostFilter();
+            return true;
+        }
+        if (!startFilterTransition(kernelFilter))
+            return false;
+        oldFilterOptimizer = filterOptimizer;
+        oldPostFilter = postFilter;
+    }
+    else if (::setsockopt(descriptor,
+                          SOL_CAN_RAW,
+                          CAN_RAW_FILTER,
+                          kernelFilter.data(),
+                          kernelFilter.size()*sizeof(CanRawFilter)) == -1 ) {
+        return false;
+    }
+
+    // the reading thread is suspended by setSocketOption(), see isReceiveOption()
+    filterOptimizer = optimizer;
+    postFilter = filterOptimization > 0 && optimizer.needsPostFilter();
+    filterPending = false;
+    return true;
+}
+
+// true if the frame at data passed the optimized kernel filters only
+static inline bool isRejectedByPostFilter(const CanRawFilterOptimizer &optimizer, bool postFilter, const char *data)
+{
+    if (!postFilter)
+        return false;
+
+    quint32 canId;
+    ::memcpy(&canId, data, sizeof(canId));
+    return !optimizer.accepts(canId);
+}
+
+inline bool CanRawSocketPrivate::isPostFiltered(const char *data) const
+{
+    // the frames of a filter transition are checked against the filters they passed
+    if (transitionDescriptor != -1)
+        return false;
+
+    return isRejectedByPostFilter(filterOptimizer, postFilter, data);
+}
+
+// the filter is stored until the socket is connected
+bool CanRawSocketPrivate::applyBpfFilter(int fd, const CanRawBpfFilter &filter)
+{
+    if (fd == -1)
+        return true;
+
+    if (filter.isEmpty()) {
+        // detaching without an attached filter fails with ENOENT
+        const int dummy = 0;
+        return ::setsockopt(fd, SOL_SOCKET, SO_DETACH_FILTER, &dummy, sizeof(int)) != -1
+                || errno == ENOENT;
+    }
+
+    QByteArray program = filter.program();
+    if (program.isEmpty()) {
+        errno = EINVAL;
+        return false;
+    }
+
+    struct sock_fprog fprog;
+    fprog.len = program.size() / sizeof(struct sock_filter);
+    fprog.filter = reinterpret_cast<struct sock_filter *>(program.data());
+    return ::setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) != -1;
+}
+
+static inline qint64 nsecsFromTimespec(const struct timespec &ts)
+{
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// the clock of the software receive timestamps
+static inline qint64 realtimeNsecs()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_REALTIME, &ts);
+    return nsecsFromTimespec(ts);
+}
+
+// the clock of the queueing delays of the transmit queues
+static inline qint64 monotonicNsecs()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return nsecsFromTimespec(ts);
+}
+
+/*
+    Takes the running drop counter of the socket, which is a 32 bit value that
+    wraps around, into the 64 bit count of dropped frames.
+*/
+void CanRawSocketPrivate::updateDroppedFrames(quint32 dropCount)
+{
+    const quint32 newDrops = dropCount - kernelDropCount;
+    if (newDrops == 0)
+        return;
+
+    kernelDropCount = dropCount;
+    droppedFrames.fetchAndAddRelease(newDrops);
+}
+
+// emits framesDropped() in the thread of the socket, the count may be updated by the receive thread
+void CanRawSocketPrivate::checkReceiveStatistics()
+{
+    Q_Q(CanRawSocket);
+
+    const quint64 dropped = droppedFrames.loadAcquire();
+    if (dropped == reportedDroppedFrames)
+        return;
+
+    const quint64 newDrops = dropped - reportedDroppedFrames;
+    reportedDroppedFrames = dropped;
+    emit q->framesDropped(newDrops);
+}
+
+void CanRawSocketPrivate::parseControlMessages(struct msghdr *message, CanFrameTrailer *trailer)
+{
+    // source address of the frame, only requested for the interface index
+    if (message->msg_name && message->msg_namelen >= sizeof(struct sockaddr_can))
+        trailer->interfaceIndex = static_cast<struct sockaddr_can *>(message->msg_name)->can_ifindex;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(message); cmsg; cmsg = CMSG_NXTHDR(message, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET)
+            continue;
+
+        switch (cmsg->cmsg_type) {
+        case SO_RXQ_OVFL: {
+            quint32 dropCount;
+            ::memcpy(&dropCount, CMSG_DATA(cmsg), sizeof(dropCount));
+            updateDroppedFrames(dropCount);
+            break;
+        }
+        case SCM_TIMESTAMP: {
+            struct timeval tv;
+            ::memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+            trailer->timestamp = qint64(tv.tv_sec) * 1000000000 + qint64(tv.tv_usec) * 1000;
+            trailer->timestampSource = CanFrame::SoftwareTimestamp;
+            receiveTime = trailer->timestamp;
+            break;
+        }
+        case SCM_TIMESTAMPNS: {
+            struct timespec ts;
+            ::memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            trailer->timestamp = nsecsFromTimespec(ts);
+            trailer->timestampSource = CanFrame::SoftwareTimestamp;
+            receiveTime = trailer->timestamp;
+            break;
+        }
+        case SCM_TIMESTAMPING: {
+            // ts[0] software, ts[1] hardware in system time (always 0 since
+            // Linux 3.17), ts[2] raw hardware
+            struct scm_timestamping tss;
+            ::memcpy(&tss, CMSG_DATA(cmsg), sizeof(tss));
+            if (nsecsFromTimespec(tss.ts[0]) != 0)
+                receiveTime = nsecsFromTimespec(tss.ts[0]);
+            if (timestamping == CanRawSocket::SoftwareTimestamping) {
+                trailer->timestamp = nsecsFromTimespec(tss.ts[0]);
+                trailer->timestampSource = CanFrame::SoftwareTimestamp;
+            }
+            else if (timestamping == CanRawSocket::HardwareTimestamping
+                     && nsecsFromTimespec(tss.ts[0]) != 0 && nsecsFromTimespec(tss.ts[2]) != 0) {
+                trailer->timestamp = hardwareToSystemTime(nsecsFromTimespec(tss.ts[0]),
+                                                          nsecsFromTimespec(tss.ts[2]));
+                trailer->timestampSource = CanFrame::HardwareTimestamp;
+            }
+            else if (nsecsFromTimespec(tss.ts[2]) != 0) {
+                trailer->timestamp = nsecsFromTimespec(tss.ts[2]);
+                trailer->timestampSource = CanFrame::RawHardwareTimestamp;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+
+/*
+    Converts the raw hardware receive time \a rawTime to system time. The
+    software receive time \a softwareTime lags behind it by the receive
+    latency, the smallest difference seen in the current and the previous
+    window is closest to the offset between the clocks. The windows let the
+    offset follow a drift of the device clock.
+*/
+qint64 CanRawSocketPrivate::hardwareToSystemTime(qint64 softwareTime, qint64 rawTime)
+{
+    const qint64 offset = softwareTime - rawTime;
+    const qint64 elapsed = softwareTime - hardwareClockWindowStart;
+
+    if (hardwareClockWindowStart == 0 || elapsed >= 2 * CAN_RAW_HARDWARE_CLOCK_WINDOW) {
+        previousHardwareClockOffset = offset;
+        hardwareClockOffset = offset;
+        hardwareClockWindowStart = softwareTime;
+    }
+    else if (elapsed >= CAN_RAW_HARDWARE_CLOCK_WINDOW) {
+        previousHardwareClockOffset = hardwareClockOffset;
+        hardwareClockOffset = offset;
+        hardwareClockWindowStart = softwareTime;
+    }
+    else if (offset < hardwareClockOffset) {
+        hardwareClockOffset = offset;
+    }
+
+    return rawTime + qMin(hardwareClockOffset, previousHardwareClockOffset);
+}
+
+/*
+    Tags the frame received at \a data, takes the drop counter from the control
+    messages of \a message and, if receive metadata is requested, appends the
+    trailer parsed from them.
+    Returns the size of the record in the read buffer, 0 for a frame removed by
+    the post filter of the optimized CAN filter or -1 for an invalid frame.
+*/
+int CanRawSocketPrivate::completeReceivedFrame(char *data, int length, size_t frameSize, struct msghdr *message)
+{
+    if (!tagReceivedFrame(data, length, frameSize))
+        return -1;
+
+    CanFrameTrailer trailer;
+    ::memset(&trailer, 0, sizeof(trailer));
+    receiveTime = 0;
+    if (message)
+        parseControlMessages(message, &trailer);
+
+    if (isPostFiltered(data)) {
+        postFilteredFrames.fetchAndAddRelaxed(1);
+        return 0;
+    }
+
+    if (!hasReceiveTrailer())
+        return length;
+
+    if (isXlFrameRecord(data))
+        data[CANXL_FLAGS_BYTE] |= CAN_XL_TRAILER_FLAG;
+    else
+        data[RES1_BYTE] |= CAN_RES1_TRAILER_FLAG;
+    ::memcpy(data + length, &trailer, sizeof(trailer));
+
+    return length + sizeof(trailer);
+}
+
+/*
+    Size of the record the next frame waiting in the socket becomes. The
+    kernel tells the length of the frame with MSG_TRUNC without taking it
+    off the queue. A post filtered frame is counted until it is read.
+*/
+qint64 CanRawSocketPrivate::pendingDirectReadSize() const
+{
+    if (!mergedFrames.isEmpty())
+        return receivedRecordSize(mergedFrames.constData());
+
+    char probe;
+    qint64 length = ::recv(descriptor, &probe, sizeof(probe), MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+    if (length <= 0 && transitionDescriptor != -1)
+        length = ::recv(transitionDescriptor, &probe, sizeof(probe), MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+    if (length <= 0)
+        return 0;
+
+    return length + (hasReceiveTrailer() ? sizeof(CanFrameTrailer) : 0);
+}
+
+qint64 CanRawSocketPrivate::readFromSocket(char *data, qint64 maxSize)
+{
+    const size_t frameSize = receiveFrameSize();
+
+    if (transitionDescriptor != -1 || !mergedFrames.isEmpty())
+        return readDuringFilterTransition(data, maxSize, frameSize);
+
+    if (batchedReceive == CanRawSocket::EnabledBatchedReceive && batchedReceiveSupported)
+        return readFrameBatchFromSocket(data, maxSize, frameSize);
+
+    return readFramesFromSocket(data, maxSize, frameSize);
+}
+
+qint64 CanRawSocketPrivate::readFramesFromSocket(char *data, qint64 maxSize, size_t frameSize)
+{
+    const bool trailer = hasReceiveTrailer();
+    const bool interfaceIndex = receiveInterfaceIndex == CanRawSocket::EnabledInterfaceIndex;
+    const qint64 recordSize = frameSize + (trailer ? sizeof(CanFrameTrailer) : 0);
+
+    union {
+        struct cmsghdr align;
+        char buffer[CAN_RAW_CONTROL_SIZE];
+    } control;
+    struct sockaddr_can address;
+    struct iovec vector;
+    struct msghdr message;
+
+    qint64 readBytes = 0;
+    int ret;
+
+    while (readBytes <= maxSize - recordSize) {
+
+        // the drop counter and receive metadata are only delivered as control messages
+        vector.iov_base = data;
+        vector.iov_len = frameSize;
+        ::memset(&message, 0, sizeof(message));
+        message.msg_iov = &vector;
+        message.msg_iovlen = 1;
+        message.msg_control = control.buffer;
+        message.msg_controllen = sizeof(control.buffer);
+        if (interfaceIndex) {
+            message.msg_name = &address;
+            message.msg_namelen = sizeof(address);
+        }
+        ret = ::recvmsg(descriptor, &message, 0);
+
+        if (ret < 0) {
+            if (errno == EAGAIN)
+                break;
+            return -1;
+        }
+
+        if (ret == 0)
+            break;
+
+        const int size = completeReceivedFrame(data, ret, frameSize, &message);
+        if (size < 0)
+            return -1; // ret is not valid
+
+        data += size;
+        readBytes += size;
+    }
+    return readBytes;
+}
+
+/*
+    Receives as many frames as fit into \a maxSize with a single recvmmsg() call.
+    Every frame gets its own slot of frame and trailer size, so classic frames
+    received in FD mode leave gaps which are closed before the next batch is requested.
+*/
+qint64 CanRawSocketPrivate::readFrameBatchFromSocket(char *data, qint64 maxSize, size_t frameSize)
+{
+    struct mmsghdr messages[CAN_RAW_MAX_BATCH_SIZE];
+    struct iovec vectors[CAN_RAW_MAX_BATCH_SIZE];
+    union {
+        struct cmsghdr align;
+        char buffer[CAN_RAW_CONTROL_SIZE];
+    } controls[CAN_RAW_MAX_BATCH_SIZE];
+    struct sockaddr_can addresses[CAN_RAW_MAX_BATCH_SIZE];
+
+    const bool trailer = hasReceiveTrailer();
+    const bool interfaceIndex = receiveInterfaceIndex == CanRawSocket::EnabledInterfaceIndex;
+    const qint64 slotSize = frameSize + (trailer ? sizeof(CanFrameTrailer) : 0);
+
+    qint64 readBytes = 0;
+
+    forever {
+        const int slotCount = qMin<qint64>((maxSize - readBytes) / slotSize, CAN_RAW_MAX_BATCH_SIZE);
+        if (slotCount <= 0)
+            break;
+
+        char *batch = data + readBytes;
+
+        ::memset(messages, 0, slotCount * sizeof(struct mmsghdr));
+        for (int i = 0; i < slotCount; ++i) {
+            vectors[i].iov_base = batch + i * slotSize;
+            vectors[i].iov_len = frameSize;
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+            messages[i].msg_hdr.msg_control = controls[i].buffer;
+            messages[i].msg_hdr.msg_controllen = sizeof(controls[i].buffer);
+            if (interfaceIndex) {
+                messages[i].msg_hdr.msg_name = &addresses[i];
+                messages[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+            }
+        }
+
+        const int ret = ::recvmmsg(descriptor, messages, slotCount, MSG_DONTWAIT, Q_NULLPTR);
+
+        if (ret < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == ENOSYS && readBytes == 0) {
+                // kernel without recvmmsg(), stay with one read() per frame
+                batchedReceiveSupported = false;
+                return readFramesFromSocket(data, maxSize, frameSize);
+            }
+            return -1;
+        }
+
+        char *frame = batch;
+        for (int i = 0; i < ret; ++i) {
+            const int length = messages[i].msg_len;
+            if (messages[i].msg_hdr.msg_flags & MSG_TRUNC)
+                return -1;
+            if (frame != vectors[i].iov_base)
+                ::memmove(frame, vectors[i].iov_base, length);
+            const int size = completeReceivedFrame(frame, length, frameSize, &messages[i].msg_hdr);
+            if (size < 0)
+                return -1;
+            frame += size;
+        }
+        readBytes += frame - batch;
+
+        // socket queue is drained
+        if (ret < slotCount)
+            break;
+    }
+    return readBytes;
+}
+
+/*
+    True if setting the CAN filter of the connected socket goes through a
+    lossless transition. The io_uring ring and the receive thread read the
+    descriptor on their own, their sockets change the filters immediately.
+*/
+bool CanRawSocketPrivate::canStartFilterTransition() const
+{
+    return filterTransition == CanRawSocket::LosslessFilterTransition
+            && descriptor != -1
+            && (readNotifier || reactorEntry)
+            && !ioUring
+            && !receiveThread;
+}
 
-    qint64 readBytes = 0;
-    int ret;
+/*
+    Binds a second socket with \a kernelFilter and the options of the socket,
+    then passes the filter to the socket itself. Frames received before the
+    second socket was bound are read from the socket with the old filters,
+    frames received until the filter of the socket is exchanged from the
+    second socket and every later frame from the socket again.
+*/
+bool CanRawSocketPrivate::startFilterTransition(const CanRawFilterArray &kernelFilter)
+{
+    const int fd = ::socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (fd == -1)
+        return false;
 
-    while (readBytes <= maxSize - (qint64)frameSize) {
+    const int errorMask = errorFilterMask;
+    const int loopbackFlag = loopback;
+    const int ownMessagesFlag = receiveOwnMessages;
+    const int dropCounter = 1;
+
+    bool ok = ::fcntl(fd, F_SETFL, O_NONBLOCK) != -1
+            && ::setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FILTER, kernelFilter.data(), kernelFilter.size()*sizeof(CanRawFilter)) != -1
+            && ::setsockopt(fd, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &errorMask, sizeof(int)) != -1
+            && ::setsockopt(fd, SOL_CAN_RAW, CAN_RAW_LOOPBACK, &loopbackFlag, sizeof(int)) != -1
+            && ::setsockopt(fd, SOL_CAN_RAW, CAN_RAW_RECV_OWN_MSGS, &ownMessagesFlag, sizeof(int)) != -1
+            && ::setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &dropCounter, sizeof(int)) != -1
+            && applyBpfFilter(fd, bpfFilter)
+            && applyTimestamping(fd, timestamping)
+            && applyBufferSize(fd, SO_RCVBUF, SO_RCVBUFFORCE, receiveBufferSize);
+#ifdef CANFD_MTU
+    if (ok && flexibleDataRateFrames == CanRawSocket::EnabledFdFrames) {
+        const int fdFrames = 1;
+        ok = ::setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &fdFrames, sizeof(int)) != -1;
+    }
+#endif
+#ifdef CANXL_MIN_MTU
+    if (ok && xlFrames == CanRawSocket::EnabledXlFrames) {
+        const int enabled = 1;
+        ok = ::setsockopt(fd, SOL_CAN_RAW, CAN_RAW_XL_FRAMES, &enabled, sizeof(int)) != -1;
+    }
+#endif
+    if (ok) {
+        struct sockaddr_can addr;
+        ::memset(&addr, 0, sizeof(addr));
+        addr.can_family = AF_CAN;
+        addr.can_ifindex = boundInterfaceIndex;
+        ok = ::bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != -1;
+    }
 
-        ret = ::read(descriptor, data, frameSize);
+    // frames timestamped from now on are delivered to the bound socket
+    const qint64 start = realtimeNsecs();
+
+    if (!ok || ::setsockopt(descriptor,
+                            SOL_CAN_RAW,
+                            CAN_RAW_FILTER,
+                            kernelFilter.data(),
+                            kernelFilter.size()*sizeof(CanRawFilter)) == -1) {
+        const int error = errno;
+        ::close(fd);
+        errno = error;
+        return false;
+    }
 
-        if (ret < 0) {
-            if (errno == EAGAIN)
-                break;
-            return -1;
+    transitionDescriptor = fd;
+    transitionStart = start;
+    transitionEnd = realtimeNsecs();
+    oldFramesDone = false;
+    newFramesDone = false;
+    transitionDropCount = 0;
+
+    scheduleTransitionRead();
+    return true;
+}
+
+void CanRawSocketPrivate::finishFilterTransition()
+{
+    if (transitionDescriptor == -1)
+        return;
+
+    ::close(transitionDescriptor);
+    transitionDescriptor = -1;
+}
+
+/*
+    Starts the transition to the filter set while the previous one was
+    running. Errors are reported like those of setCanFilter().
+*/
+void CanRawSocketPrivate::startPendingFilterTransition()
+{
+    if (!filterPending || transitionDescriptor != -1)
+        return;
+
+    filterPending = false;
+    if (canStartFilterTransition()) {
+        if (!startFilterTransition(pendingKernelFilter)) {
+            setError(getSystemError());
+            return;
+        }
+        oldFilterOptimizer = filterOptimizer;
+        oldPostFilter = postFilter;
+    }
+    else if (::setsockopt(descriptor,
+                          SOL_CAN_RAW,
+                          CAN_RAW_FILTER,
+                          pendingKernelFilter.data(),
+                          pendingKernelFilter.size()*sizeof(CanRawFilter)) == -1 ) {
+        setError(getSystemError());
+        return;
+    }
+
+    filterOptimizer = pendingFilterOptimizer;
+    postFilter = pendingPostFilter;
+}
+
+/*
+    Reads again after the grace period, in case none of the sockets receives
+    anything, until the frames of the transition are read. A full read
+    buffer doesn't hold the transition up, its frames are taken from the
+    sockets anyway. A filter set meanwhile starts when the transition is done.
+*/
+void CanRawSocketPrivate::scheduleTransitionRead()
+{
+    Q_Q(CanRawSocket);
+
+    QTimer::singleShot(CAN_RAW_TRANSITION_GRACE / 1000000 + 1, q, [this]() {
+        if (isReadNotificationEnabled()) {
+            readNotification();
+        } else if (transitionDescriptor != -1 && !drainFilterTransition(receiveFrameSize())) {
+            CanAbstractSocketErrorInfo error = getSystemError();
+            if (error.errorCode != CanAbstractSocket::SocketResourceError)
+                error.errorCode = CanAbstractSocket::ReadError;
+            setError(error);
+            return;
         }
 
-        if (ret == 0)
+        if (transitionDescriptor == -1 && filterPending) {
+            startPendingFilterTransition();
+            if (transitionDescriptor != -1)
+                return; // the new transition reads on its own
+        }
+        if (transitionDescriptor != -1 || !mergedFrames.isEmpty())
+            scheduleTransitionRead();
+    });
+}
+
+/*
+    Receives one frame from \a fd into \a data and sets receiveTime.
+    Returns the size of the record, 0 if there is no frame or -1 on error.
+*/
+int CanRawSocketPrivate::receiveTransitionFrame(int fd, char *data, size_t frameSize)
+{
+    union {
+        struct cmsghdr align;
+        char buffer[CAN_RAW_CONTROL_SIZE];
+    } control;
+    struct sockaddr_can address;
+    struct iovec vector;
+    struct msghdr message;
+
+    vector.iov_base = data;
+    vector.iov_len = frameSize;
+    ::memset(&message, 0, sizeof(message));
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+    if (receiveInterfaceIndex == CanRawSocket::EnabledInterfaceIndex) {
+        message.msg_name = &address;
+        message.msg_namelen = sizeof(address);
+    }
+
+    const int ret = ::recvmsg(fd, &message, 0);
+    if (ret < 0)
+        return errno == EAGAIN ? 0 : -1;
+    if (ret == 0)
+        return 0;
+
+    // the second socket has a drop counter of its own
+    const bool secondSocket = fd == transitionDescriptor;
+    if (secondSocket)
+        qSwap(kernelDropCount, transitionDropCount);
+    const int size = completeReceivedFrame(data, ret, frameSize, &message);
+    if (secondSocket)
+        qSwap(kernelDropCount, transitionDropCount);
+    return size;
+}
+
+// applies the post filter of the filters the frame passed in the kernel
+bool CanRawSocketPrivate::acceptTransitionFrame(const char *data, bool oldFilters)
+{
+    const bool rejected = oldFilters
+            ? isRejectedByPostFilter(oldFilterOptimizer, oldPostFilter, data)
+            : isRejectedByPostFilter(filterOptimizer, postFilter, data);
+    if (rejected)
+        postFilteredFrames.fetchAndAddRelaxed(1);
+    return !rejected;
+}
+
+/*
+    Merges the frames of a filter transition by their receive time: the
+    frames of the socket received before the transition started, the frames
+    of the second socket received while the filter of the socket was
+    exchanged and the frames of the socket received after that, which are
+    held back until the second socket is drained. Every frame waiting in the
+    sockets is taken, the merged frames wait in mergedFrames to be read.
+*/
+bool CanRawSocketPrivate::drainFilterTransition(size_t frameSize)
+{
+    const bool graceExpired = realtimeNsecs() - transitionEnd > CAN_RAW_TRANSITION_GRACE;
+    char record[CAN_RAW_MAX_RECORD_SIZE];
+    int size;
+
+    while (!oldFramesDone) {
+        size = receiveTransitionFrame(descriptor, record, frameSize);
+        if (size < 0)
+            return false;
+        if (size == 0) {
+            oldFramesDone = graceExpired;
             break;
+        }
 
-        /* we add aditional data (max dlen and mtu) to reserved pading bytes
-            (__res0 and __res1, see can.h) in order to distinct between the two frame types
-        */
-        if (ret == CAN_MTU) {
-            // received can frame in can or canfd mode
-            data[RES0_BYTE] = res0FromCanMtu(CAN_MTU);
-            data[RES1_BYTE] = res1FromCanMtu(CAN_MTU);
+        if (receiveTime >= transitionEnd) {
+            oldFramesDone = true;
+            if (acceptTransitionFrame(record, false))
+                heldFrames.append(record, size);
         }
-#ifdef CANFD_MTU
-        else if (ret == CANFD_MTU && static_cast<int>(frameSize) == ret) {
-            // received canfd frame in canfd mode
-            data[RES0_BYTE] = res0FromCanMtu(CANFD_MTU);
-            data[RES1_BYTE] = res1FromCanMtu(CANFD_MTU);
+        else if (receiveTime < transitionStart && acceptTransitionFrame(record, true)) {
+            mergedFrames.append(record, size);
         }
-#endif
-        else
-            return -1; // ret is not valid
+        // frames received in between are read from the second socket
+    }
 
-        data += ret;
-        readBytes += ret;
+    if (!oldFramesDone)
+        return true;
+
+    while ((size = receiveTransitionFrame(descriptor, record, frameSize)) > 0) {
+        if (acceptTransitionFrame(record, false))
+            heldFrames.append(record, size);
+    }
+    if (size < 0)
+        return false;
+
+    while (!newFramesDone) {
+        size = receiveTransitionFrame(transitionDescriptor, record, frameSize);
+        if (size < 0)
+            return false;
+        if (size == 0) {
+            newFramesDone = graceExpired;
+            break;
+        }
+
+        // the socket has the later frames with the new filters as well
+        if (receiveTime >= transitionEnd)
+            newFramesDone = true;
+        else if (receiveTime >= transitionStart && acceptTransitionFrame(record, false))
+            mergedFrames.append(record, size);
+    }
+
+    if (newFramesDone) {
+        finishFilterTransition();
+        mergedFrames.append(heldFrames);
+        heldFrames.clear();
+    }
+
+    return true;
+}
+
+// reads the merged frames of a filter transition, whole records only
+qint64 CanRawSocketPrivate::readDuringFilterTransition(char *data, qint64 maxSize, size_t frameSize)
+{
+    if (transitionDescriptor != -1 && !drainFilterTransition(frameSize))
+        return -1;
+
+    qint64 readBytes = 0;
+    while (readBytes < mergedFrames.size()) {
+        const qint64 recordSize = receivedRecordSize(mergedFrames.constData() + readBytes);
+        if (readBytes + recordSize > maxSize)
+            break;
+        readBytes += recordSize;
     }
+
+    ::memcpy(data, mergedFrames.constData(), readBytes);
+    mergedFrames.remove(0, readBytes);
     return readBytes;
 }
 
-qint64  CanRawSocketPrivate::writeToSocket(const char *data, qint64 maxSize)
+// returns the size of the frame tagged by the reserved bytes or 0 if it can't be written
+static inline size_t transmitFrameSize(const char *data,
+                                       CanRawSocket::FlexibleDataRateFrames fdFrames,
+                                       CanRawSocket::XlFrames xlFrames)
 {
-    size_t frameSize = CAN_MTU;
+    if (isXlFrameRecord(data)) {
+        //xl frame can only be written in xl mode, with the used payload only
+        const int dataLength = xlDataLengthFromRecord(data);
+        if (xlFrames != CanRawSocket::EnabledXlFrames
+                || dataLength < CANXL_MIN_DLEN
+                || dataLength > CANXL_MAX_DLEN
+                || (data[CANXL_FLAGS_BYTE] & CAN_XL_TRAILER_FLAG)) {
+            return 0;
+        }
+        return CANXL_HDR_SIZE + dataLength;
+    }
+
+    //get reserved bytes that define frame type (can or canfd)
+    const quint8 res0 = data[RES0_BYTE];
+    const quint8 res1 = data[RES1_BYTE];
+
+    if (res0 == res0FromCanMtu(CAN_MTU)
+            && res1 == res1FromCanMtu(CAN_MTU)) {
+        //standard can frame can be written in can and in canfd mode
+        return CAN_MTU;
+    }
 #ifdef CANFD_MTU
-    if (flexibleDataRateFrames == CanRawSocket::EnabledFdFrames)
-        frameSize = CANFD_MTU;
+    else if (res0 == res0FromCanMtu(CANFD_MTU)
+             && res1 == res1FromCanMtu(CANFD_MTU)
+             && (fdFrames == CanRawSocket::EnabledFdFrames
+                 || xlFrames == CanRawSocket::EnabledXlFrames)) {
+        //fd frame can only be written in fd mode, which xl mode includes
+        return CANFD_MTU;
+    }
+#else
+    Q_UNUSED(fdFrames);
 #endif
-    size_t bytesToWrite;
-    quint8 res0;
-    quint8 res1;
+    //data for reserved bytes is incorrect
+    return 0;
+}
+
+/*
+    A frame the kernel took only in part is not counted as written. The
+    frames sent before it are reported, like on any other write error, and
+    the error is reported on its own. Without such frames the caller reports
+    it as a WriteError.
+*/
+qint64 CanRawSocketPrivate::shortWriteResult(qint64 writtenBytes)
+{
+    if (writtenBytes == 0) {
+        errno = EIO;
+        return -1;
+    }
+
+    setError(CanAbstractSocketErrorInfo(CanAbstractSocket::WriteError, CanRawSocket::tr("Frame written in part")));
+    return writtenBytes;
+}
+
+qint64 CanRawSocketPrivate::writeToSocket(const char *data, qint64 maxSize)
+{
+    qint64 writtenBytes;
+    if (batchedTransmitSupported)
+        writtenBytes = writeFrameBatchToSocket(data, maxSize);
+    else
+        writtenBytes = writeFramesToSocket(data, maxSize);
+
+    if (writtenBytes == 0
+            && data == writeBuffer.readPointer()
+            && writeBuffer.size() > maxSize
+            && (maxSize < CAN_RAW_HEADER_SIZE
+                || maxSize < static_cast<qint64>(transmitFrameSize(data, flexibleDataRateFrames, xlFrames)))) {
+        // the first frame is split between two chunks of the write buffer
+        linearizeWriteBuffer();
+        return writeToSocket(writeBuffer.readPointer(), writeBuffer.nextDataBlockSize());
+    }
+
+    return writtenBytes;
+}
+
+/*
+    Sends every complete frame of the contiguous block with sendmmsg(), one
+    message per frame. Returns the number of bytes of frames accepted by the
+    kernel, so the caller can free exactly that much of the write buffer.
+*/
+qint64 CanRawSocketPrivate::writeFrameBatchToSocket(const char *data, qint64 maxSize)
+{
+    struct mmsghdr messages[CAN_RAW_MAX_BATCH_SIZE];
+    struct iovec vectors[CAN_RAW_MAX_BATCH_SIZE];
 
     qint64 writtenBytes = 0;
-    int ret;
 
     forever {
+        // collect every complete frame of the block, up to one batch
+        const char *batch = data + writtenBytes;
+        qint64 batchSize = 0;
+        int frameCount = 0;
+
+        while (frameCount < CAN_RAW_MAX_BATCH_SIZE) {
+            const qint64 leftSize = maxSize - writtenBytes - batchSize;
+            if (leftSize < CAN_RAW_HEADER_SIZE)
+                break;
+
+            const size_t frameSize = transmitFrameSize(batch + batchSize, flexibleDataRateFrames, xlFrames);
+            if (frameSize == 0) {
+                if (frameCount == 0 && writtenBytes == 0)
+                    return -1;
+                // send the valid frames first, the error is reported on the next call
+                break;
+            }
+            if (leftSize < static_cast<qint64>(frameSize))
+                break;
 
-        //get reserved bytes that define frame type (can or canfd)
-        res0 = data[RES0_BYTE];
-        res1 = data[RES1_BYTE];
+            vectors[frameCount].iov_base = const_cast<char *>(batch + batchSize);
+            vectors[frameCount].iov_len = frameSize;
+            batchSize += frameSize;
+            ++frameCount;
+        }
 
-        if (maxSize - writtenBytes < static_cast<qint64>(frameSize))  {
-            //leftof size smaller then frame size
+        if (frameCount == 0)
             break;
+
+        ::memset(messages, 0, frameCount * sizeof(struct mmsghdr));
+        for (int i = 0; i < frameCount; ++i) {
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
         }
 
-        if (res0 == res0FromCanMtu(CAN_MTU)
-                && res1 == res1FromCanMtu(CAN_MTU)) {
-            //standard can frame can be written in can and in canfd mode
-            bytesToWrite = CAN_MTU;
+        const int ret = ::sendmmsg(descriptor, messages, frameCount, MSG_DONTWAIT);
+
+        if (ret < 0) {
+            if (errno == ENOBUFS || errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == ENOSYS && writtenBytes == 0) {
+                // kernel without sendmmsg(), stay with one write() per frame
+                batchedTransmitSupported = false;
+                return writeFramesToSocket(data, maxSize);
+            }
+            // report the frames already sent, the error is reported on the next call
+            return writtenBytes > 0 ? writtenBytes : -1;
         }
-#ifdef CANFD_MTU
-        else if (res0 == res0FromCanMtu(CANFD_MTU)
-                 && res1 == res1FromCanMtu(CANFD_MTU)
-                 && flexibleDataRateFrames == CanRawSocket::EnabledFdFrames) {
-            //fd frame can only be written in fd mode
-            bytesToWrite = CANFD_MTU;
+
+        for (int i = 0; i < ret; ++i) {
+            if (messages[i].msg_len != vectors[i].iov_len)
+                return shortWriteResult(writtenBytes);
+            writtenBytes += messages[i].msg_len;
         }
-#endif
-        else {
-            //data for reserved bytes is incorrect
-            return -1;
+
+        // device queue is full
+        if (ret < frameCount)
+            break;
+    }
+    return writtenBytes;
+}
+
+qint64 CanRawSocketPrivate::writeFramesToSocket(const char *data, qint64 maxSize)
+{
+    size_t bytesToWrite;
+
+    qint64 writtenBytes = 0;
+    int ret;
+
+    forever {
+
+        if (maxSize - writtenBytes < CAN_RAW_HEADER_SIZE)  {
+            //leftof size smaller then frame size
+            break;
         }
 
+        bytesToWrite = transmitFrameSize(data, flexibleDataRateFrames, xlFrames);
+        if (bytesToWrite == 0)
+            return writtenBytes > 0 ? writtenBytes : -1;
+
+        if (maxSize - writtenBytes < static_cast<qint64>(bytesToWrite))
+            break;
+
         ret = ::write(descriptor, data, bytesToWrite);
 
         if (ret == 0) {
             break;
         }
         else if (ret < 0) {
-            if (errno == ENOBUFS)
+            if (errno == ENOBUFS || errno == EAGAIN)
                 break;
-            return -1;
+            return writtenBytes > 0 ? writtenBytes : -1;
         }
-        else if (ret != static_cast<int>(frameSize)) {
-            return -1;
+        else if (ret != static_cast<int>(bytesToWrite)) {
+            return shortWriteResult(writtenBytes);
         }
 
         data += ret;
@@ -562,4 +2352,322 @@ qint64  CanRawSocketPrivate::writeToSocket(const char *data, qint64 maxSize)
     return writtenBytes;
 }
 
+int CanRawSocketPrivate::receiveUnitSize() const
+{
+    // the source address and control messages of the receive metadata need recvmsg()
+    if (hasReceiveTrailer())
+        return 0;
+
+    // XL frames need their mode before connecting
+    if (xlFrames == CanRawSocket::EnabledXlFrames)
+        return CANXL_MTU;
+
+    // large enough for fd frames, which may be enabled after connecting
+#ifdef CANFD_MTU
+    return CANFD_MTU;
+#else
+    return CAN_MTU;
+#endif
+}
+
+int CanRawSocketPrivate::completeReceivedUnit(char *data, int length)
+{
+    if (!tagReceivedFrame(data, length, receiveFrameSize()))
+        return -1;
+
+    if (isPostFiltered(data)) {
+        postFilteredFrames.fetchAndAddRelaxed(1);
+        return -1;
+    }
+    return length;
+}
+
+qint64 CanRawSocketPrivate::transmitUnitSize(const char *data, qint64 maxSize) const
+{
+    if (maxSize < CAN_RAW_HEADER_SIZE)
+        return 0;
+
+    const size_t frameSize = transmitFrameSize(data, flexibleDataRateFrames, xlFrames);
+    if (frameSize == 0)
+        return -1;
+
+    return maxSize < static_cast<qint64>(frameSize) ? 0 : frameSize;
+}
+
+// counts the tagged frames in data returned by readFromSocket()
+qint64 CanRawSocketPrivate::receivedUnitCount(const char *data, qint64 size) const
+{
+    qint64 frames = 0;
+
+    while (size >= CAN_RAW_HEADER_SIZE) {
+        const qint64 recordSize = receivedRecordSize(data);
+        if (recordSize < CAN_RAW_HEADER_SIZE || recordSize > size)
+            break;
+
+        data += recordSize;
+        size -= recordSize;
+        ++frames;
+    }
+    return frames;
+}
+
+/*
+    Decodes the buffered records straight into the frames, a record split
+    between two chunks of the buffer is copied together first.
+*/
+qint64 CanRawSocketPrivate::readFrames(CanFrame *frames, qint64 maxCount)
+{
+    Q_Q(CanRawSocket);
+
+    if (!(q->openMode() & QIODevice::ReadOnly))
+        return -1;
+
+    char record[CAN_RAW_MAX_RECORD_SIZE];
+    qint64 count = 0;
+
+    while (count < maxCount && buffer.size() >= CAN_RAW_HEADER_SIZE) {
+        const char *data = buffer.readPointer();
+        qint64 size = buffer.nextDataBlockSize();
+
+        if (size < CAN_RAW_HEADER_SIZE || size < receivedRecordSize(data)) {
+            // the record is split between two chunks of the buffer, which
+            // only happens after reading a part of a record with read()
+            size = buffer.peek(record, sizeof(record));
+            data = record;
+        }
+
+        const qint64 recordSize = frames[count].d->fromRecord(data, size);
+        if (recordSize <= 0)
+            break;
+
+        buffer.free(recordSize);
+        ++count;
+    }
+
+    if (readBufferMaxSize && !isReadNotificationEnabled())
+        setReadNotificationEnabled(true);
+
+    if (count == 0 && state != CanAbstractSocket::ConnectedState)
+        return -1;
+
+    return count;
+}
+
+qint64 CanRawSocketPrivate::writeFrames(const CanFrame *frames, qint64 count)
+{
+    Q_Q(CanRawSocket);
+
+    if (!(q->openMode() & QIODevice::WriteOnly))
+        return -1;
+
+    if (transmitScheduling == CanRawSocket::PriorityTransmitScheduling) {
+        const qint64 queueTime = monotonicNsecs();
+        char record[CAN_RAW_MAX_RECORD_SIZE];
+        qint64 written = 0;
+
+        for (; written < count && frames[written].isValid(); ++written) {
+            frames[written].d->toRecord(record);
+            const size_t frameSize = transmitFrameSize(record, flexibleDataRateFrames, xlFrames);
+            if (frameSize == 0)
+                break;
+            transmitQueues.enqueue(record, frameSize, queueTime);
+        }
+
+        dispatchTransmitQueues();
+        return written > 0 ? written : -1;
+    }
+
+    // as with write(), the first frames of an event loop turn leave right away
+    const bool writeThrough = writeBuffer.isEmpty() && pendingBytesWritten == 0 && !ioUring;
+    qint64 written = 0;
+
+    while (written < count) {
+        const CanFrame &frame = frames[written];
+        if (!frame.isValid())
+            break;
+
+        const qint64 recordSize = frame.d->recordSize();
+        char *record = writeBuffer.reserve(recordSize);
+        frame.d->toRecord(record);
+
+        if (transmitFrameSize(record, flexibleDataRateFrames, xlFrames) == 0) {
+            writeBuffer.chop(recordSize);
+            break;
+        }
+        ++written;
+    }
+
+    if (writeThrough && written > 0)
+        startAsyncWrite();
+    else if (!writeBuffer.isEmpty() && !isWriteNotificationEnabled())
+        setWriteNotificationEnabled(true);
+
+    return written > 0 ? written : -1;
+}
+
+/*
+    Hands out the complete records of the first chunk of the read buffer.
+    A record split between two chunks is copied together and handed out
+    alone, the records after it are in the next span.
+*/
+qint64 CanRawSocketPrivate::peekFrames(CanFrameView *views, qint64 maxCount)
+{
+    Q_Q(CanRawSocket);
+
+    if (!(q->openMode() & QIODevice::ReadOnly))
+        return -1;
+
+    if (maxCount <= 0 || buffer.size() < CAN_RAW_HEADER_SIZE)
+        return state == CanAbstractSocket::ConnectedState ? 0 : -1;
+
+    const char *data = buffer.readPointer();
+    qint64 size = buffer.nextDataBlockSize();
+
+    if (size < CAN_RAW_HEADER_SIZE || size < receivedRecordSize(data)) {
+        // only happens after reading a part of a record with read()
+        if (splitRecord.size() < int(CAN_RAW_MAX_RECORD_SIZE))
+            splitRecord.resize(CAN_RAW_MAX_RECORD_SIZE);
+        size = buffer.peek(splitRecord.data(), splitRecord.size());
+        if (size < CAN_RAW_HEADER_SIZE || size < receivedRecordSize(splitRecord.constData()))
+            return 0;
+
+        views[0] = CanFrameView(splitRecord.constData());
+        return 1;
+    }
+
+    qint64 count = 0;
+
+    while (count < maxCount && size >= CAN_RAW_HEADER_SIZE) {
+        const qint64 recordSize = receivedRecordSize(data);
+        if (recordSize < CAN_RAW_HEADER_SIZE || size < recordSize)
+            break;
+
+        views[count++] = CanFrameView(data);
+        data += recordSize;
+        size -= recordSize;
+    }
+
+    return count;
+}
+
+qint64 CanRawSocketPrivate::consumeFrames(qint64 count)
+{
+    char header[CAN_RAW_HEADER_SIZE];
+    qint64 consumed = 0;
+
+    while (consumed < count && buffer.size() >= CAN_RAW_HEADER_SIZE) {
+        const char *data = buffer.readPointer();
+        if (buffer.nextDataBlockSize() < CAN_RAW_HEADER_SIZE) {
+            buffer.peek(header, sizeof(header));
+            data = header;
+        }
+
+        const qint64 recordSize = receivedRecordSize(data);
+        if (recordSize < CAN_RAW_HEADER_SIZE || buffer.size() < recordSize)
+            break;
+
+        buffer.free(recordSize);
+        ++consumed;
+    }
+
+    if (readBufferMaxSize && !isReadNotificationEnabled())
+        setReadNotificationEnabled(true);
+
+    return consumed;
+}
+
+/*
+    Queues the written frames by their priority class in priority scheduling.
+    A frame written in several pieces is queued once it is complete. The
+    frames before an invalid frame are taken and their size returned, as
+    with a short write of a socket, a write starting with it fails.
+*/
+qint64 CanRawSocketPrivate::writeData(const char *data, qint64 maxSize)
+{
+    if (transmitScheduling != CanRawSocket::PriorityTransmitScheduling)
+        return CanAbstractSocketPrivate::writeData(data, maxSize);
+
+    const qint64 queueTime = monotonicNsecs();
+
+    QByteArray pending;
+    qint64 size = maxSize;
+    qint64 carriedSize = 0;
+    if (!partialTransmitRecord.isEmpty()) {
+        pending.swap(partialTransmitRecord);
+        carriedSize = pending.size();
+        pending.append(data, maxSize);
+        data = pending.constData();
+        size = pending.size();
+    }
+    const char *begin = data;
+
+    while (size >= CAN_RAW_HEADER_SIZE) {
+        const size_t frameSize = transmitFrameSize(data, flexibleDataRateFrames, xlFrames);
+        if (frameSize == 0) {
+            // the bytes of the caller before the invalid frame, if it began in
+            // the carried piece that piece is dropped with it
+            const qint64 takenSize = (data - begin) - carriedSize;
+            dispatchTransmitQueues();
+            if (takenSize > 0)
+                return takenSize;
+            setError(CanAbstractSocketErrorInfo(CanAbstractSocket::WriteError));
+            return -1;
+        }
+        if (size < static_cast<qint64>(frameSize))
+            break;
+
+        transmitQueues.enqueue(data, frameSize, queueTime);
+        data += frameSize;
+        size -= frameSize;
+    }
+
+    if (size > 0)
+        partialTransmitRecord = QByteArray(data, size);
+
+    dispatchTransmitQueues();
+    return maxSize;
+}
+
+/*
+    Moves up to \a maxFrames frames, all of them if it is negative, from the
+    transmit queues to the write buffer, the most urgent class first.
+*/
+void CanRawSocketPrivate::moveTransmitQueues(int maxFrames)
+{
+    if (!transmitQueues.isEmpty())
+        transmitQueues.dequeue(&writeBuffer, maxFrames, monotonicNsecs());
+}
+
+// the next batch is chosen when the socket takes it, urgent frames queued meanwhile go first
+void CanRawSocketPrivate::refillWriteBuffer()
+{
+    if (transmitScheduling == CanRawSocket::PriorityTransmitScheduling)
+        moveTransmitQueues(CAN_RAW_SCHEDULED_BATCH_SIZE);
+}
+
+/*
+    Starts sending the queued frames. As with the write-through of
+    CanAbstractSocketPrivate::writeData(), the first batch of an event loop
+    turn leaves right away, the others follow the write notification.
+*/
+void CanRawSocketPrivate::dispatchTransmitQueues()
+{
+    if (writeBuffer.isEmpty() && pendingBytesWritten == 0) {
+        refillWriteBuffer();
+        if (!ioUring && !writeBuffer.isEmpty()) {
+            startAsyncWrite();
+            return;
+        }
+    }
+
+    if ((!writeBuffer.isEmpty() || pendingBytesWritten > 0) && !isWriteNotificationEnabled())
+        setWriteNotificationEnabled(true);
+}
+
+void CanRawSocketPrivate::clearTransmitQueues()
+{
+    transmitQueues.clear();
+    partialTransmitRecord.clear();
+}
+
 #include "moc_canrawsocket.cpp"
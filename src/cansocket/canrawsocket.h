@@ -19,6 +19,9 @@
 #ifndef CANRAWSOCKET_H
 #define CANRAWSOCKET_H
 
+#include <QtCore/qbytearray.h>
+#include <QtCore/qvector.h>
+
 #include <CanSocket/cansocketglobal.h>
 #include <CanSocket/canabstractsocket.h>
 #include <CanSocket/canframe.h>
@@ -103,6 +106,119 @@ Q_DECLARE_SHARED(CanRawFilterArray)
 
 Q_DECLARE_METATYPE(CanRawFilterArray)
 
+class CanRawBpfFilterData;
+
+class CANSOCKET_EXPORT CanRawDataPredicate
+{
+public:
+    enum Comparison {
+        Equal,
+        NotEqual
+    };
+
+    CanRawDataPredicate(int offset = 0, quint8 value = 0, quint8 mask = 0xff,
+                        Comparison comparison = Equal);
+
+    inline int offset() const { return byteOffset; }
+    inline quint8 value() const { return byteValue; }
+    inline quint8 mask() const { return byteMask; }
+    inline Comparison comparison() const { return byteComparison; }
+
+    bool matches(const char *data, int dataLength) const;
+
+    inline bool operator ==(const CanRawDataPredicate &rhs) const {
+        return byteOffset == rhs.byteOffset && byteValue == rhs.byteValue
+                && byteMask == rhs.byteMask && byteComparison == rhs.byteComparison;
+    }
+    inline bool operator !=(const CanRawDataPredicate &rhs) const { return !operator==(rhs); }
+
+private:
+    int byteOffset;
+    quint8 byteValue;
+    quint8 byteMask;
+    Comparison byteComparison;
+};
+
+class CANSOCKET_EXPORT CanRawBpfFilter
+{
+public:
+    CanRawBpfFilter();
+    explicit CanRawBpfFilter(const CanRawFilterArray &filters);
+    CanRawBpfFilter(const CanRawBpfFilter &rhs);
+    ~CanRawBpfFilter();
+
+    void swap(CanRawBpfFilter &);
+
+    bool isEmpty() const;
+    int ruleCount() const;
+
+    void addRule(const CanRawFilter &filter,
+                 const QVector<CanRawDataPredicate> &predicates = QVector<CanRawDataPredicate>());
+    void clear();
+
+    bool matches(const char *frame, int size) const;
+
+    QByteArray program() const;
+
+    bool operator ==(const CanRawBpfFilter &rhs) const;
+    inline bool operator !=(const CanRawBpfFilter &rhs) const { return !operator==(rhs); }
+
+private:
+    QSharedDataPointer<CanRawBpfFilterData> d;
+};
+Q_DECLARE_SHARED(CanRawBpfFilter)
+
+Q_DECLARE_METATYPE(CanRawBpfFilter)
+
+class CanRawFilterOptimizerData;
+
+class CANSOCKET_EXPORT CanRawFilterOptimizer
+{
+public:
+    explicit CanRawFilterOptimizer(qreal maxOverAcceptance = 0);
+    CanRawFilterOptimizer(const CanRawFilterOptimizer &rhs);
+    ~CanRawFilterOptimizer();
+
+    CanRawFilterOptimizer &operator =(const CanRawFilterOptimizer &rhs);
+
+    void setMaxOverAcceptance(qreal ratio);
+    qreal maxOverAcceptance() const;
+
+    CanRawFilterArray optimize(const CanRawFilterArray &filters);
+
+    int originalFilterCount() const;
+    int filterCount() const;
+    qreal falsePositiveRate() const;
+
+    bool needsPostFilter() const;
+    bool accepts(uint canId) const;
+
+private:
+    QSharedDataPointer<CanRawFilterOptimizerData> d;
+};
+
+struct CanRawTransmitStatistics
+{
+    quint64 frames;
+    qint64 queuedFrames;
+    qint64 totalDelay;
+    qint64 maxDelay;
+};
+
+struct CanRawTransmitClass
+{
+    CanRawFilter filter;
+    int priorityClass;
+
+    inline bool operator ==(const CanRawTransmitClass &rhs) const {
+        return filter == rhs.filter && priorityClass == rhs.priorityClass;
+    }
+    inline bool operator !=(const CanRawTransmitClass &rhs) const { return !operator==(rhs); }
+};
+
+typedef QVector<CanRawTransmitClass> CanRawTransmitClassArray;
+Q_DECLARE_METATYPE(CanRawTransmitClassArray)
+
 class CANSOCKET_EXPORT CanRawSocket : public CanAbstractSocket
 {
     Q_OBJECT
@@ -112,6 +228,19 @@ class CANSOCKET_EXPORT CanRawSocket : public CanAbstractSocket
     Q_PROPERTY(Loopback loopback READ loopback WRITE setLoopback NOTIFY loopbackChanged)
     Q_PROPERTY(ReceiveOwnMessages receiveOwnMessages READ receiveOwnMessages WRITE setReceiveOwnMessages NOTIFY receiveOwnMessagesChanged)
     Q_PROPERTY(FlexibleDataRateFrames flexibleDataRateFrames READ flexibleDataRateFrames WRITE setFlexibleDataRateFrames NOTIFY flexibleDataRateFramesChanged)
+    Q_PROPERTY(XlFrames xlFrames READ xlFrames WRITE setXlFrames NOTIFY xlFramesChanged)
+    Q_PROPERTY(BatchedReceive batchedReceive READ batchedReceive WRITE setBatchedReceive NOTIFY batchedReceiveChanged)
+    Q_PROPERTY(Timestamping timestamping READ timestamping WRITE setTimestamping NOTIFY timestampingChanged)
+    Q_PROPERTY(int busyPoll READ busyPoll WRITE setBusyPoll NOTIFY busyPollChanged)
+    Q_PROPERTY(int busyPollCpu READ busyPollCpu WRITE setBusyPollCpu NOTIFY busyPollCpuChanged)
+    Q_PROPERTY(int receiveBufferSize READ receiveBufferSize WRITE setReceiveBufferSize NOTIFY receiveBufferSizeChanged)
+    Q_PROPERTY(int sendBufferSize READ sendBufferSize WRITE setSendBufferSize NOTIFY sendBufferSizeChanged)
+    Q_PROPERTY(qreal filterOptimization READ filterOptimization WRITE setFilterOptimization NOTIFY filterOptimizationChanged)
+    Q_PROPERTY(CanRawBpfFilter bpfFilter READ bpfFilter WRITE setBpfFilter NOTIFY bpfFilterChanged)
+    Q_PROPERTY(ReceiveInterfaceIndex receiveInterfaceIndex READ receiveInterfaceIndex WRITE setReceiveInterfaceIndex NOTIFY receiveInterfaceIndexChanged)
+    Q_PROPERTY(FilterTransition filterTransition READ filterTransition WRITE setFilterTransition NOTIFY filterTransitionChanged)
+    Q_PROPERTY(TransmitScheduling transmitScheduling READ transmitScheduling WRITE setTransmitScheduling NOTIFY transmitSchedulingChanged)
+    Q_PROPERTY(CanRawTransmitClassArray transmitPriorityClasses READ transmitPriorityClasses WRITE setTransmitPriorityClasses NOTIFY transmitPriorityClassesChanged)
 
 public:
     enum CanRawSocketOption {
@@ -119,7 +248,20 @@ public:
         ErrorFilterMaskOption,
         LoopbackOption,
         ReceiveOwnMessagesOption,
-        FlexibleDataRateFramesOption
+        FlexibleDataRateFramesOption,
+        BatchedReceiveOption,
+        TimestampingOption,
+        BusyPollOption,
+        BusyPollCpuOption,
+        ReceiveBufferSizeOption,
+        SendBufferSizeOption,
+        ReceiveInterfaceIndexOption,
+        BpfFilterOption,
+        FilterOptimizationOption,
+        FilterTransitionOption,
+        XlFramesOption,
+        TransmitSchedulingOption,
+        TransmitPriorityClassesOption
     };
     Q_ENUM(CanRawSocketOption)
 
@@ -147,6 +289,62 @@ public:
     };
     Q_ENUM(FlexibleDataRateFrames)
 
+    enum XlFrames {
+        DisabledXlFrames = 0,
+        EnabledXlFrames = 1,
+
+        UndefinedXlFrames = -1
+    };
+    Q_ENUM(XlFrames)
+
+    enum BatchedReceive {
+        DisabledBatchedReceive = 0,
+        EnabledBatchedReceive = 1,
+
+        UndefinedBatchedReceive = -1
+    };
+    Q_ENUM(BatchedReceive)
+
+    enum Timestamping {
+        DisabledTimestamping = 0,
+        MicrosecondTimestamping = 1,
+        NanosecondTimestamping = 2,
+        SoftwareTimestamping = 3,
+        HardwareTimestamping = 4,
+        RawHardwareTimestamping = 5,
+
+        UndefinedTimestamping = -1
+    };
+    Q_ENUM(Timestamping)
+
+    enum ReceiveInterfaceIndex {
+        DisabledInterfaceIndex = 0,
+        EnabledInterfaceIndex = 1,
+
+        UndefinedInterfaceIndex = -1
+    };
+    Q_ENUM(ReceiveInterfaceIndex)
+
+    enum FilterTransition {
+        ImmediateFilterTransition = 0,
+        LosslessFilterTransition = 1,
+
+        UndefinedFilterTransition = -1
+    };
+    Q_ENUM(FilterTransition)
+
+    enum TransmitScheduling {
+        FifoTransmitScheduling = 0,
+        PriorityTransmitScheduling = 1,
+
+        UndefinedTransmitScheduling = -1
+    };
+    Q_ENUM(TransmitScheduling)
+
+    enum {
+        TransmitPriorityClasses = 8
+    };
+
     explicit CanRawSocket(QObject *parent = Q_NULLPTR);
     virtual ~CanRawSocket();
 
@@ -168,12 +366,82 @@ public:
     void setFlexibleDataRateFrames(FlexibleDataRateFrames fdFrames);
     FlexibleDataRateFrames flexibleDataRateFrames();
 
+    void setXlFrames(XlFrames xlFrames);
+    XlFrames xlFrames();
+
+    void setBatchedReceive(BatchedReceive batchedReceive);
+    BatchedReceive batchedReceive();
+
+    void setTimestamping(Timestamping timestamping);
+    Timestamping timestamping();
+
+    void setBusyPoll(int usecs);
+    int busyPoll();
+
+    void setBusyPollCpu(int cpu);
+    int busyPollCpu();
+
+    void setReceiveBufferSize(int bytes);
+    int receiveBufferSize();
+
+    void setSendBufferSize(int bytes);
+    int sendBufferSize();
+
+    void setFilterOptimization(qreal maxOverAcceptance);
+    qreal filterOptimization();
+
+    int kernelFilterCount();
+    qreal filterFalsePositiveRate();
+    quint64 postFilteredFrames();
+
+    void setBpfFilter(const CanRawBpfFilter &filter);
+    CanRawBpfFilter bpfFilter();
+
+    void setReceiveInterfaceIndex(ReceiveInterfaceIndex interfaceIndex);
+    ReceiveInterfaceIndex receiveInterfaceIndex();
+
+    void setFilterTransition(FilterTransition transition);
+    FilterTransition filterTransition();
+
+    quint64 droppedFrames();
+
+    void setTransmitScheduling(TransmitScheduling scheduling);
+    TransmitScheduling transmitScheduling();
+
+    void setTransmitPriorityClasses(const CanRawTransmitClassArray &classes);
+    CanRawTransmitClassArray transmitPriorityClasses();
+    void setTransmitPriorityClass(const CanRawFilter &filter, int priorityClass);
+    void clearTransmitPriorityClasses();
+
+    CanRawTransmitStatistics transmitStatistics(int priorityClass);
+    void resetTransmitStatistics();
+
+    qint64 readFrames(CanFrame *frames, qint64 maxCount);
+    qint64 writeFrames(const CanFrame *frames, qint64 count);
+
+    qint64 peekFrames(CanFrameView *views, qint64 maxCount);
+    qint64 consumeFrames(qint64 count);
+
 Q_SIGNALS:
     void canFilterChanged();
     void errorFilterMaskChanged();
     void loopbackChanged();
     void receiveOwnMessagesChanged();
     void flexibleDataRateFramesChanged();
+    void xlFramesChanged();
+    void batchedReceiveChanged();
+    void timestampingChanged();
+    void busyPollChanged();
+    void busyPollCpuChanged();
+    void receiveBufferSizeChanged();
+    void sendBufferSizeChanged();
+    void receiveInterfaceIndexChanged();
+    void bpfFilterChanged();
+    void filterOptimizationChanged();
+    void filterTransitionChanged();
+    void transmitSchedulingChanged();
+    void transmitPriorityClassesChanged();
+    void framesDropped(quint64 frames);
 
 private:
     Q_DISABLE_COPY(CanRawSocket)
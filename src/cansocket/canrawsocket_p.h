@@ -21,6 +21,12 @@
 
 #include <CanSocket/canrawsocket.h>
 #include <private/canabstractsocket_p.h>
+#include <private/canrawtransmitqueues_p.h>
+
+#include <QtCore/qatomic.h>
+
+struct msghdr;
+struct CanFrameTrailer;
 
 class CanRawSocketPrivate : CanAbstractSocketPrivate
 {
@@ -31,18 +37,137 @@ public:
     virtual ~CanRawSocketPrivate();
 
     bool connectToInterface(const QString &interfaceName) Q_DECL_OVERRIDE;
+    void disconnectFromInterface() Q_DECL_OVERRIDE;
 
     bool setSocketOption(CanRawSocket::CanRawSocketOption option, const QVariant &value);
+    bool applySocketOption(CanRawSocket::CanRawSocketOption option, const QVariant &value);
     QVariant socketOption(CanRawSocket::CanRawSocketOption option);
 
     qint64 readFromSocket(char *data, qint64 maxSize) Q_DECL_OVERRIDE;
     qint64 writeToSocket(const char *data, qint64 maxSize) Q_DECL_OVERRIDE;
 
+    bool canReadDirectly() const Q_DECL_OVERRIDE { return true; }
+    qint64 pendingDirectReadSize() const Q_DECL_OVERRIDE;
+    int receiveUnitSize() const Q_DECL_OVERRIDE;
+    int completeReceivedUnit(char *data, int length) Q_DECL_OVERRIDE;
+    qint64 transmitUnitSize(const char *data, qint64 maxSize) const Q_DECL_OVERRIDE;
+    qint64 receivedUnitCount(const char *data, qint64 size) const Q_DECL_OVERRIDE;
+    int busyPollTime() const Q_DECL_OVERRIDE { return busyPoll; }
+    int receiveThreadCpu() const Q_DECL_OVERRIDE { return busyPollCpu; }
+    void checkReceiveStatistics() Q_DECL_OVERRIDE;
+
+    inline bool hasReceiveTrailer() const
+    {
+        return timestamping != CanRawSocket::DisabledTimestamping
+                || receiveInterfaceIndex == CanRawSocket::EnabledInterfaceIndex;
+    }
+    int deviceMtu() const;
+    size_t receiveFrameSize() const;
+    int completeReceivedFrame(char *data, int length, size_t frameSize, struct msghdr *message);
+    void parseControlMessages(struct msghdr *message, CanFrameTrailer *trailer);
+    qint64 hardwareToSystemTime(qint64 softwareTime, qint64 rawTime);
+    void updateDroppedFrames(quint32 dropCount);
+    bool applyBufferSize(int fd, int option, int forceOption, int size);
+    bool applyBpfFilter(int fd, const CanRawBpfFilter &filter);
+    bool applyCanFilter(const CanRawFilterArray &filter);
+    inline bool isPostFiltered(const char *data) const;
+    bool applyTimestamping(int fd, CanRawSocket::Timestamping newTimestamping);
+
+    bool canStartFilterTransition() const;
+    bool startFilterTransition(const CanRawFilterArray &kernelFilter);
+    void finishFilterTransition();
+    void startPendingFilterTransition();
+    void scheduleTransitionRead();
+    int receiveTransitionFrame(int fd, char *data, size_t frameSize);
+    bool acceptTransitionFrame(const char *data, bool oldFilters);
+    bool drainFilterTransition(size_t frameSize);
+    qint64 readDuringFilterTransition(char *data, qint64 maxSize, size_t frameSize);
+
+    qint64 readFramesFromSocket(char *data, qint64 maxSize, size_t frameSize);
+    qint64 readFrameBatchFromSocket(char *data, qint64 maxSize, size_t frameSize);
+    qint64 writeFrameBatchToSocket(const char *data, qint64 maxSize);
+    qint64 writeFramesToSocket(const char *data, qint64 maxSize);
+    qint64 shortWriteResult(qint64 writtenBytes);
+
+    qint64 readFrames(CanFrame *frames, qint64 maxCount);
+    qint64 writeFrames(const CanFrame *frames, qint64 count);
+    qint64 peekFrames(CanFrameView *views, qint64 maxCount);
+    qint64 consumeFrames(qint64 count);
+
+    qint64 writeData(const char *data, qint64 maxSize) Q_DECL_OVERRIDE;
+    void refillWriteBuffer() Q_DECL_OVERRIDE;
+    qint64 queuedTransmitSize() const Q_DECL_OVERRIDE { return transmitQueues.size(); }
+    void moveTransmitQueues(int maxFrames);
+    void dispatchTransmitQueues();
+    void clearTransmitQueues();
+
    CanRawFilterArray canFilter;
+   CanRawBpfFilter bpfFilter;
+   qreal filterOptimization;
+   CanRawFilterOptimizer filterOptimizer;
+   bool postFilter;
+   QAtomicInteger<quint64> postFilteredFrames;
    CanFrame::CanFrameErrors errorFilterMask;
    CanRawSocket::Loopback loopback;
    CanRawSocket::ReceiveOwnMessages receiveOwnMessages;
    CanRawSocket::FlexibleDataRateFrames flexibleDataRateFrames;
+   CanRawSocket::XlFrames xlFrames;
+   CanRawSocket::BatchedReceive batchedReceive;
+   CanRawSocket::Timestamping timestamping;
+   CanRawSocket::ReceiveInterfaceIndex receiveInterfaceIndex;
+   CanRawSocket::FilterTransition filterTransition;
+   CanRawSocket::TransmitScheduling transmitScheduling;
+   int boundInterfaceIndex;
+
+   // state of a lossless filter transition, the second socket carries the
+   // frames of the new filters received between the two receive times.
+   // The frames are taken from both sockets as they arrive, in order in
+   // mergedFrames and the later frames of the socket in heldFrames, so a
+   // full read buffer can't hold the transition up.
+   int transitionDescriptor;
+   qint64 transitionStart;
+   qint64 transitionEnd;
+   bool oldFramesDone;
+   bool newFramesDone;
+   CanRawFilterOptimizer oldFilterOptimizer;
+   bool oldPostFilter;
+   quint32 transitionDropCount;
+   QByteArray mergedFrames;
+   QByteArray heldFrames;
+
+   // filter set during a transition, it starts the next one when it is done
+   bool filterPending;
+   CanRawFilterArray pendingKernelFilter;
+   CanRawFilterOptimizer pendingFilterOptimizer;
+   bool pendingPostFilter;
+
+   // copy of a record split between two chunks of the read buffer, handed
+   // out by peekFrames() as the buffer can't show it in one piece
+   QByteArray splitRecord;
+
+   // frames waiting for the socket in priority scheduling
+   CanRawTransmitQueues transmitQueues;
+   QByteArray partialTransmitRecord;
+
+   // software receive time of the last parsed frame, 0 without timestamp
+   qint64 receiveTime;
+   // cleared by the reading thread, batchedReceive only changes on the owner thread
+   bool batchedReceiveSupported;
+   bool batchedTransmitSupported;
+   int busyPoll;
+   int busyPollCpu;
+   int receiveBufferSize;
+   int sendBufferSize;
+
+   // kernel drop counter of the last received frame, only used by the reading thread
+   quint32 kernelDropCount;
+   // smallest offset of the system clock to the device clock in the current
+   // and the previous window, only used by the reading thread
+   qint64 hardwareClockWindowStart;
+   qint64 hardwareClockOffset;
+   qint64 previousHardwareClockOffset;
+   QAtomicInteger<quint64> droppedFrames;
+   quint64 reportedDroppedFrames;
 };
 
 #endif // CANRAWSOCKET_P_H
@@ -0,0 +1,136 @@
+/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#ifndef CANRAWTRANSMITQUEUES_P_H
+#define CANRAWTRANSMITQUEUES_P_H
+
+#include <CanSocket/canrawsocket.h>
+#include <private/canframe_p.h>
+#include <private/qringbuffer_p.h>
+
+#include <linux/can.h>
+#include <string.h>
+
+// Queues of the priority transmit scheduling of CanRawSocket, one per class.
+// A frame is queued as an entry of the time it was queued, its size and its
+// record, reserved in one piece so it never spans two chunks of the queue.
+class CanRawTransmitQueues
+{
+public:
+    struct Entry
+    {
+        qint64 queueTime;
+        qint64 size;
+    };
+
+    CanRawTransmitQueues()
+        : queuedBytes(0)
+    {
+        ::memset(statistics, 0, sizeof(statistics));
+    }
+
+    inline qint64 size() const { return queuedBytes; }
+    inline bool isEmpty() const { return queuedBytes == 0; }
+
+    // the first matching class filter decides, frames matching none are
+    // classed by the three most significant bits of their 11 bit base id
+    inline int classOf(const char *record) const
+    {
+        quint32 id;
+        ::memcpy(&id, record, sizeof(id));
+
+        for (int i = 0; i < classes.size(); ++i) {
+            const CanRawFilter &filter = classes.at(i).filter;
+            if ((id & filter.filterMask()) == (filter.filterId() & filter.filterMask()))
+                return classes.at(i).priorityClass;
+        }
+
+        // the base id of extended frames is the first part of their id on the
+        // bus, the priority of XL frames sits where the standard id does
+        uint baseId = id & CAN_SFF_MASK;
+        if (!isXlFrameRecord(record) && (id & CAN_EFF_FLAG))
+            baseId = (id & CAN_EFF_MASK) >> 18;
+
+        return baseId >> 8;
+    }
+
+    inline void enqueue(const char *record, qint64 size, qint64 queueTime)
+    {
+        const int priorityClass = classOf(record);
+
+        Entry entry;
+        entry.queueTime = queueTime;
+        entry.size = size;
+
+        char *queued = queues[priorityClass].reserve(sizeof(entry) + size);
+        ::memcpy(queued, &entry, sizeof(entry));
+        ::memcpy(queued + sizeof(entry), record, size);
+
+        queuedBytes += size;
+        ++statistics[priorityClass].queuedFrames;
+    }
+
+    // moves up to maxFrames frames, all of them if it is negative, to buffer,
+    // the most urgent class first, and returns the number of frames moved
+    inline int dequeue(QRingBuffer *buffer, int maxFrames, qint64 now)
+    {
+        int frames = 0;
+
+        for (int i = 0; i < CanRawSocket::TransmitPriorityClasses && queuedBytes > 0; ++i) {
+            QRingBuffer &queue = queues[i];
+            CanRawTransmitStatistics &classStatistics = statistics[i];
+
+            while (!queue.isEmpty() && (maxFrames < 0 || frames < maxFrames)) {
+                const char *queued = queue.readPointer();
+                Entry entry;
+                ::memcpy(&entry, queued, sizeof(entry));
+
+                ::memcpy(buffer->reserve(entry.size), queued + sizeof(entry), entry.size);
+                queue.free(sizeof(entry) + entry.size);
+                queuedBytes -= entry.size;
+
+                const qint64 delay = now - entry.queueTime;
+                ++classStatistics.frames;
+                --classStatistics.queuedFrames;
+                classStatistics.totalDelay += delay;
+                classStatistics.maxDelay = qMax(classStatistics.maxDelay, delay);
+                ++frames;
+            }
+        }
+
+        return frames;
+    }
+
+    inline void clear()
+    {
+        for (int i = 0; i < CanRawSocket::TransmitPriorityClasses; ++i) {
+            queues[i].clear();
+            statistics[i].queuedFrames = 0;
+        }
+        queuedBytes = 0;
+    }
+
+    CanRawTransmitClassArray classes;
+    CanRawTransmitStatistics statistics[CanRawSocket::TransmitPriorityClasses];
+
+private:
+    QRingBuffer queues[CanRawSocket::TransmitPriorityClasses];
+    qint64 queuedBytes;
+};
+
+#endif // CANRAWTRANSMITQUEUES_P_H
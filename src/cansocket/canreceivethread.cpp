@@ -0,0 +1,303 @@
+﻿/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "canreceivethread_p.h"
+#include "canabstractsocket_p.h"
+
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+
+static inline qint64 monotonicNsecs()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+CanReceiveQueue::CanReceiveQueue(int slotCount, int slotSize)
+    : storage(slotCount * slotSize)
+    , lengths(slotCount)
+    , size(slotSize)
+    , mask(slotCount - 1)
+    , head(0)
+    , tail(0)
+{
+    Q_ASSERT((slotCount & (slotCount - 1)) == 0);
+}
+
+char *CanReceiveQueue::reserveSlot()
+{
+    const quint32 index = tail.loadAcquire();
+    if (index - head.loadAcquire() > mask)
+        return Q_NULLPTR; // full
+
+    return storage.data() + (index & mask) * size;
+}
+
+void CanReceiveQueue::publishSlot(qint64 bytes)
+{
+    const quint32 index = tail.load();
+    lengths[index & mask] = bytes;
+    tail.storeRelease(index + 1);
+}
+
+const char *CanReceiveQueue::peekSlot(qint64 *bytes) const
+{
+    const quint32 index = head.load();
+    if (index == tail.loadAcquire())
+        return Q_NULLPTR; // empty
+
+    *bytes = lengths.at(index & mask);
+    return storage.constData() + (index & mask) * size;
+}
+
+void CanReceiveQueue::releaseSlot()
+{
+    head.storeRelease(head.load() + 1);
+}
+
+/*
+    Reads the socket of \a socket on its own thread into a queue of
+    \a slotCount slots of \a slotSize bytes. Only readFromSocket() and
+    receivedUnitCount() of the socket are called from the thread, the owner
+    suspends it while it changes the options they depend on.
+*/
+CanReceiveThread::CanReceiveThread(CanAbstractSocketPrivate *socket, int slotCount, int slotSize)
+    : QThread()
+    , socket(socket)
+    , queue(slotCount, slotSize)
+    , scratch(slotSize)
+    , wakeUpDescriptor(-1)
+    , stopDescriptor(-1)
+    , busyPollNsecs(0)
+    , cpu(-1)
+    , stopRequested(0)
+    , notifyPending(0)
+    , error(0)
+    , queuedBytes(0)
+{
+}
+
+CanReceiveThread::~CanReceiveThread()
+{
+    stopReceiving();
+}
+
+/*
+    Makes the thread spin for \a usecs on an empty socket before it blocks,
+    and pins it to \a cpu unless it is -1. Has to be called before
+    startReceiving().
+*/
+void CanReceiveThread::setBusyPoll(int usecs, int cpu)
+{
+    busyPollNsecs = qint64(usecs) * 1000;
+    this->cpu = cpu;
+}
+
+bool CanReceiveThread::startReceiving()
+{
+    wakeUpDescriptor = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    stopDescriptor = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeUpDescriptor == -1 || stopDescriptor == -1) {
+        const int eventError = errno;
+        stopReceiving();
+        errno = eventError;
+        return false;
+    }
+
+    stopRequested.storeRelease(0);
+    start(QThread::TimeCriticalPriority);
+    return true;
+}
+
+void CanReceiveThread::stopReceiving()
+{
+    if (isRunning()) {
+        stopRequested.storeRelease(1);
+        ::eventfd_write(stopDescriptor, 1);
+        wait();
+    }
+
+    if (wakeUpDescriptor != -1) {
+        ::close(wakeUpDescriptor);
+        wakeUpDescriptor = -1;
+    }
+    if (stopDescriptor != -1) {
+        ::close(stopDescriptor);
+        stopDescriptor = -1;
+    }
+}
+
+/*
+    Stops the thread and keeps its queue and descriptors, the owner reads
+    the queued data as before. Returns \c false if the thread wasn't
+    running, e.g. after a receive error.
+*/
+bool CanReceiveThread::suspend()
+{
+    if (!isRunning())
+        return false;
+
+    stopRequested.storeRelease(1);
+    ::eventfd_write(stopDescriptor, 1);
+    wait();
+    return true;
+}
+
+// continues a suspended thread, it sees everything the owner changed meanwhile
+void CanReceiveThread::resume()
+{
+    eventfd_t value;
+    ::eventfd_read(stopDescriptor, &value);
+    stopRequested.storeRelease(0);
+    start(QThread::TimeCriticalPriority);
+}
+
+// called by the owner before it drains the queue, data published from
+// now on wakes it up again
+void CanReceiveThread::acknowledge()
+{
+    eventfd_t value;
+    ::eventfd_read(wakeUpDescriptor, &value);
+    notifyPending.storeRelease(0);
+}
+
+void CanReceiveThread::wakeUp()
+{
+    if (notifyPending.testAndSetOrdered(0, 1))
+        ::eventfd_write(wakeUpDescriptor, 1);
+}
+
+void CanReceiveThread::release(qint64 bytes)
+{
+    queue.releaseSlot();
+    queuedBytes.fetchAndAddRelaxed(-bytes);
+}
+
+// spins on the queue for the busy poll time, so the owner isn't put to sleep either
+bool CanReceiveThread::spinForData() const
+{
+    if (busyPollNsecs <= 0)
+        return false;
+
+    qint64 bytes;
+    const qint64 deadline = monotonicNsecs() + busyPollNsecs;
+    do {
+        if (queue.peekSlot(&bytes) || error.loadAcquire())
+            return true;
+    } while (monotonicNsecs() < deadline && !stopRequested.loadAcquire());
+
+    return false;
+}
+
+void CanReceiveThread::run()
+{
+    if (cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        ::pthread_setaffinity_np(::pthread_self(), sizeof(cpus), &cpus);
+    }
+
+    while (drainSocket() && waitForSocket()) {
+    }
+}
+
+// reads until the socket is empty, returns false if the thread has to stop,
+// which a flooded bus must not hold off
+bool CanReceiveThread::drainSocket()
+{
+    forever {
+        if (stopRequested.loadAcquire())
+            return false;
+
+        // with the queue full the frames are read anyway and dropped, so
+        // the kernel buffer can't overrun and the loss is counted
+        char *slot = queue.reserveSlot();
+        char *data = slot ? slot : scratch.data();
+
+        const qint64 readBytes = socket->readFromSocket(data, queue.slotSize());
+        if (readBytes < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                return true;
+            error.storeRelease(errno);
+            wakeUp();
+            return false;
+        }
+        if (readBytes == 0)
+            return true;
+
+        if (!slot) {
+            socket->receiveQueueDroppedFrames.fetchAndAddRelaxed(socket->receivedUnitCount(data, readBytes));
+            continue;
+        }
+
+        queue.publishSlot(readBytes);
+
+        const qint64 queued = queuedBytes.fetchAndAddRelaxed(readBytes) + readBytes;
+        if (queued > socket->receiveQueueHighWaterMark.loadAcquire())
+            socket->receiveQueueHighWaterMark.storeRelease(queued);
+
+        wakeUp();
+    }
+}
+
+// blocks until the socket is readable, returns false if the thread has to stop
+bool CanReceiveThread::waitForSocket()
+{
+    if (busyPollNsecs > 0) {
+        // with SO_BUSY_POLL the nonblocking peek also polls the device queue
+        const qint64 deadline = monotonicNsecs() + busyPollNsecs;
+        char probe;
+        do {
+            if (stopRequested.loadAcquire())
+                return false;
+            if (::recv(socket->descriptor, &probe, sizeof(probe), MSG_PEEK | MSG_DONTWAIT) >= 0
+                    || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                return true; // errors are reported by the next read
+            }
+        } while (monotonicNsecs() < deadline);
+    }
+
+    struct pollfd descriptors[2];
+    descriptors[0].fd = socket->descriptor;
+    descriptors[0].events = POLLIN;
+    descriptors[1].fd = stopDescriptor;
+    descriptors[1].events = POLLIN;
+
+    int ret;
+    do {
+        descriptors[0].revents = 0;
+        descriptors[1].revents = 0;
+        ret = ::poll(descriptors, 2, -1);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        error.storeRelease(errno);
+        wakeUp();
+        return false;
+    }
+
+    return !(descriptors[1].revents & POLLIN);
+}
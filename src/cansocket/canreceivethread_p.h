@@ -0,0 +1,106 @@
+﻿/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#ifndef CANRECEIVETHREAD_P_H
+#define CANRECEIVETHREAD_P_H
+
+#include <QtCore/qatomic.h>
+#include <QtCore/qthread.h>
+#include <QtCore/qvector.h>
+
+class CanAbstractSocketPrivate;
+
+// Lock-free single producer, single consumer ring of fixed size slots. Each
+// slot holds the result of one readFromSocket() call, so the producer reads
+// straight into the ring and the consumer copies whole chunks.
+class CanReceiveQueue
+{
+public:
+    CanReceiveQueue(int slotCount, int slotSize);
+
+    int slotSize() const { return size; }
+
+    // producer
+    char *reserveSlot();
+    void publishSlot(qint64 bytes);
+
+    // consumer
+    const char *peekSlot(qint64 *bytes) const;
+    void releaseSlot();
+
+private:
+    QVector<char> storage;
+    QVector<qint64> lengths;
+    const int size;
+    const quint32 mask;
+
+    QAtomicInteger<quint32> head Q_DECL_ALIGN(64); // next slot to consume
+    QAtomicInteger<quint32> tail Q_DECL_ALIGN(64); // next slot to produce
+};
+
+class CanReceiveThread : public QThread
+{
+public:
+    CanReceiveThread(CanAbstractSocketPrivate *socket, int slotCount, int slotSize);
+    ~CanReceiveThread();
+
+    void setBusyPoll(int usecs, int cpu);
+
+    bool startReceiving();
+    void stopReceiving();
+    bool suspend();
+    void resume();
+
+    // the owner thread is woken up through an eventfd, once per batch
+    int eventDescriptor() const { return wakeUpDescriptor; }
+    void acknowledge();
+    void wakeUp();
+
+    int slotSize() const { return queue.slotSize(); }
+    const char *peek(qint64 *bytes) const { return queue.peekSlot(bytes); }
+    bool spinForData() const;
+    void release(qint64 bytes);
+
+    int receiveError() const { return error.loadAcquire(); }
+
+protected:
+    void run() Q_DECL_OVERRIDE;
+
+    bool drainSocket();
+    bool waitForSocket();
+
+    CanAbstractSocketPrivate *socket;
+    CanReceiveQueue queue;
+    QVector<char> scratch;
+
+    int wakeUpDescriptor;
+    int stopDescriptor;
+
+    qint64 busyPollNsecs;
+    int cpu;
+
+    QAtomicInt stopRequested;
+    QAtomicInt notifyPending;
+    QAtomicInt error;
+    QAtomicInteger<qint64> queuedBytes;
+
+private:
+    Q_DISABLE_COPY(CanReceiveThread)
+};
+
+#endif // CANRECEIVETHREAD_P_H
@@ -4,17 +4,35 @@ PUBLIC_HEADERS += \
     $$PWD/cansocketglobal.h \
     $$PWD/canabstractsocket.h \
     $$PWD/canframe.h \
-    $$PWD/canrawsocket.h
+    $$PWD/canframecodec.h \
+    $$PWD/canrawsocket.h \
+    $$PWD/cancapturesocket.h \
+    $$PWD/cansocketreactor.h \
+    $$PWD/cansockettrace.h
 
 PRIVATE_HEADERS += \
     $$PWD/canabstractsocket_p.h \
     $$PWD/canframe_p.h \
-    $$PWD/canrawsocket_p.h
+    $$PWD/canrawsocket_p.h \
+    $$PWD/canrawtransmitqueues_p.h \
+    $$PWD/cancapturesocket_p.h \
+    $$PWD/caniouring_p.h \
+    $$PWD/cansocketreactor_p.h \
+    $$PWD/canreceivethread_p.h \
+    $$PWD/cansockettrace_p.h
 
 SOURCES += \
     $$PWD/canabstractsocket.cpp \
     $$PWD/canframe.cpp \
-    $$PWD/canrawsocket.cpp
+    $$PWD/canframecodec.cpp \
+    $$PWD/canframepool.cpp \
+    $$PWD/canrawsocket.cpp \
+    $$PWD/canrawbpffilter.cpp \
+    $$PWD/canrawfilteroptimizer.cpp \
+    $$PWD/cancapturesocket.cpp \
+    $$PWD/cansocketreactor.cpp \
+    $$PWD/canreceivethread.cpp \
+    $$PWD/cansockettrace.cpp
 
 config_isotp {
     PUBLIC_HEADERS += $$PWD/canisotpsocket.h
@@ -22,12 +40,39 @@ config_isotp {
     SOURCES += $$PWD/canisotpsocket.cpp
 }
 
+config_iouring {
+    DEFINES += CANSOCKET_HAVE_IOURING
+    SOURCES += $$PWD/caniouring.cpp
+}
+
+# qmake CONFIG+=cansocket_trace compiles the trace points in
+cansocket_trace {
+    DEFINES += CANSOCKET_TRACE
+    config_sdt: DEFINES += CANSOCKET_TRACE_SDT
+}
+
 config_isotp {
     message("Including CAN ISO-TP protocol")
 } else {
     message("Skipping CAN ISO-TP protocol")
 }
 
+config_iouring {
+    message("Including io_uring backend")
+} else {
+    message("Skipping io_uring backend")
+}
+
+cansocket_trace {
+    config_sdt {
+        message("Including trace points with USDT probes")
+    } else {
+        message("Including trace points")
+    }
+} else {
+    message("Skipping trace points")
+}
+
 
 HEADERS += $$PUBLIC_HEADERS $$PRIVATE_HEADERS \
 
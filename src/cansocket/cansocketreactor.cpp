@@ -0,0 +1,399 @@
+﻿/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "cansocketreactor.h"
+#include "cansocketreactor_p.h"
+#include "canabstractsocket.h"
+#include "canabstractsocket_p.h"
+
+#include <QtCore/qsocketnotifier.h>
+#include <QtCore/qthread.h>
+#include <QtCore/qtimer.h>
+
+#include <sys/epoll.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define CAN_REACTOR_DEFAULT_BATCH_SIZE 64 // sockets dispatched per round
+#define CAN_REACTOR_MAX_BATCH_SIZE 256
+
+/*!
+    \class CanSocketReactor
+
+    \brief The CanSocketReactor class multiplexes the I/O notifications of
+    many CAN sockets over one epoll instance.
+
+    \ingroup cansocket
+    \inmodule cansocket-qt-lib
+
+    By default every socket owns a read and a write QSocketNotifier, and the
+    cost of the event dispatcher grows with each of them. Sockets added to a
+    reactor instead have their descriptors registered edge triggered with a
+    single epoll descriptor, which is the only one watched by the event loop.
+
+    Ready sockets are dispatched in rounds of at most batchSize() sockets.
+    A socket that received data is read again in the next round until it is
+    drained, remaining rounds are continued from the event loop so one busy
+    socket can't starve the others.
+
+    The reactor and its sockets have to live in the same thread. A socket can
+    be added before or while it is connected and keeps its reactor across
+    reconnects. Removing a socket, or destroying the reactor, gives the
+    sockets their own notifiers back.
+ */
+
+class ReactorNotifier : public QSocketNotifier
+{
+public:
+    ReactorNotifier(CanSocketReactorPrivate *d, QObject *parent)
+        : QSocketNotifier(d->epollDescriptor, QSocketNotifier::Read, parent)
+        , dptr(d)
+    {
+    }
+
+protected:
+    bool event(QEvent *e) Q_DECL_OVERRIDE
+    {
+        if (e->type() == QEvent::SockAct) {
+            dptr->processEvents();
+            return true;
+        }
+        return QSocketNotifier::event(e);
+    }
+
+private:
+    CanSocketReactorPrivate *dptr;
+};
+
+static inline CanAbstractSocketPrivate *socketPrivate(CanAbstractSocket *socket)
+{
+    return static_cast<CanAbstractSocketPrivate *>(QObjectPrivate::get(socket));
+}
+
+CanSocketReactor::CanSocketReactor(QObject *parent)
+    : QObject(*new CanSocketReactorPrivate, parent)
+{
+    Q_D(CanSocketReactor);
+
+    d->epollDescriptor = ::epoll_create1(EPOLL_CLOEXEC);
+    if (d->epollDescriptor != -1)
+        d->notifier = new ReactorNotifier(d, this);
+}
+
+CanSocketReactor::~CanSocketReactor()
+{
+    Q_D(CanSocketReactor);
+
+    while (!d->entries.isEmpty())
+        d->detach(d->entries.last(), true);
+}
+
+/*!
+    Returns \c true if the epoll instance could be created.
+ */
+bool CanSocketReactor::isValid() const
+{
+    Q_D(const CanSocketReactor);
+    return d->epollDescriptor != -1;
+}
+
+/*!
+    Moves the notifications of \a socket to this reactor. Returns \c false if
+    the reactor is invalid, the socket lives in another thread or it belongs
+    to another reactor.
+ */
+bool CanSocketReactor::addSocket(CanAbstractSocket *socket)
+{
+    Q_D(CanSocketReactor);
+
+    if (!socket || d->epollDescriptor == -1 || socket->thread() != thread())
+        return false;
+
+    CanAbstractSocketPrivate *socketD = socketPrivate(socket);
+    if (socketD->reactorEntry)
+        return socketD->reactorEntry->reactor == d;
+
+    d->attach(socketD);
+    return true;
+}
+
+/*!
+    Gives \a socket its own notifiers back.
+ */
+void CanSocketReactor::removeSocket(CanAbstractSocket *socket)
+{
+    Q_D(CanSocketReactor);
+
+    if (!socket)
+        return;
+
+    CanAbstractSocketPrivate *socketD = socketPrivate(socket);
+    if (socketD->reactorEntry && socketD->reactorEntry->reactor == d)
+        d->detach(socketD->reactorEntry, true);
+}
+
+bool CanSocketReactor::hasSocket(CanAbstractSocket *socket) const
+{
+    Q_D(const CanSocketReactor);
+
+    if (!socket)
+        return false;
+
+    const CanAbstractSocketPrivate *socketD = socketPrivate(socket);
+    return socketD->reactorEntry && socketD->reactorEntry->reactor == d;
+}
+
+int CanSocketReactor::socketCount() const
+{
+    Q_D(const CanSocketReactor);
+    return d->entries.size();
+}
+
+/*!
+    Sets the maximum number of \a sockets dispatched in one round, and of
+    events fetched from epoll at once. The default is 64.
+ */
+void CanSocketReactor::setBatchSize(int sockets)
+{
+    Q_D(CanSocketReactor);
+    d->batchSize = qBound(1, sockets, CAN_REACTOR_MAX_BATCH_SIZE);
+}
+
+int CanSocketReactor::batchSize() const
+{
+    Q_D(const CanSocketReactor);
+    return d->batchSize;
+}
+
+CanSocketReactorPrivate::CanSocketReactorPrivate()
+    : epollDescriptor(-1)
+    , notifier(Q_NULLPTR)
+    , batchSize(CAN_REACTOR_DEFAULT_BATCH_SIZE)
+    , dispatching(false)
+    , dispatchScheduled(false)
+{
+}
+
+CanSocketReactorPrivate::~CanSocketReactorPrivate()
+{
+    qDeleteAll(removedEntries);
+
+    if (epollDescriptor != -1)
+        ::close(epollDescriptor);
+}
+
+void CanSocketReactorPrivate::attach(CanAbstractSocketPrivate *socket)
+{
+    CanSocketReactorEntry *entry = new CanSocketReactorEntry;
+    entry->reactor = this;
+    entry->socket = socket;
+    entry->descriptor = -1;
+    entry->readEnabled = socket->readNotifier && socket->readNotifier->isEnabled();
+    entry->writeEnabled = socket->writeNotifier && socket->writeNotifier->isEnabled();
+    entry->readReady = false;
+    entry->writeReady = false;
+    entry->queued = false;
+
+    // the reactor takes over from the socket notifiers
+    delete socket->readNotifier;
+    socket->readNotifier = Q_NULLPTR;
+    delete socket->writeNotifier;
+    socket->writeNotifier = Q_NULLPTR;
+
+    socket->reactorEntry = entry;
+    entries.append(entry);
+
+    if (socket->descriptor > 0 && registerDescriptor(entry)) {
+        // readiness may predate the registration
+        setReadEnabled(entry, entry->readEnabled);
+        setWriteEnabled(entry, entry->writeEnabled);
+    }
+}
+
+void CanSocketReactorPrivate::detach(CanSocketReactorEntry *entry, bool restoreNotifiers)
+{
+    CanAbstractSocketPrivate *socket = entry->socket;
+    const bool readEnabled = entry->readEnabled;
+    const bool writeEnabled = entry->writeEnabled;
+
+    unregisterDescriptor(entry);
+
+    entries.removeOne(entry);
+    if (entry->queued)
+        readyEntries.removeOne(entry);
+
+    socket->reactorEntry = Q_NULLPTR;
+    if (restoreNotifiers && socket->descriptor > 0) {
+        if (readEnabled)
+            socket->setReadNotificationEnabled(true);
+        if (writeEnabled)
+            socket->setWriteNotificationEnabled(true);
+    }
+
+    // the entry may still be referenced by the round being dispatched
+    entry->socket = Q_NULLPTR;
+    if (dispatching)
+        removedEntries.append(entry);
+    else
+        delete entry;
+}
+
+bool CanSocketReactorPrivate::registerDescriptor(CanSocketReactorEntry *entry)
+{
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    event.data.ptr = entry;
+
+    if (::epoll_ctl(epollDescriptor, EPOLL_CTL_ADD, entry->socket->descriptor, &event) == -1)
+        return false;
+
+    entry->descriptor = entry->socket->descriptor;
+    return true;
+}
+
+void CanSocketReactorPrivate::unregisterDescriptor(CanSocketReactorEntry *entry)
+{
+    if (entry->descriptor != -1) {
+        ::epoll_ctl(epollDescriptor, EPOLL_CTL_DEL, entry->descriptor, Q_NULLPTR);
+        entry->descriptor = -1;
+    }
+
+    // as the socket notifiers, the states don't outlive the connection
+    entry->readEnabled = false;
+    entry->writeEnabled = false;
+    entry->readReady = false;
+    entry->writeReady = false;
+}
+
+/*
+    With edge triggered notifications an edge that arrived while the
+    notification was disabled is not repeated, so enabling it dispatches
+    the socket once; a socket that has nothing to read costs one read.
+*/
+void CanSocketReactorPrivate::setReadEnabled(CanSocketReactorEntry *entry, bool enable)
+{
+    entry->readEnabled = enable;
+    if (enable && entry->descriptor != -1) {
+        entry->readReady = true;
+        enqueue(entry);
+    }
+}
+
+void CanSocketReactorPrivate::setWriteEnabled(CanSocketReactorEntry *entry, bool enable)
+{
+    entry->writeEnabled = enable;
+    if (enable && entry->descriptor != -1) {
+        entry->writeReady = true;
+        enqueue(entry);
+    }
+}
+
+void CanSocketReactorPrivate::enqueue(CanSocketReactorEntry *entry)
+{
+    if (!entry->queued) {
+        entry->queued = true;
+        readyEntries.append(entry);
+    }
+    scheduleDispatch();
+}
+
+void CanSocketReactorPrivate::scheduleDispatch()
+{
+    Q_Q(CanSocketReactor);
+
+    // a running round schedules the next one itself
+    if (dispatchScheduled || dispatching)
+        return;
+
+    dispatchScheduled = true;
+    QTimer::singleShot(0, q, [this]() { dispatchReady(); });
+}
+
+void CanSocketReactorPrivate::processEvents()
+{
+    struct epoll_event events[CAN_REACTOR_MAX_BATCH_SIZE];
+
+    int count;
+    do {
+        count = ::epoll_wait(epollDescriptor, events, batchSize, 0);
+    } while (count < 0 && errno == EINTR);
+
+    for (int i = 0; i < count; ++i) {
+        CanSocketReactorEntry *entry = static_cast<CanSocketReactorEntry *>(events[i].data.ptr);
+        if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+            entry->readReady = true;
+        if (events[i].events & EPOLLOUT)
+            entry->writeReady = true;
+        if (!entry->queued) {
+            entry->queued = true;
+            readyEntries.append(entry);
+        }
+    }
+
+    if (!dispatching)
+        dispatchReady();
+}
+
+void CanSocketReactorPrivate::dispatchReady()
+{
+    dispatchScheduled = false;
+    if (readyEntries.isEmpty())
+        return;
+
+    dispatching = true;
+
+    const int count = qMin(readyEntries.size(), batchSize);
+    const QVector<CanSocketReactorEntry *> round = readyEntries.mid(0, count);
+    readyEntries.remove(0, count);
+    for (CanSocketReactorEntry *entry : round)
+        entry->queued = false;
+
+    for (CanSocketReactorEntry *entry : round) {
+        CanAbstractSocketPrivate *socket = entry->socket;
+
+        if (socket && entry->descriptor != -1 && entry->writeReady && entry->writeEnabled) {
+            // one shot, startAsyncWrite() enables it again while data is pending
+            entry->writeReady = false;
+            entry->writeEnabled = false;
+            socket->completeAsyncWrite();
+        }
+
+        if (entry->socket && entry->descriptor != -1 && entry->readReady && entry->readEnabled) {
+            const qint64 receivedBytes = socket->receivedBytes;
+            socket->readNotification();
+
+            // keep reading in the next rounds until the socket is drained
+            if (entry->socket && entry->descriptor != -1 && entry->readEnabled
+                    && socket->receivedBytes != receivedBytes) {
+                enqueue(entry);
+            } else {
+                entry->readReady = false;
+            }
+        }
+    }
+
+    dispatching = false;
+
+    qDeleteAll(removedEntries);
+    removedEntries.clear();
+
+    if (!readyEntries.isEmpty())
+        scheduleDispatch();
+}
+
+#include "moc_cansocketreactor.cpp"
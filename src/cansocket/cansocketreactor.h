@@ -0,0 +1,54 @@
+﻿/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#ifndef CANSOCKETREACTOR_H
+#define CANSOCKETREACTOR_H
+
+#include <QtCore/qobject.h>
+
+#include <CanSocket/cansocketglobal.h>
+
+class CanAbstractSocket;
+class CanSocketReactorPrivate;
+
+class CANSOCKET_EXPORT CanSocketReactor : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(int batchSize READ batchSize WRITE setBatchSize)
+
+public:
+    explicit CanSocketReactor(QObject *parent = Q_NULLPTR);
+    virtual ~CanSocketReactor();
+
+    bool isValid() const;
+
+    bool addSocket(CanAbstractSocket *socket);
+    void removeSocket(CanAbstractSocket *socket);
+    bool hasSocket(CanAbstractSocket *socket) const;
+    int socketCount() const;
+
+    void setBatchSize(int sockets);
+    int batchSize() const;
+
+private:
+    Q_DECLARE_PRIVATE(CanSocketReactor)
+    Q_DISABLE_COPY(CanSocketReactor)
+};
+
+#endif // CANSOCKETREACTOR_H
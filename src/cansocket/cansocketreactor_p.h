@@ -0,0 +1,76 @@
+﻿/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#ifndef CANSOCKETREACTOR_P_H
+#define CANSOCKETREACTOR_P_H
+
+#include <CanSocket/cansocketreactor.h>
+
+#include <QtCore/qvector.h>
+#include <QtCore/private/qobject_p.h>
+
+class QSocketNotifier;
+class CanAbstractSocketPrivate;
+class CanSocketReactorPrivate;
+
+struct CanSocketReactorEntry
+{
+    CanSocketReactorPrivate *reactor;
+    CanAbstractSocketPrivate *socket;
+    int descriptor;     // registered with epoll, -1 while not connected
+    bool readEnabled;   // mirror the socket notifier states
+    bool writeEnabled;
+    bool readReady;     // edge seen and not yet drained
+    bool writeReady;
+    bool queued;
+};
+
+class CanSocketReactorPrivate : public QObjectPrivate
+{
+    Q_DECLARE_PUBLIC(CanSocketReactor)
+
+public:
+    CanSocketReactorPrivate();
+    virtual ~CanSocketReactorPrivate();
+
+    void attach(CanAbstractSocketPrivate *socket);
+    void detach(CanSocketReactorEntry *entry, bool restoreNotifiers);
+
+    bool registerDescriptor(CanSocketReactorEntry *entry);
+    void unregisterDescriptor(CanSocketReactorEntry *entry);
+
+    void setReadEnabled(CanSocketReactorEntry *entry, bool enable);
+    void setWriteEnabled(CanSocketReactorEntry *entry, bool enable);
+
+    void enqueue(CanSocketReactorEntry *entry);
+    void scheduleDispatch();
+    void processEvents();
+    void dispatchReady();
+
+    int epollDescriptor;
+    QSocketNotifier *notifier;
+    int batchSize;
+
+    QVector<CanSocketReactorEntry *> entries;
+    QVector<CanSocketReactorEntry *> readyEntries;
+    QVector<CanSocketReactorEntry *> removedEntries;
+    bool dispatching;
+    bool dispatchScheduled;
+};
+
+#endif // CANSOCKETREACTOR_P_H
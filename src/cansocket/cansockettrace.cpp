@@ -0,0 +1,177 @@
+/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include "cansockettrace.h"
+#include "cansockettrace_p.h"
+
+#include <time.h>
+
+#define CAN_TRACE_RING_SIZE 8192 // events kept, a power of two
+
+static const char *const tracePointNames[] = {
+    "ReadNotification",
+    "ReadIntoBuffer",
+    "ReadDirect",
+    "WriteData",
+    "WriteToSocket",
+    "BytesWritten",
+    "ReadNotifierEnabled",
+    "WriteNotifierEnabled",
+    "SocketOption"
+};
+Q_STATIC_ASSERT(sizeof(tracePointNames) / sizeof(tracePointNames[0]) == CanSocketTrace::TracePointCount);
+
+#ifdef CANSOCKET_TRACE
+
+QBasicAtomicInt CanSocketTracePrivate::enabled = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+namespace {
+
+// the sequence is index + 1 of the event in the slot, 0 while it is written
+struct CanSocketTraceSlot
+{
+    QBasicAtomicInteger<quint64> sequence;
+    CanSocketTraceEvent event;
+};
+
+}
+
+static CanSocketTraceSlot traceRing[CAN_TRACE_RING_SIZE];
+static QBasicAtomicInteger<quint64> traceHead = Q_BASIC_ATOMIC_INITIALIZER(0);
+static QBasicAtomicInteger<quint64> traceStart = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+// CANSOCKET_TRACE=1 enables the ring from the start of the application
+static void enableTraceFromEnvironment()
+{
+    if (qEnvironmentVariableIntValue("CANSOCKET_TRACE") > 0)
+        CanSocketTracePrivate::enabled.store(1);
+}
+Q_CONSTRUCTOR_FUNCTION(enableTraceFromEnvironment)
+
+/*
+    Records an event without locking, writers of the same slot can only
+    collide after the ring wrapped around while one of them was preempted.
+*/
+void CanSocketTracePrivate::record(int point, int descriptor, qint64 arg0, qint64 arg1)
+{
+    const quint64 index = traceHead.fetchAndAddRelaxed(1);
+    CanSocketTraceSlot &slot = traceRing[index & (CAN_TRACE_RING_SIZE - 1)];
+
+    struct timespec now;
+    ::clock_gettime(CLOCK_MONOTONIC, &now);
+
+    slot.sequence.storeRelease(0);
+    slot.event.timestamp = qint64(now.tv_sec) * 1000000000 + now.tv_nsec;
+    slot.event.point = point;
+    slot.event.descriptor = descriptor;
+    slot.event.arg0 = arg0;
+    slot.event.arg1 = arg1;
+    slot.sequence.storeRelease(index + 1);
+}
+
+#endif // CANSOCKET_TRACE
+
+/*!
+    \class CanSocketTrace
+
+    Gives access to the trace points of the read, write, notifier and option
+    paths of the sockets. They are only compiled into a library configured
+    with CONFIG += cansocket_trace, and cost nothing otherwise.
+
+    While enabled, every trace point records an event into a ring of the
+    last 8192 events, which events() copies out. The ring can also be
+    enabled with the environment variable CANSOCKET_TRACE=1. The trace
+    points are USDT probes as well, which external tracers can attach to
+    without enabling the ring.
+ */
+
+/*!
+    Returns \c true if the library was built with trace points.
+ */
+bool CanSocketTrace::isAvailable()
+{
+#ifdef CANSOCKET_TRACE
+    return true;
+#else
+    return false;
+#endif
+}
+
+void CanSocketTrace::setEnabled(bool enable)
+{
+#ifdef CANSOCKET_TRACE
+    CanSocketTracePrivate::enabled.store(enable ? 1 : 0);
+#else
+    Q_UNUSED(enable);
+#endif
+}
+
+bool CanSocketTrace::isEnabled()
+{
+#ifdef CANSOCKET_TRACE
+    return CanSocketTracePrivate::enabled.load() != 0;
+#else
+    return false;
+#endif
+}
+
+/*!
+    Returns the recorded events from the oldest to the newest. Events
+    overwritten while they are copied are left out.
+ */
+QVector<CanSocketTraceEvent> CanSocketTrace::events()
+{
+    QVector<CanSocketTraceEvent> events;
+
+#ifdef CANSOCKET_TRACE
+    const quint64 head = traceHead.loadAcquire();
+    quint64 first = head > CAN_TRACE_RING_SIZE ? head - CAN_TRACE_RING_SIZE : 0;
+    first = qMax(first, traceStart.loadAcquire());
+
+    events.reserve(int(head - first));
+    for (quint64 index = first; index < head; ++index) {
+        const CanSocketTraceSlot &slot = traceRing[index & (CAN_TRACE_RING_SIZE - 1)];
+        if (slot.sequence.loadAcquire() != index + 1)
+            continue;
+
+        const CanSocketTraceEvent event = slot.event;
+        if (slot.sequence.loadAcquire() == index + 1)
+            events.append(event);
+    }
+#endif
+
+    return events;
+}
+
+void CanSocketTrace::clear()
+{
+#ifdef CANSOCKET_TRACE
+    traceStart.storeRelease(traceHead.loadAcquire());
+#endif
+}
+
+/*!
+    Returns the name of the trace point \a point, which is also the name of
+    its USDT probe.
+ */
+const char *CanSocketTrace::pointName(int point)
+{
+    if (point < 0 || point >= TracePointCount)
+        return "Unknown";
+    return tracePointNames[point];
+}
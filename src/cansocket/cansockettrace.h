@@ -0,0 +1,65 @@
+/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#ifndef CANSOCKETTRACE_H
+#define CANSOCKETTRACE_H
+
+#include <QtCore/qvector.h>
+
+#include <CanSocket/cansocketglobal.h>
+
+struct CanSocketTraceEvent
+{
+    qint64 timestamp; // CLOCK_MONOTONIC nanoseconds
+    int point;
+    int descriptor;
+    qint64 arg0;
+    qint64 arg1;
+};
+
+class CANSOCKET_EXPORT CanSocketTrace
+{
+public:
+    enum TracePoint {
+        ReadNotification,
+        ReadIntoBuffer,
+        ReadDirect,
+        WriteData,
+        WriteToSocket,
+        BytesWritten,
+        ReadNotifierEnabled,
+        WriteNotifierEnabled,
+        SocketOption,
+
+        TracePointCount
+    };
+
+    static bool isAvailable();
+
+    static void setEnabled(bool enable);
+    static bool isEnabled();
+
+    static QVector<CanSocketTraceEvent> events();
+    static void clear();
+
+    static const char *pointName(int point);
+};
+
+Q_DECLARE_TYPEINFO(CanSocketTraceEvent, Q_PRIMITIVE_TYPE);
+
+#endif // CANSOCKETTRACE_H
@@ -0,0 +1,62 @@
+/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#ifndef CANSOCKETTRACE_P_H
+#define CANSOCKETTRACE_P_H
+
+#include <CanSocket/cansockettrace.h>
+
+#include <QtCore/qatomic.h>
+
+// Trace points of the hot paths. They compile to nothing unless the library
+// is configured with CONFIG += cansocket_trace, which defines CANSOCKET_TRACE.
+// Then every point records into the ring of CanSocketTrace while it is
+// enabled, and is a USDT probe of the provider cansocket if <sys/sdt.h> was
+// found, for bpftrace, perf, SystemTap or LTTng.
+#ifdef CANSOCKET_TRACE
+
+#   ifdef CANSOCKET_TRACE_SDT
+#       include <sys/sdt.h>
+#       define CAN_TRACE_PROBE(point, descriptor, arg0, arg1) \
+            DTRACE_PROBE3(cansocket, point, int(descriptor), qint64(arg0), qint64(arg1))
+#   else
+#       define CAN_TRACE_PROBE(point, descriptor, arg0, arg1) do {} while (false)
+#   endif
+
+class CanSocketTracePrivate
+{
+public:
+    static QBasicAtomicInt enabled;
+
+    static void record(int point, int descriptor, qint64 arg0, qint64 arg1);
+};
+
+#   define CAN_TRACE(point, descriptor, arg0, arg1) \
+        do { \
+            CAN_TRACE_PROBE(point, descriptor, arg0, arg1); \
+            if (Q_UNLIKELY(CanSocketTracePrivate::enabled.load())) \
+                CanSocketTracePrivate::record(CanSocketTrace::point, int(descriptor), qint64(arg0), qint64(arg1)); \
+        } while (false)
+
+#else
+
+#   define CAN_TRACE(point, descriptor, arg0, arg1) do {} while (false)
+
+#endif // CANSOCKET_TRACE
+
+#endif // CANSOCKETTRACE_P_H
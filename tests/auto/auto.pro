@@ -1,5 +1,6 @@
 TEMPLATE = subdirs
-SUBDIRS = canframe cmake
+SUBDIRS = canframe canframecodec canrawbpffilter canrawfilteroptimizer canrawsocket canrawtransmitqueues cmake
 
 !contains(QT_CONFIG, private_tests): SUBDIRS -= \
-	canframedata
+	canframedata \
+	canrawtransmitqueues
@@ -21,6 +21,7 @@
 #include <QtTest>
 
 #include <CanSocket/canframe.h>
+#include <private/canframe_p.h>
 #include <linux/can.h>
 
 class tst_CanFrame : public QObject
@@ -32,6 +33,12 @@ public:
 
 private Q_SLOTS:
     void constructors();
+    void streamTimestamp();
+    void streamXlFrame();
+    void payloadStorage();
+    void editorCopies();
+    void framePool();
+    void frameView();
 };
 
 tst_CanFrame::tst_CanFrame()
@@ -95,6 +102,269 @@ void tst_CanFrame::constructors()
         QVERIFY(canRtrFrame.id() & CanFrame::RtrIdFlag);
 }
 
+void tst_CanFrame::streamTimestamp()
+{
+    struct can_frame canFrame;
+    ::memset(&canFrame, 0, sizeof(canFrame));
+    canFrame.can_id = 0x123;
+    canFrame.can_dlc = 2;
+    canFrame.data[0] = 0x11;
+    canFrame.data[1] = 0x22;
+
+    QByteArray record(reinterpret_cast<const char *>(&canFrame), sizeof(canFrame));
+    record[6] = res0FromCanMtu(CAN_MTU);
+    record[7] = res1FromCanMtu(CAN_MTU) | CAN_RES1_TRAILER_FLAG;
+
+    CanFrameTrailer trailer;
+    ::memset(&trailer, 0, sizeof(trailer));
+    trailer.timestamp = Q_INT64_C(1476000000123456789);
+    trailer.timestampSource = CanFrame::SoftwareTimestamp;
+    trailer.interfaceIndex = 3;
+    record.append(reinterpret_cast<const char *>(&trailer), sizeof(trailer));
+
+    QDataStream stream(record);
+    stream.setByteOrder(static_cast<QDataStream::ByteOrder>(QSysInfo::ByteOrder));
+
+    CanFrame frame;
+    stream >> frame;
+
+    QVERIFY(stream.atEnd());
+    QVERIFY(frame.isDataFrame());
+    QCOMPARE(frame.canId(), 0x123u);
+    QCOMPARE(frame.dataLength(), 2);
+    QCOMPARE(frame.constData()[1], char(0x22));
+    QVERIFY(frame.hasTimestamp());
+    QCOMPARE(frame.timestampSource(), CanFrame::SoftwareTimestamp);
+    QCOMPARE(frame.timestamp(), trailer.timestamp);
+    QCOMPARE(frame.interfaceIndex(), 3);
+}
+
+void tst_CanFrame::streamXlFrame()
+{
+    // struct canxl_frame with the used payload only
+    const quint32 prio = 0x123 | (0x05 << CANXL_VCID_OFFSET);
+    const quint8 flags = CANXL_XLF | CANXL_SEC;
+    const quint8 sdt = 0x03;
+    const quint16 len = 3;
+    const quint32 af = 0xcafe0001;
+    const char payload[] = { 0x11, 0x22, 0x33 };
+
+    QByteArray record;
+    record.append(reinterpret_cast<const char *>(&prio), sizeof(prio));
+    record.append(static_cast<char>(flags | CAN_XL_TRAILER_FLAG));
+    record.append(static_cast<char>(sdt));
+    record.append(reinterpret_cast<const char *>(&len), sizeof(len));
+    record.append(reinterpret_cast<const char *>(&af), sizeof(af));
+    record.append(payload, sizeof(payload));
+    QCOMPARE(record.size(), int(CANXL_HDR_SIZE) + 3);
+
+    CanFrameTrailer trailer;
+    ::memset(&trailer, 0, sizeof(trailer));
+    trailer.timestamp = Q_INT64_C(1476000000123456789);
+    trailer.timestampSource = CanFrame::SoftwareTimestamp;
+    record.append(reinterpret_cast<const char *>(&trailer), sizeof(trailer));
+
+    QDataStream in(record);
+    in.setByteOrder(static_cast<QDataStream::ByteOrder>(QSysInfo::ByteOrder));
+
+    CanFrame frame;
+    in >> frame;
+
+    QVERIFY(in.atEnd());
+    QVERIFY(frame.isXlFrame());
+    QCOMPARE(frame.frameType(), CanFrame::XlFrame);
+    QCOMPARE(frame.canId(), 0x123u);
+    QCOMPARE(frame.virtualCanId(), quint8(0x05));
+    QCOMPARE(frame.sduType(), sdt);
+    QCOMPARE(frame.acceptanceField(), af);
+    QCOMPARE(frame.xlFrameFlags(), CanFrame::CanXlFrameFlags(CanFrame::SimpleExtendedContentFlag));
+    QCOMPARE(frame.dataLength(), 3);
+    QCOMPARE(frame.constData()[2], char(0x33));
+    QCOMPARE(frame.timestamp(), trailer.timestamp);
+
+    // written without the trailer, as the kernel takes it
+    QByteArray written;
+    QDataStream out(&written, QIODevice::WriteOnly);
+    out.setByteOrder(static_cast<QDataStream::ByteOrder>(QSysInfo::ByteOrder));
+    out << frame;
+
+    QByteArray expected = record.left(CANXL_HDR_SIZE + 3);
+    expected[CANXL_FLAGS_BYTE] = static_cast<char>(flags);
+    QCOMPARE(written, expected);
+
+    // converting drops the XL fields
+    frame.toFdFrame();
+    QVERIFY(frame.isFdFrame());
+    QCOMPARE(frame.canId(), 0x123u);
+    QCOMPARE(frame.sduType(), quint8(0));
+    QVERIFY(!frame.setVirtualCanId(1));
+}
+
+void tst_CanFrame::payloadStorage()
+{
+    const char payload[] = { 0x11, 0x22, 0x33, 0x44 };
+
+    CanFrame fdFrame(CanFrame::FdFrame);
+    QVERIFY(fdFrame.setDataLength(4));
+    fdFrame.setData(payload, sizeof(payload));
+
+    // copies share the frame data until one of them is written
+    CanFrame copy(fdFrame);
+    copy[0] = 0x55;
+    QCOMPARE(fdFrame.constData()[0], char(0x11));
+    QCOMPARE(copy.constData()[0], char(0x55));
+    QCOMPARE(copy.constData()[3], char(0x44));
+
+    // the XL payload moves to the side buffer and back, keeping the bytes
+    fdFrame.toXlFrame();
+    QVERIFY(fdFrame.isXlFrame());
+    QCOMPARE(fdFrame.dataLength(), 4);
+    QCOMPARE(fdFrame.constData()[3], char(0x44));
+    QCOMPARE(fdFrame.constData()[CANXL_MAX_DLEN - 1], char(0));
+
+    CanFrame xlCopy(fdFrame);
+    xlCopy[1] = 0x66;
+    QCOMPARE(fdFrame.constData()[1], char(0x22));
+    QVERIFY(xlCopy.constData() != fdFrame.constData());
+
+    fdFrame.toDataFrame();
+    QVERIFY(fdFrame.isDataFrame());
+    QCOMPARE(fdFrame.dataLength(), 4);
+    QCOMPARE(fdFrame.constData()[2], char(0x33));
+    QCOMPARE(fdFrame.constData()[7], char(0));
+}
+
+void tst_CanFrame::editorCopies()
+{
+    CanFrame frame(CanFrame::DataFrame);
+    frame.setCanId(0x123);
+    frame.setDataLength(2);
+
+    QVector<CanFrame> copies;
+    {
+        CanFrameEditor editor(frame);
+        editor[0] = 0x11;
+
+        // copies made while the editor exists don't see later changes
+        copies.append(frame);
+        CanFrame assigned;
+        assigned = frame;
+        copies.append(assigned);
+
+        editor[0] = 0x22;
+        QVERIFY(editor.setDataLength(0));
+        editor.setId(0x456 | CAN_RTR_FLAG);
+    }
+
+    QCOMPARE(frame.constData()[0], char(0x22));
+    QCOMPARE(frame.frameType(), CanFrame::RtrFrame);
+    for (int i = 0; i < copies.size(); ++i) {
+        QCOMPARE(copies.at(i).constData()[0], char(0x11));
+        QCOMPARE(copies.at(i).canId(), uint(0x123));
+        QCOMPARE(copies.at(i).frameType(), CanFrame::DataFrame);
+        QVERIFY(copies.at(i).constData() != frame.constData());
+    }
+
+    // without an editor copies share the frame data again
+    CanFrame shared(frame);
+    QVERIFY(shared.constData() == frame.constData());
+}
+
+void tst_CanFrame::framePool()
+{
+    const int frameCount = 32;
+
+    CanFrame::reservePool(4 * frameCount);
+    CanFrame::resetPoolStatistics();
+    const CanFramePoolStatistics before = CanFrame::poolStatistics();
+    QCOMPARE(before.hits, quint64(0));
+    QCOMPARE(before.misses, quint64(0));
+    QVERIFY(before.pooledFrames >= 4 * frameCount);
+
+    {
+        QVector<CanFrame> frames;
+        for (int i = 0; i < frameCount; ++i)
+            frames.append(CanFrame(CanFrame::DataFrame));
+
+        const CanFramePoolStatistics during = CanFrame::poolStatistics();
+        QCOMPARE(during.hits, quint64(frameCount));
+        QCOMPARE(during.misses, quint64(0));
+        QCOMPARE(during.framesInUse, before.framesInUse + frameCount);
+        QVERIFY(during.peakFramesInUse >= during.framesInUse);
+    }
+
+    // the memory of destroyed frames stays pooled
+    const CanFramePoolStatistics after = CanFrame::poolStatistics();
+    QCOMPARE(after.framesInUse, before.framesInUse);
+    QCOMPARE(after.pooledFrames, before.pooledFrames);
+}
+
+void tst_CanFrame::frameView()
+{
+    // a classic frame with metadata followed by an FD frame, as buffered by the socket
+    struct can_frame canFrame;
+    ::memset(&canFrame, 0, sizeof(canFrame));
+    canFrame.can_id = 0x123;
+    canFrame.can_dlc = 2;
+    canFrame.data[0] = 0x11;
+    canFrame.data[1] = 0x22;
+
+    QByteArray records(reinterpret_cast<const char *>(&canFrame), sizeof(canFrame));
+    records[6] = res0FromCanMtu(CAN_MTU);
+    records[7] = res1FromCanMtu(CAN_MTU) | CAN_RES1_TRAILER_FLAG;
+
+    CanFrameTrailer trailer;
+    ::memset(&trailer, 0, sizeof(trailer));
+    trailer.timestamp = Q_INT64_C(1476000000123456789);
+    trailer.timestampSource = CanFrame::HardwareTimestamp;
+    trailer.interfaceIndex = 3;
+    records.append(reinterpret_cast<const char *>(&trailer), sizeof(trailer));
+
+    struct canfd_frame fdFrame;
+    ::memset(&fdFrame, 0, sizeof(fdFrame));
+    fdFrame.can_id = 0x1abcdef | CAN_EFF_FLAG;
+    fdFrame.len = 12;
+    fdFrame.data[11] = 0x33;
+    QByteArray fdRecord(reinterpret_cast<const char *>(&fdFrame), sizeof(fdFrame));
+    fdRecord[6] = res0FromCanMtu(CANFD_MTU);
+    fdRecord[7] = res1FromCanMtu(CANFD_MTU);
+    records.append(fdRecord);
+
+    const CanFrameView view(records.constData());
+    QVERIFY(view.isValid());
+    QCOMPARE(view.frameType(), CanFrame::DataFrame);
+    QCOMPARE(view.canId(), 0x123u);
+    QCOMPARE(view.dataLength(), 2);
+    QCOMPARE(view.data()[1], char(0x22));
+    QCOMPARE(view.timestamp(), trailer.timestamp);
+    QCOMPARE(view.timestampSource(), CanFrame::HardwareTimestamp);
+    QCOMPARE(view.interfaceIndex(), 3);
+    QCOMPARE(view.size(), int(CAN_MTU + sizeof(trailer)));
+
+    // the view reads what a frame decoded from the record holds
+    const CanFrame frame = view.toCanFrame();
+    QVERIFY(frame.isDataFrame());
+    QCOMPARE(frame.canId(), view.canId());
+    QCOMPARE(frame.timestamp(), view.timestamp());
+
+    const CanFrameView fdView(records.constData() + view.size());
+    QCOMPARE(fdView.frameType(), CanFrame::FdFrame);
+    QCOMPARE(fdView.id(), uint(fdFrame.can_id));
+    QCOMPARE(fdView.canId(), 0x1abcdefu);
+    QCOMPARE(fdView.dataLength(), 12);
+    QCOMPARE(fdView.data()[11], char(0x33));
+    QVERIFY(fdView.data() >= records.constData());
+    QCOMPARE(fdView.timestampSource(), CanFrame::NoTimestamp);
+    QCOMPARE(fdView.size(), int(CANFD_MTU));
+
+    // an error flagged frame of the wrong length isn't a valid error frame
+    const quint32 errorId = 0x123 | CAN_ERR_FLAG;
+    ::memcpy(records.data(), &errorId, sizeof(errorId));
+    QCOMPARE(view.frameType(), CanFrame::UnknownFrame);
+    QVERIFY(!view.isValid());
+    QVERIFY(!CanFrameView().isValid());
+}
+
 QTEST_MAIN(tst_CanFrame)
 
 #include "tst_canframe.moc"
@@ -0,0 +1,6 @@
+QT = core testlib
+TARGET = tst_canframecodec
+
+QT += cansocket
+
+SOURCES += tst_canframecodec.cpp
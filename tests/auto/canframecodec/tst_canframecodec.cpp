@@ -0,0 +1,184 @@
+/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <QObject>
+#include <QString>
+#include <QtTest>
+
+#include <CanSocket/canframe.h>
+#include <CanSocket/canframecodec.h>
+
+#include <algorithm>
+
+static QVector<CanFrame> testFrames()
+{
+    QVector<CanFrame> frames;
+
+    CanFrame dataFrame(CanFrame::DataFrame);
+    dataFrame.setCanId(0x123);
+    dataFrame.setDataLength(3);
+    dataFrame.setData("\x11\x22\x33", 3);
+    frames << dataFrame;
+
+    CanFrame fdFrame(CanFrame::FdFrame);
+    fdFrame.setCanId(0x1abcdef);
+    fdFrame.setFrameFormat(CanFrame::ExtendedFrameFormat);
+    fdFrame.setDataLength(48);
+    fdFrame[47] = 0x47;
+    fdFrame.setFdFrameFlags(CanFrame::BitRateSwitchFlag);
+    fdFrame.setTimestamp(Q_INT64_C(1476000000123456789), CanFrame::HardwareTimestamp);
+    fdFrame.setInterfaceIndex(3);
+    frames << fdFrame;
+
+    CanFrame rtrFrame(CanFrame::RtrFrame);
+    rtrFrame.setCanId(0x7ff);
+    frames << rtrFrame;
+
+    CanFrame errorFrame(CanFrame::ErrorFrame);
+    errorFrame.setCanId(CanFrame::BusOffError);
+    frames << errorFrame;
+
+    CanFrame xlFrame(CanFrame::XlFrame);
+    xlFrame.setCanId(0x42);
+    xlFrame.setDataLength(1000);
+    xlFrame[999] = 0x55;
+    xlFrame.setSduType(0x03);
+    xlFrame.setVirtualCanId(0x07);
+    xlFrame.setAcceptanceField(0xcafe0001);
+    frames << xlFrame;
+
+    return frames;
+}
+
+static void compareFrames(const CanFrame &actual, const CanFrame &expected)
+{
+    QCOMPARE(actual.frameType(), expected.frameType());
+    QCOMPARE(actual.id(), expected.id());
+    QCOMPARE(actual.dataLength(), expected.dataLength());
+    QCOMPARE(QByteArray(actual.constData(), actual.dataLength()),
+             QByteArray(expected.constData(), expected.dataLength()));
+    QCOMPARE(actual.timestamp(), expected.timestamp());
+    QCOMPARE(actual.timestampSource(), expected.timestampSource());
+    QCOMPARE(actual.interfaceIndex(), expected.interfaceIndex());
+}
+
+class tst_CanFrameCodec : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void roundTrip();
+    void streamOperatorFormat();
+    void rejectedBlocks();
+};
+
+void tst_CanFrameCodec::roundTrip()
+{
+    const QVector<CanFrame> frames = testFrames();
+
+    QByteArray block;
+    QDataStream out(&block, QIODevice::WriteOnly);
+    QVERIFY(CanFrameCodec::writeFrames(out, frames));
+    // a second block with an invalid frame, which is skipped
+    QVERIFY(CanFrameCodec::writeFrames(out, QVector<CanFrame>() << CanFrame() << frames.first()));
+
+    QDataStream in(block);
+    QVector<CanFrame> read;
+    QVERIFY(CanFrameCodec::readFrames(in, &read));
+    QCOMPARE(read.size(), frames.size());
+    QVERIFY(CanFrameCodec::readFrames(in, &read));
+    QCOMPARE(read.size(), frames.size() + 1);
+    QVERIFY(in.atEnd());
+
+    for (int i = 0; i < frames.size(); ++i)
+        compareFrames(read.at(i), frames.at(i));
+    compareFrames(read.last(), frames.first());
+
+    QCOMPARE(read.at(4).sduType(), quint8(0x03));
+    QCOMPARE(read.at(4).virtualCanId(), quint8(0x07));
+    QCOMPARE(read.at(4).acceptanceField(), quint32(0xcafe0001));
+    QCOMPARE(read.at(1).fdFrameFlags(), CanFrame::CanFdFrameFlags(CanFrame::BitRateSwitchFlag));
+}
+
+void tst_CanFrameCodec::streamOperatorFormat()
+{
+    const QVector<CanFrame> frames = testFrames();
+
+    QByteArray legacy;
+    QDataStream out(&legacy, QIODevice::WriteOnly);
+    out.setByteOrder(static_cast<QDataStream::ByteOrder>(QSysInfo::ByteOrder));
+    for (const CanFrame &frame : frames)
+        out << frame;
+
+    QDataStream in(legacy);
+    in.setByteOrder(static_cast<QDataStream::ByteOrder>(QSysInfo::ByteOrder));
+    QVector<CanFrame> read;
+    QVERIFY(CanFrameCodec::readFrames(in, &read));
+    QCOMPARE(read.size(), frames.size());
+
+    // the stream operator doesn't write the receive metadata
+    for (int i = 0; i < frames.size(); ++i) {
+        QCOMPARE(read.at(i).frameType(), frames.at(i).frameType());
+        QCOMPARE(read.at(i).id(), frames.at(i).id());
+        QCOMPARE(read.at(i).dataLength(), frames.at(i).dataLength());
+    }
+}
+
+void tst_CanFrameCodec::rejectedBlocks()
+{
+    QByteArray block;
+    QDataStream out(&block, QIODevice::WriteOnly);
+    QVERIFY(CanFrameCodec::writeFrames(out, testFrames()));
+
+    // magic, version, header size, frame count and data size
+    const int versionOffset = 4;
+    const int dataSizeOffset = 12;
+
+    QByteArray newer = block;
+    const quint16 version = CanFrameCodec::CurrentVersion + 1;
+    ::memcpy(newer.data() + versionOffset, &version, sizeof(version));
+    QDataStream newerIn(newer);
+    QVector<CanFrame> read;
+    QVERIFY(!CanFrameCodec::readFrames(newerIn, &read));
+    QCOMPARE(newerIn.status(), QDataStream::ReadCorruptData);
+
+    QByteArray swapped = block;
+    std::reverse(swapped.begin(), swapped.begin() + 4);
+    QDataStream swappedIn(swapped);
+    QVERIFY(!CanFrameCodec::readFrames(swappedIn, &read));
+    QCOMPARE(swappedIn.status(), QDataStream::ReadCorruptData);
+
+    QByteArray truncated = block.left(block.size() - 1);
+    QDataStream truncatedIn(truncated);
+    QVERIFY(!CanFrameCodec::readFrames(truncatedIn, &read));
+    QCOMPARE(truncatedIn.status(), QDataStream::ReadPastEnd);
+
+    // a data size that cuts the last record
+    QByteArray cut = block;
+    quint32 dataSize;
+    ::memcpy(&dataSize, cut.constData() + dataSizeOffset, sizeof(dataSize));
+    --dataSize;
+    ::memcpy(cut.data() + dataSizeOffset, &dataSize, sizeof(dataSize));
+    QDataStream cutIn(cut);
+    QVERIFY(!CanFrameCodec::readFrames(cutIn, &read));
+    QVERIFY(read.isEmpty());
+}
+
+QTEST_MAIN(tst_CanFrameCodec)
+
+#include "tst_canframecodec.moc"
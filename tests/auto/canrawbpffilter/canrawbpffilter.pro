@@ -0,0 +1,6 @@
+QT = core testlib
+TARGET = tst_canrawbpffilter
+
+QT += cansocket
+
+SOURCES += tst_canrawbpffilter.cpp
@@ -0,0 +1,206 @@
+/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+
+#include <QObject>
+#include <QString>
+#include <QtTest>
+
+#include <CanSocket/canrawsocket.h>
+
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/filter.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Runs the compiled programs in the kernel on a datagram socket pair, whose
+// packets carry the same bytes as the skb of a CAN frame.
+class KernelFilter
+{
+public:
+    KernelFilter() { descriptors[0] = descriptors[1] = -1; }
+    ~KernelFilter()
+    {
+        if (descriptors[0] != -1) {
+            ::close(descriptors[0]);
+            ::close(descriptors[1]);
+        }
+    }
+
+    bool attach(const CanRawBpfFilter &filter)
+    {
+        if (::socketpair(AF_UNIX, SOCK_DGRAM, 0, descriptors) == -1
+                || ::fcntl(descriptors[1], F_SETFL, O_NONBLOCK) == -1)
+            return false;
+
+        QByteArray program = filter.program();
+        struct sock_fprog fprog;
+        fprog.len = program.size() / sizeof(struct sock_filter);
+        fprog.filter = reinterpret_cast<struct sock_filter *>(program.data());
+        return !program.isEmpty()
+                && ::setsockopt(descriptors[1], SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) == 0;
+    }
+
+    bool accepts(const struct can_frame &frame)
+    {
+        struct can_frame received;
+        if (::send(descriptors[0], &frame, sizeof(frame), 0) != sizeof(frame))
+            return false;
+        return ::recv(descriptors[1], &received, sizeof(received), 0) == sizeof(received);
+    }
+
+private:
+    int descriptors[2];
+};
+
+static struct can_frame makeFrame(uint canId, const QByteArray &data)
+{
+    struct can_frame frame;
+    ::memset(&frame, 0, sizeof(frame));
+    frame.can_id = canId;
+    frame.can_dlc = data.size();
+    ::memcpy(frame.data, data.constData(), data.size());
+    return frame;
+}
+
+class tst_CanRawBpfFilter : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void matches_data();
+    void matches();
+    void programMatchesReference();
+    void limits();
+};
+
+void tst_CanRawBpfFilter::matches_data()
+{
+    QTest::addColumn<CanRawBpfFilter>("filter");
+    QTest::addColumn<uint>("canId");
+    QTest::addColumn<QByteArray>("data");
+    QTest::addColumn<bool>("accepted");
+
+    CanRawBpfFilter mux;
+    mux.addRule(CanRawFilter(0x123, CAN_SFF_MASK),
+                QVector<CanRawDataPredicate>() << CanRawDataPredicate(0, 0x12));
+
+    QTest::newRow("mux match") << mux << 0x123u << QByteArray("\x12\x01", 2) << true;
+    QTest::newRow("mux other value") << mux << 0x123u << QByteArray("\x13\x01", 2) << false;
+    QTest::newRow("mux other id") << mux << 0x124u << QByteArray("\x12\x01", 2) << false;
+    QTest::newRow("mux no payload") << mux << 0x123u << QByteArray() << false;
+    QTest::newRow("error frame") << mux << uint(CAN_ERR_FLAG | CAN_ERR_BUSOFF) << QByteArray(8, 0) << true;
+
+    CanRawBpfFilter masked;
+    masked.addRule(CanRawFilter(0x100, 0x700),
+                   QVector<CanRawDataPredicate>() << CanRawDataPredicate(2, 0x01, 0x0f)
+                                                  << CanRawDataPredicate(3, 0xff, 0xff, CanRawDataPredicate::NotEqual));
+
+    QTest::newRow("masked match") << masked << 0x1abu << QByteArray("\0\0\xf1\0", 4) << true;
+    QTest::newRow("masked not equal fails") << masked << 0x1abu << QByteArray("\0\0\xf1\xff", 4) << false;
+    QTest::newRow("masked short payload") << masked << 0x1abu << QByteArray("\0\0\x01", 3) << false;
+
+    CanRawBpfFilter inverted(CanRawFilterArray(1, CanRawFilter(0x200 | CAN_INV_FILTER, CAN_SFF_MASK)));
+
+    QTest::newRow("inverted match") << inverted << 0x201u << QByteArray(1, 0) << true;
+    QTest::newRow("inverted reject") << inverted << 0x200u << QByteArray(1, 0) << false;
+
+    CanRawBpfFilter extended(CanRawFilterArray(1, CanRawFilter(0x12345678 | CAN_EFF_FLAG, CAN_EFF_MASK | CAN_EFF_FLAG)));
+
+    QTest::newRow("extended match") << extended << uint(0x12345678 | CAN_EFF_FLAG) << QByteArray() << true;
+    QTest::newRow("extended standard id") << extended << 0x678u << QByteArray() << false;
+}
+
+void tst_CanRawBpfFilter::matches()
+{
+    QFETCH(CanRawBpfFilter, filter);
+    QFETCH(uint, canId);
+    QFETCH(QByteArray, data);
+    QFETCH(bool, accepted);
+
+    const struct can_frame frame = makeFrame(canId, data);
+    QCOMPARE(filter.matches(reinterpret_cast<const char *>(&frame), sizeof(frame)), accepted);
+
+    KernelFilter kernelFilter;
+    QVERIFY(kernelFilter.attach(filter));
+    QCOMPARE(kernelFilter.accepts(frame), accepted);
+}
+
+void tst_CanRawBpfFilter::programMatchesReference()
+{
+    qsrand(1);
+
+    for (int round = 0; round < 100; ++round) {
+        CanRawBpfFilter filter;
+        const int rules = qrand() % 4 + 1;
+        for (int i = 0; i < rules; ++i) {
+            uint id = qrand() % 0x800;
+            uint mask = (qrand() % 2) ? CAN_SFF_MASK : 0x700;
+            if (qrand() % 4 == 0) {
+                id |= CAN_EFF_FLAG;
+                mask |= CAN_EFF_FLAG;
+            }
+            if (qrand() % 5 == 0)
+                id |= CAN_INV_FILTER;
+
+            QVector<CanRawDataPredicate> predicates;
+            for (int j = qrand() % 3; j > 0; --j) {
+                predicates << CanRawDataPredicate(qrand() % CAN_MAX_DLEN, qrand() % 4,
+                                                  (qrand() % 2) ? 0xff : 0x03,
+                                                  (qrand() % 3) ? CanRawDataPredicate::Equal
+                                                                : CanRawDataPredicate::NotEqual);
+            }
+            filter.addRule(CanRawFilter(id, mask), predicates);
+        }
+
+        KernelFilter kernelFilter;
+        QVERIFY(kernelFilter.attach(filter));
+
+        for (int i = 0; i < 200; ++i) {
+            uint canId = qrand() % 0x800;
+            if (qrand() % 4 == 0)
+                canId = (qrand() & CAN_EFF_MASK) | CAN_EFF_FLAG;
+
+            QByteArray data(qrand() % (CAN_MAX_DLEN + 1), Qt::Uninitialized);
+            for (int j = 0; j < data.size(); ++j)
+                data[j] = qrand() % 4;
+
+            const struct can_frame frame = makeFrame(canId, data);
+            QCOMPARE(kernelFilter.accepts(frame),
+                     filter.matches(reinterpret_cast<const char *>(&frame), sizeof(frame)));
+        }
+    }
+}
+
+void tst_CanRawBpfFilter::limits()
+{
+    QVERIFY(CanRawBpfFilter().program().isEmpty());
+
+    CanRawBpfFilter tooManyPredicates;
+    tooManyPredicates.addRule(CanRawFilter(), QVector<CanRawDataPredicate>(51, CanRawDataPredicate(0, 1)));
+    QVERIFY(tooManyPredicates.program().isEmpty());
+
+    CanRawBpfFilter badOffset;
+    badOffset.addRule(CanRawFilter(), QVector<CanRawDataPredicate>() << CanRawDataPredicate(CANFD_MAX_DLEN, 1));
+    QVERIFY(badOffset.program().isEmpty());
+}
+
+QTEST_MAIN(tst_CanRawBpfFilter)
+
+#include "tst_canrawbpffilter.moc"
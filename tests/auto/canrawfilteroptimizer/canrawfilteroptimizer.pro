@@ -0,0 +1,6 @@
+QT = core testlib
+TARGET = tst_canrawfilteroptimizer
+
+QT += cansocket
+
+SOURCES += tst_canrawfilteroptimizer.cpp
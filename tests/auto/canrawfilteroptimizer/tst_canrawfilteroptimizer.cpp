@@ -0,0 +1,146 @@
+/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+
+#include <QObject>
+#include <QString>
+#include <QtTest>
+
+#include <CanSocket/canrawsocket.h>
+
+#include <linux/can.h>
+
+// what the kernel does with a CAN_RAW_FILTER array
+static bool kernelAccepts(const CanRawFilterArray &filters, uint canId)
+{
+    for (int i = 0; i < filters.size(); ++i) {
+        const CanRawFilter &filter = filters.constData()[i];
+        const uint mask = filter.filterMask() & ~CAN_ERR_FLAG;
+        const bool match = (canId & mask) == (filter.filterId() & mask);
+        if ((filter.filterId() & CAN_INV_FILTER) ? !match : match)
+            return true;
+    }
+    return false;
+}
+
+// every standard id, plus extended and rtr variants of it
+static QVector<uint> testIds()
+{
+    QVector<uint> ids;
+    for (uint id = 0; id <= CAN_SFF_MASK; ++id) {
+        ids << id << (id | CAN_RTR_FLAG) << (id | CAN_EFF_FLAG) << (id | 0x40000 | CAN_EFF_FLAG);
+    }
+    return ids;
+}
+
+static CanRawFilterArray randomFilters(int count)
+{
+    CanRawFilterArray filters;
+    for (int i = 0; i < count; ++i) {
+        if (qrand() % 10 == 0)
+            filters.append(CanRawFilter((qrand() % 0x800) | CAN_EFF_FLAG, CAN_EFF_MASK | CAN_EFF_FLAG));
+        else
+            filters.append(CanRawFilter(qrand() % 0x800, CAN_SFF_MASK));
+    }
+    filters.append(CanRawFilter(0x555, 0x700));
+    return filters;
+}
+
+class tst_CanRawFilterOptimizer : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void exactCover();
+    void overAcceptance();
+    void kernelHashedFiltersAreKept();
+};
+
+void tst_CanRawFilterOptimizer::exactCover()
+{
+    qsrand(1);
+    const QVector<uint> ids = testIds();
+
+    for (int round = 0; round < 10; ++round) {
+        const CanRawFilterArray filters = randomFilters(50 + qrand() % 250);
+
+        CanRawFilterOptimizer optimizer;
+        const CanRawFilterArray optimized = optimizer.optimize(filters);
+
+        QCOMPARE(optimizer.originalFilterCount(), filters.size());
+        QCOMPARE(optimizer.filterCount(), optimized.size());
+        QVERIFY(optimized.size() <= filters.size());
+        QCOMPARE(optimizer.falsePositiveRate(), qreal(0));
+        QVERIFY(!optimizer.needsPostFilter());
+
+        for (uint id : ids)
+            QCOMPARE(kernelAccepts(optimized, id), kernelAccepts(filters, id));
+    }
+}
+
+void tst_CanRawFilterOptimizer::overAcceptance()
+{
+    qsrand(2);
+    const QVector<uint> ids = testIds();
+
+    for (int round = 0; round < 10; ++round) {
+        const CanRawFilterArray filters = randomFilters(50 + qrand() % 250);
+
+        CanRawFilterOptimizer exact;
+        const int exactCount = exact.optimize(filters).size();
+
+        CanRawFilterOptimizer optimizer(0.25);
+        const CanRawFilterArray optimized = optimizer.optimize(filters);
+
+        QVERIFY(optimized.size() <= exactCount);
+        QVERIFY(optimizer.falsePositiveRate() <= 0.25 / 1.25);
+
+        for (uint id : ids) {
+            const bool accepted = kernelAccepts(filters, id);
+            if (accepted)
+                QVERIFY(kernelAccepts(optimized, id));
+            if (kernelAccepts(optimized, id))
+                QCOMPARE(optimizer.accepts(id), accepted);
+        }
+    }
+}
+
+void tst_CanRawFilterOptimizer::kernelHashedFiltersAreKept()
+{
+    const uint fullMask = CAN_SFF_MASK | CAN_EFF_FLAG | CAN_RTR_FLAG;
+
+    CanRawFilterArray filters;
+    filters.append(CanRawFilter(0x100, fullMask));
+    filters.append(CanRawFilter(0x101, fullMask));
+
+    CanRawFilterOptimizer optimizer;
+    QCOMPARE(optimizer.optimize(filters), filters);
+
+    CanRawFilterArray plain;
+    plain.append(CanRawFilter(0x100, CAN_SFF_MASK));
+    plain.append(CanRawFilter(0x101, CAN_SFF_MASK));
+
+    const CanRawFilterArray merged = optimizer.optimize(plain);
+    QCOMPARE(merged.size(), 1);
+    QCOMPARE(merged.constData()[0].filterId(), 0x100u);
+    QCOMPARE(merged.constData()[0].filterMask(), uint(CAN_SFF_MASK & ~1));
+}
+
+QTEST_MAIN(tst_CanRawFilterOptimizer)
+
+#include "tst_canrawfilteroptimizer.moc"
@@ -0,0 +1,4 @@
+QT = core testlib cansocket
+TARGET = tst_canrawsocket
+
+SOURCES += tst_canrawsocket.cpp
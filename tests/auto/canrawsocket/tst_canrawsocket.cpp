@@ -0,0 +1,245 @@
+/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <QObject>
+#include <QString>
+#include <QtTest>
+
+#include <CanSocket/canrawsocket.h>
+#include <CanSocket/canframe.h>
+
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <errno.h>
+#include <unistd.h>
+
+static const uint OldId = 0x100;   // accepted by the old filters only
+static const uint NewId = 0x200;   // accepted by the new filters only
+static const uint SharedId = 0x300; // accepted by both
+static const uint StopId = 0x7ff;   // accepted by every filter set, ends a test
+
+static const int SentFrames = 6000;
+static const int GroupCount = 3;
+
+static inline uint frameId(int sequence)
+{
+    static const uint ids[GroupCount] = {OldId, NewId, SharedId};
+    return ids[sequence % GroupCount];
+}
+
+// Sends the frames one after the other, each with its sequence number as
+// payload, then the stop frame.
+class Sender : public QThread
+{
+public:
+    explicit Sender(int descriptor) : failed(false), descriptor(descriptor) {}
+
+    bool failed;
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        struct can_frame frame;
+        ::memset(&frame, 0, sizeof(frame));
+        frame.can_dlc = sizeof(quint32);
+
+        for (int i = 0; i < SentFrames; ++i) {
+            frame.can_id = frameId(i);
+            const quint32 sequence = i;
+            ::memcpy(frame.data, &sequence, sizeof(sequence));
+            if (!send(frame))
+                return;
+            // paced so the receive queues don't overrun on a loaded machine,
+            // the filters change while the frames are sent
+            ::usleep(50);
+        }
+
+        frame.can_id = StopId;
+        send(frame);
+    }
+
+private:
+    bool send(const struct can_frame &frame)
+    {
+        // the vcan queue may be full for a moment
+        while (::write(descriptor, &frame, sizeof(frame)) != sizeof(frame)) {
+            if (errno != ENOBUFS) {
+                failed = true;
+                return false;
+            }
+            ::usleep(100);
+        }
+        return true;
+    }
+
+    int descriptor;
+};
+
+class tst_CanRawSocket : public QObject
+{
+    Q_OBJECT
+
+public:
+    tst_CanRawSocket();
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void losslessFilterTransition_data();
+    void losslessFilterTransition();
+
+private:
+    static CanRawFilterArray filterSet(uint id);
+
+    QString interfaceName;
+    int sender;
+};
+
+tst_CanRawSocket::tst_CanRawSocket()
+    : interfaceName(QString::fromLocal8Bit(qgetenv("CANSOCKET_TEST_INTERFACE")))
+    , sender(-1)
+{
+    if (interfaceName.isEmpty())
+        interfaceName = QStringLiteral("vcan0");
+}
+
+void tst_CanRawSocket::initTestCase()
+{
+    struct ifreq ifr;
+    struct sockaddr_can addr;
+
+    sender = ::socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (sender == -1)
+        QSKIP("CAN sockets are not supported");
+
+    ::strncpy(ifr.ifr_name, interfaceName.toLocal8Bit().constData(), IFNAMSIZ - 1);
+    ifr.ifr_name[IFNAMSIZ - 1] = '\0';
+    if (::ioctl(sender, SIOCGIFINDEX, &ifr) == -1)
+        QSKIP("Test interface is not available, set CANSOCKET_TEST_INTERFACE");
+
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    QVERIFY(::bind(sender, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0);
+}
+
+void tst_CanRawSocket::cleanupTestCase()
+{
+    if (sender != -1)
+        ::close(sender);
+}
+
+// the frames of id, the shared frames and the stop frame
+CanRawFilterArray tst_CanRawSocket::filterSet(uint id)
+{
+    CanRawFilterArray filter;
+    if (id != 0)
+        filter.append(CanRawFilter(id, CAN_SFF_MASK));
+    filter.append(CanRawFilter(SharedId, CAN_SFF_MASK));
+    filter.append(CanRawFilter(StopId, CAN_SFF_MASK));
+    return filter;
+}
+
+void tst_CanRawSocket::losslessFilterTransition_data()
+{
+    QTest::addColumn<bool>("queued");
+
+    QTest::newRow("one transition") << false;
+    // the second filter waits for the transition to the first one
+    QTest::newRow("queued transition") << true;
+}
+
+/*
+    Sends frames without a break while the filters change. The frames of
+    both filter sets have to arrive exactly once and in order, the frames of
+    the old filters up to the transition and those of the new filters from
+    then on, without a gap.
+*/
+void tst_CanRawSocket::losslessFilterTransition()
+{
+    QFETCH(bool, queued);
+
+    CanRawSocket socket;
+    socket.setFilterTransition(CanRawSocket::LosslessFilterTransition);
+    socket.setReceiveBufferSize(1024 * 1024);
+    socket.setCanFilter(filterSet(OldId));
+    QVERIFY(socket.connectToInterface(interfaceName, QIODevice::ReadOnly));
+
+    QVector<quint32> received[GroupCount];
+    QVector<quint32> sequences;
+    bool stopped = false;
+    QEventLoop loop;
+
+    connect(&socket, &QIODevice::readyRead, &loop, [&]() {
+        CanFrame frames[64];
+        qint64 count;
+        while ((count = socket.readFrames(frames, 64)) > 0) {
+            for (int i = 0; i < count; ++i) {
+                if (frames[i].canId() == StopId) {
+                    stopped = true;
+                    loop.quit();
+                    continue;
+                }
+                quint32 sequence;
+                ::memcpy(&sequence, frames[i].constData(), sizeof(sequence));
+                sequences.append(sequence);
+                received[sequence % GroupCount].append(sequence);
+            }
+        }
+    });
+
+    QTimer::singleShot(100, &loop, [&]() {
+        if (queued)
+            socket.setCanFilter(filterSet(0));
+        socket.setCanFilter(filterSet(NewId));
+    });
+    QTimer::singleShot(30000, &loop, &QEventLoop::quit);
+
+    Sender senderThread(sender);
+    senderThread.start();
+    loop.exec();
+    senderThread.wait();
+
+    QVERIFY(!senderThread.failed);
+    QVERIFY(stopped);
+    QCOMPARE(socket.droppedFrames(), quint64(0));
+    QCOMPARE(socket.canFilter(), filterSet(NewId));
+
+    // in order and none twice
+    for (int i = 1; i < sequences.size(); ++i)
+        QVERIFY2(sequences.at(i) > sequences.at(i - 1), qPrintable(QString::number(sequences.at(i))));
+
+    // the frames accepted by both filter sets all arrive
+    QCOMPARE(received[2].size(), SentFrames / GroupCount);
+
+    // the old frames up to the transition, the new ones from then on
+    const QVector<quint32> &oldFrames = received[0];
+    const QVector<quint32> &newFrames = received[1];
+    QVERIFY(!oldFrames.isEmpty());
+    QVERIFY(!newFrames.isEmpty());
+    QVERIFY(oldFrames.last() < newFrames.first());
+    QCOMPARE(oldFrames.size(), int(oldFrames.last() / GroupCount + 1));
+    QCOMPARE(newFrames.size(), int((SentFrames - 1 - newFrames.first()) / GroupCount + 1));
+}
+
+QTEST_MAIN(tst_CanRawSocket)
+
+#include "tst_canrawsocket.moc"
@@ -0,0 +1,6 @@
+QT = core testlib cansocket-private
+TARGET = tst_canrawtransmitqueues
+
+QT += cansocket
+
+SOURCES += tst_canrawtransmitqueues.cpp
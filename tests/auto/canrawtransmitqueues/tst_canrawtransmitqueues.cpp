@@ -0,0 +1,214 @@
+/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <QObject>
+#include <QString>
+#include <QtTest>
+
+#include <CanSocket/canrawsocket.h>
+#include <private/canrawtransmitqueues_p.h>
+#include <linux/can.h>
+
+class tst_CanRawTransmitQueues : public QObject
+{
+    Q_OBJECT
+
+public:
+    tst_CanRawTransmitQueues();
+
+private Q_SLOTS:
+    void classOf_data();
+    void classOf();
+    void classFilters();
+    void dequeueOrder();
+    void dequeueBatch();
+    void statistics();
+    void clear();
+
+private:
+    static QByteArray record(quint32 id, quint8 data = 0);
+    static QVector<quint8> dequeued(QRingBuffer *buffer);
+};
+
+tst_CanRawTransmitQueues::tst_CanRawTransmitQueues()
+{
+}
+
+// classic frame record, tagged like CanRawSocket tags the frames it writes
+QByteArray tst_CanRawTransmitQueues::record(quint32 id, quint8 data)
+{
+    struct can_frame frame;
+    ::memset(&frame, 0, sizeof(frame));
+    frame.can_id = id;
+    frame.can_dlc = 1;
+    frame.data[0] = data;
+
+    QByteArray result(reinterpret_cast<const char *>(&frame), sizeof(frame));
+    result[6] = CAN_MAX_DLEN;
+    result[7] = CAN_MTU;
+    return result;
+}
+
+// the first data byte of every record in buffer, in the order they were dequeued
+QVector<quint8> tst_CanRawTransmitQueues::dequeued(QRingBuffer *buffer)
+{
+    QVector<quint8> result;
+    while (!buffer->isEmpty()) {
+        struct can_frame frame;
+        buffer->read(reinterpret_cast<char *>(&frame), sizeof(frame));
+        result.append(frame.data[0]);
+    }
+    return result;
+}
+
+void tst_CanRawTransmitQueues::classOf_data()
+{
+    QTest::addColumn<quint32>("id");
+    QTest::addColumn<int>("priorityClass");
+
+    QTest::newRow("standard 0x000") << quint32(0x000) << 0;
+    QTest::newRow("standard 0x0ff") << quint32(0x0ff) << 0;
+    QTest::newRow("standard 0x100") << quint32(0x100) << 1;
+    QTest::newRow("standard 0x4ff") << quint32(0x4ff) << 4;
+    QTest::newRow("standard 0x7ff") << quint32(0x7ff) << 7;
+    QTest::newRow("extended 0x00000000") << quint32(0x00000000 | CAN_EFF_FLAG) << 0;
+    QTest::newRow("extended 0x0003ffff") << quint32(0x0003ffff | CAN_EFF_FLAG) << 0;
+    QTest::newRow("extended 0x04000000") << quint32(0x04000000 | CAN_EFF_FLAG) << 1;
+    QTest::newRow("extended 0x1fffffff") << quint32(0x1fffffff | CAN_EFF_FLAG) << 7;
+}
+
+void tst_CanRawTransmitQueues::classOf()
+{
+    QFETCH(quint32, id);
+    QFETCH(int, priorityClass);
+
+    CanRawTransmitQueues queues;
+    QCOMPARE(queues.classOf(record(id).constData()), priorityClass);
+}
+
+void tst_CanRawTransmitQueues::classFilters()
+{
+    CanRawTransmitQueues queues;
+
+    CanRawTransmitClass exact;
+    exact.filter = CanRawFilter(0x7ff, CAN_SFF_MASK);
+    exact.priorityClass = 0;
+
+    CanRawTransmitClass range;
+    range.filter = CanRawFilter(0x700, 0x700);
+    range.priorityClass = 2;
+
+    queues.classes << exact << range;
+
+    // the first matching filter decides
+    QCOMPARE(queues.classOf(record(0x7ff).constData()), 0);
+    QCOMPARE(queues.classOf(record(0x7fe).constData()), 2);
+    // frames matching no filter fall back to their id
+    QCOMPARE(queues.classOf(record(0x5ff).constData()), 5);
+}
+
+void tst_CanRawTransmitQueues::dequeueOrder()
+{
+    CanRawTransmitQueues queues;
+    QVERIFY(queues.isEmpty());
+
+    const quint32 ids[] = {0x700, 0x100, 0x701, 0x000, 0x102, 0x001};
+    for (int i = 0; i < 6; ++i) {
+        const QByteArray frame = record(ids[i], i);
+        queues.enqueue(frame.constData(), frame.size(), 0);
+    }
+    QCOMPARE(queues.size(), qint64(6 * CAN_MTU));
+
+    QRingBuffer buffer;
+    QCOMPARE(queues.dequeue(&buffer, -1, 0), 6);
+    QVERIFY(queues.isEmpty());
+
+    // most urgent class first, in the order written within a class
+    QVector<quint8> expected;
+    expected << 3 << 5 << 1 << 4 << 0 << 2;
+    QCOMPARE(dequeued(&buffer), expected);
+}
+
+void tst_CanRawTransmitQueues::dequeueBatch()
+{
+    CanRawTransmitQueues queues;
+
+    for (int i = 0; i < 4; ++i) {
+        const QByteArray frame = record(0x300, i);
+        queues.enqueue(frame.constData(), frame.size(), 0);
+    }
+
+    QRingBuffer buffer;
+    QCOMPARE(queues.dequeue(&buffer, 3, 0), 3);
+    QCOMPARE(queues.size(), qint64(CAN_MTU));
+
+    // an urgent frame queued meanwhile goes ahead of the one left
+    const QByteArray urgent = record(0x000, 9);
+    queues.enqueue(urgent.constData(), urgent.size(), 0);
+
+    QCOMPARE(queues.dequeue(&buffer, 3, 0), 2);
+
+    QVector<quint8> expected;
+    expected << 0 << 1 << 2 << 9 << 3;
+    QCOMPARE(dequeued(&buffer), expected);
+}
+
+void tst_CanRawTransmitQueues::statistics()
+{
+    CanRawTransmitQueues queues;
+
+    const QByteArray first = record(0x200, 0);
+    const QByteArray second = record(0x200, 1);
+    queues.enqueue(first.constData(), first.size(), 100);
+    queues.enqueue(second.constData(), second.size(), 400);
+    QCOMPARE(queues.statistics[2].queuedFrames, qint64(2));
+
+    QRingBuffer buffer;
+    QCOMPARE(queues.dequeue(&buffer, 1, 1000), 1);
+    QCOMPARE(queues.statistics[2].frames, quint64(1));
+    QCOMPARE(queues.statistics[2].queuedFrames, qint64(1));
+    QCOMPARE(queues.statistics[2].totalDelay, qint64(900));
+    QCOMPARE(queues.statistics[2].maxDelay, qint64(900));
+
+    QCOMPARE(queues.dequeue(&buffer, 1, 1200), 1);
+    QCOMPARE(queues.statistics[2].frames, quint64(2));
+    QCOMPARE(queues.statistics[2].queuedFrames, qint64(0));
+    QCOMPARE(queues.statistics[2].totalDelay, qint64(1700));
+    QCOMPARE(queues.statistics[2].maxDelay, qint64(900));
+    QCOMPARE(queues.statistics[0].frames, quint64(0));
+}
+
+void tst_CanRawTransmitQueues::clear()
+{
+    CanRawTransmitQueues queues;
+
+    const QByteArray frame = record(0x600);
+    queues.enqueue(frame.constData(), frame.size(), 0);
+    queues.clear();
+
+    QVERIFY(queues.isEmpty());
+    QCOMPARE(queues.statistics[6].queuedFrames, qint64(0));
+
+    QRingBuffer buffer;
+    QCOMPARE(queues.dequeue(&buffer, -1, 0), 0);
+    QVERIFY(buffer.isEmpty());
+}
+
+QTEST_MAIN(tst_CanRawTransmitQueues)
+
+#include "tst_canrawtransmitqueues.moc"
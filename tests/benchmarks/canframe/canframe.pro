@@ -0,0 +1,4 @@
+QT = core testlib cansocket
+TARGET = tst_bench_canframe
+
+SOURCES += tst_bench_canframe.cpp
@@ -0,0 +1,231 @@
+/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <QObject>
+#include <QString>
+#include <QtTest>
+
+#include <CanSocket/canframe.h>
+#include <CanSocket/canframecodec.h>
+
+#include <linux/can.h>
+
+static const int StreamSize = 4096;
+
+// A bus carrying mostly classic frames, with FD, error and RTR frames mixed in.
+static QVector<CanFrame> mixedFrames()
+{
+    static const CanFrame::CanFrameType pattern[] = {
+        CanFrame::DataFrame, CanFrame::FdFrame, CanFrame::DataFrame, CanFrame::RtrFrame,
+        CanFrame::DataFrame, CanFrame::FdFrame, CanFrame::ErrorFrame, CanFrame::DataFrame
+    };
+    const int patternSize = sizeof(pattern) / sizeof(pattern[0]);
+
+    QVector<CanFrame> frames;
+    frames.reserve(StreamSize);
+    for (int i = 0; i < StreamSize; ++i) {
+        CanFrame frame(pattern[i % patternSize]);
+        frame.setCanId(0x100 + (i & 0xff));
+        frame.setDataLength(qMin(frame.maxDataLength(), i % 9));
+        frames.append(frame);
+    }
+    return frames;
+}
+
+class tst_Bench_CanFrame : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void classify();
+    void streamDecode();
+
+    void buildAndSend_data();
+    void buildAndSend();
+
+    void receiveDecodeForward_data();
+    void receiveDecodeForward();
+};
+
+// frame data taken from the pool, every construction and every copying detach
+static quint64 frameAllocations()
+{
+    const CanFramePoolStatistics statistics = CanFrame::poolStatistics();
+    return statistics.hits + statistics.misses;
+}
+
+void tst_Bench_CanFrame::classify()
+{
+    const QVector<CanFrame> frames = mixedFrames();
+    int counts[CanFrame::XlFrame + 1] = {};
+    qint64 maxLengths = 0;
+
+    // what a decoder asks of every frame before looking at its payload
+    QBENCHMARK {
+        for (const CanFrame &frame : frames) {
+            if (!frame.isValid())
+                continue;
+            ++counts[frame.frameType()];
+            maxLengths += frame.maxDataLength() + frame.maxDataTransferUnit();
+        }
+    }
+
+    QVERIFY(maxLengths > 0);
+    QVERIFY(counts[CanFrame::DataFrame] > 0);
+    QVERIFY(counts[CanFrame::FdFrame] > 0);
+    QVERIFY(counts[CanFrame::ErrorFrame] > 0);
+    QVERIFY(counts[CanFrame::RtrFrame] > 0);
+}
+
+void tst_Bench_CanFrame::streamDecode()
+{
+    const QVector<CanFrame> frames = mixedFrames();
+
+    QByteArray records;
+    QDataStream out(&records, QIODevice::WriteOnly);
+    out.setByteOrder(static_cast<QDataStream::ByteOrder>(QSysInfo::ByteOrder));
+    for (const CanFrame &frame : frames)
+        out << frame;
+
+    QVector<CanFrame> decoded(StreamSize);
+
+    QBENCHMARK {
+        QDataStream in(records);
+        in.setByteOrder(static_cast<QDataStream::ByteOrder>(QSysInfo::ByteOrder));
+        for (CanFrame &frame : decoded) {
+            in >> frame;
+            if (frame.frameType() == CanFrame::UnknownFrame)
+                QFAIL("invalid frame decoded");
+        }
+    }
+
+    for (int i = 0; i < StreamSize; ++i)
+        QCOMPARE(decoded.at(i).frameType(), frames.at(i).frameType());
+}
+
+void tst_Bench_CanFrame::buildAndSend_data()
+{
+    QTest::addColumn<bool>("editor");
+
+    QTest::newRow("setters") << false;
+    QTest::newRow("editor") << true;
+}
+
+void tst_Bench_CanFrame::buildAndSend()
+{
+    QFETCH(bool, editor);
+
+    const char payload[CAN_MAX_DLEN] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    QVector<CanFrame> outgoing;
+    outgoing.reserve(StreamSize);
+    QByteArray sent;
+    quint64 allocations = 0;
+
+    // frames are built one by one, queued and sent in batches
+    QBENCHMARK {
+        outgoing.clear();
+        const quint64 before = frameAllocations();
+        for (int i = 0; i < StreamSize; ++i) {
+            CanFrame frame(CanFrame::DataFrame);
+            if (editor) {
+                CanFrameEditor edit(frame);
+                edit.setCanId(0x100 + (i & 0xff));
+                edit.setDataLength(CAN_MAX_DLEN);
+                edit.setData(payload, CAN_MAX_DLEN);
+                edit[0] = char(i);
+            }
+            else {
+                frame.setCanId(0x100 + (i & 0xff));
+                frame.setDataLength(CAN_MAX_DLEN);
+                frame.setData(payload, CAN_MAX_DLEN);
+                frame[0] = char(i);
+            }
+            outgoing.append(std::move(frame));
+        }
+        allocations = frameAllocations() - before;
+
+        sent.clear();
+        QDataStream stream(&sent, QIODevice::WriteOnly);
+        CanFrameCodec::writeFrames(stream, outgoing);
+    }
+
+    qDebug("%.2f frame allocations per frame, %d constructions included",
+           double(allocations) / StreamSize, StreamSize);
+    QCOMPARE(outgoing.size(), StreamSize);
+    QCOMPARE(outgoing.last().constData()[0], char(StreamSize - 1));
+}
+
+void tst_Bench_CanFrame::receiveDecodeForward_data()
+{
+    QTest::addColumn<bool>("move");
+
+    QTest::newRow("copy") << false;
+    QTest::newRow("move") << true;
+}
+
+void tst_Bench_CanFrame::receiveDecodeForward()
+{
+    QFETCH(bool, move);
+
+    const QVector<CanFrame> frames = mixedFrames();
+    QByteArray received;
+    QDataStream out(&received, QIODevice::WriteOnly);
+    CanFrameCodec::writeFrames(out, frames);
+
+    QVector<CanFrame> decoded;
+    decoded.reserve(StreamSize);
+    QVector<CanFrame> forwarded;
+    forwarded.reserve(StreamSize);
+    quint64 allocations = 0;
+
+    // a gateway decoding a batch and forwarding the data frames with a new id
+    QBENCHMARK {
+        decoded.clear();
+        forwarded.clear();
+        const quint64 before = frameAllocations();
+
+        QDataStream in(received);
+        CanFrameCodec::readFrames(in, &decoded);
+        for (CanFrame &frame : decoded) {
+            if (!frame.isDataFrame())
+                continue;
+            if (move) {
+                {
+                    CanFrameEditor edit(frame);
+                    edit.setCanId(frame.canId() | 0x400);
+                }
+                forwarded.append(std::move(frame));
+            }
+            else {
+                CanFrame copy = frame;
+                copy.setCanId(frame.canId() | 0x400);
+                forwarded.append(copy);
+            }
+        }
+        allocations = frameAllocations() - before;
+    }
+
+    qDebug("%.2f frame allocations per received frame, %d forwarded",
+           double(allocations) / StreamSize, forwarded.size());
+    QVERIFY(!forwarded.isEmpty());
+    QVERIFY(forwarded.first().canId() & 0x400);
+}
+
+QTEST_MAIN(tst_Bench_CanFrame)
+
+#include "tst_bench_canframe.moc"
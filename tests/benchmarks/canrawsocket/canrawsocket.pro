@@ -0,0 +1,6 @@
+QT = core testlib cansocket
+TARGET = tst_bench_canrawsocket
+
+LIBS += -ldl
+
+SOURCES += tst_bench_canrawsocket.cpp
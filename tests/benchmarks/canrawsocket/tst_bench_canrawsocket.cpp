@@ -0,0 +1,537 @@
+/****************************************************************************
+* cansocket-qt.lib - Qt socketcan library
+* Copyright (C) 2016 Georgije Bosiger <gbosiger@gmail.com>
+*
+* This library is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published
+* by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this library. If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <QObject>
+#include <QString>
+#include <QtTest>
+
+#include <CanSocket/canrawsocket.h>
+#include <CanSocket/cancapturesocket.h>
+#include <CanSocket/cansocketreactor.h>
+#include <CanSocket/canframe.h>
+
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+// Receive syscalls issued on the socket under test are counted by interposing
+// the libc entry points the library uses.
+static int countedDescriptor = -1;
+static quint64 receiveSyscalls = 0;
+
+extern "C" ssize_t read(int fd, void *buf, size_t count)
+{
+    typedef ssize_t (*ReadFunction)(int, void *, size_t);
+    static ReadFunction realRead = reinterpret_cast<ReadFunction>(::dlsym(RTLD_NEXT, "read"));
+
+    if (fd == countedDescriptor)
+        ++receiveSyscalls;
+    return realRead(fd, buf, count);
+}
+
+extern "C" ssize_t recvmsg(int fd, struct msghdr *message, int flags)
+{
+    typedef ssize_t (*RecvmsgFunction)(int, struct msghdr *, int);
+    static RecvmsgFunction realRecvmsg = reinterpret_cast<RecvmsgFunction>(::dlsym(RTLD_NEXT, "recvmsg"));
+
+    if (fd == countedDescriptor)
+        ++receiveSyscalls;
+    return realRecvmsg(fd, message, flags);
+}
+
+extern "C" int recvmmsg(int fd, struct mmsghdr *messages, unsigned int length, int flags, struct timespec *timeout)
+{
+    typedef int (*RecvmmsgFunction)(int, struct mmsghdr *, unsigned int, int, struct timespec *);
+    static RecvmmsgFunction realRecvmmsg = reinterpret_cast<RecvmmsgFunction>(::dlsym(RTLD_NEXT, "recvmmsg"));
+
+    if (fd == countedDescriptor)
+        ++receiveSyscalls;
+    return realRecvmmsg(fd, messages, length, flags, timeout);
+}
+
+static const uint RequestId = 0x123;
+static const uint ResponseId = 0x321;
+static const uint StopId = 0x7ff;
+
+// Answers every request frame with a response frame on a blocking socket,
+// until the stop frame arrives.
+class Responder : public QThread
+{
+public:
+    explicit Responder(int descriptor) : descriptor(descriptor) {}
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        struct can_frame frame;
+        while (::read(descriptor, &frame, sizeof(frame)) == sizeof(frame) && frame.can_id != StopId) {
+            frame.can_id = ResponseId;
+            if (::write(descriptor, &frame, sizeof(frame)) != sizeof(frame))
+                break;
+        }
+    }
+
+private:
+    int descriptor;
+};
+
+class tst_Bench_CanRawSocket : public QObject
+{
+    Q_OBJECT
+
+public:
+    tst_Bench_CanRawSocket();
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void receive_data();
+    void receive();
+
+    void roundTrip_data();
+    void roundTrip();
+
+    void readFrames_data();
+    void readFrames();
+
+    void urgentFrame_data();
+    void urgentFrame();
+
+private:
+    void receiveCaptured();
+    bool sendBurst(int frames);
+    int openResponderSocket();
+
+    QString interfaceName;
+    int sender;
+};
+
+static const int BurstSize = 128;
+static const int Bursts = 200;
+static const int RoundTrips = 20000;
+static const int BulkFrames = 256;
+static const uint BulkId = 0x700;
+static const uint UrgentId = 0x010;
+
+tst_Bench_CanRawSocket::tst_Bench_CanRawSocket()
+    : interfaceName(QString::fromLocal8Bit(qgetenv("CANSOCKET_TEST_INTERFACE")))
+    , sender(-1)
+{
+    if (interfaceName.isEmpty())
+        interfaceName = QStringLiteral("vcan0");
+}
+
+void tst_Bench_CanRawSocket::initTestCase()
+{
+    struct ifreq ifr;
+    struct sockaddr_can addr;
+
+    sender = ::socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (sender == -1)
+        QSKIP("CAN sockets are not supported");
+
+    ::strncpy(ifr.ifr_name, interfaceName.toLocal8Bit().constData(), IFNAMSIZ - 1);
+    ifr.ifr_name[IFNAMSIZ - 1] = '\0';
+    if (::ioctl(sender, SIOCGIFINDEX, &ifr) == -1)
+        QSKIP("Test interface is not available, set CANSOCKET_TEST_INTERFACE");
+
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    QVERIFY(::bind(sender, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0);
+}
+
+void tst_Bench_CanRawSocket::cleanupTestCase()
+{
+    if (sender != -1)
+        ::close(sender);
+}
+
+void tst_Bench_CanRawSocket::receive_data()
+{
+    QTest::addColumn<CanAbstractSocket::IoBackend>("ioBackend");
+    QTest::addColumn<CanRawSocket::BatchedReceive>("batchedReceive");
+    QTest::addColumn<bool>("unbuffered");
+    QTest::addColumn<bool>("capture");
+    QTest::addColumn<bool>("reactor");
+
+    QTest::newRow("recvmsg") << CanAbstractSocket::NotifierIoBackend << CanRawSocket::DisabledBatchedReceive << false << false << false;
+    QTest::newRow("recvmmsg") << CanAbstractSocket::NotifierIoBackend << CanRawSocket::EnabledBatchedReceive << false << false << false;
+    QTest::newRow("recvmmsg-unbuffered") << CanAbstractSocket::NotifierIoBackend << CanRawSocket::EnabledBatchedReceive << true << false << false;
+    QTest::newRow("io_uring") << CanAbstractSocket::IoUringIoBackend << CanRawSocket::EnabledBatchedReceive << false << false << false;
+    QTest::newRow("thread") << CanAbstractSocket::ReceiveThreadIoBackend << CanRawSocket::EnabledBatchedReceive << false << false << false;
+    // readyRead() from the event loop through the epoll descriptor of a CanSocketReactor
+    QTest::newRow("reactor") << CanAbstractSocket::NotifierIoBackend << CanRawSocket::EnabledBatchedReceive << false << false << true;
+    // CanCaptureSocket, the frames are counted in the blocks of the ring
+    QTest::newRow("tpacket_v3") << CanAbstractSocket::NotifierIoBackend << CanRawSocket::EnabledBatchedReceive << false << true << false;
+}
+
+void tst_Bench_CanRawSocket::receive()
+{
+    QFETCH(CanAbstractSocket::IoBackend, ioBackend);
+    QFETCH(CanRawSocket::BatchedReceive, batchedReceive);
+    QFETCH(bool, unbuffered);
+    QFETCH(bool, capture);
+    QFETCH(bool, reactor);
+
+    if (capture) {
+        receiveCaptured();
+        return;
+    }
+
+    CanRawSocket socket;
+    socket.setIoBackend(ioBackend);
+    socket.setBatchedReceive(batchedReceive);
+
+    CanSocketReactor socketReactor;
+    if (reactor) {
+        QVERIFY(socketReactor.isValid());
+        QVERIFY(socketReactor.addSocket(&socket));
+    }
+
+    QVERIFY(socket.connectToInterface(interfaceName, unbuffered ? QIODevice::ReadOnly | QIODevice::Unbuffered
+                                                                : QIODevice::ReadOnly));
+
+    if (socket.ioBackend() != ioBackend)
+        QSKIP("I/O backend is not supported");
+
+    countedDescriptor = socket.socketDescriptor();
+    receiveSyscalls = 0;
+
+    QByteArray sink(BurstSize * CAN_MTU, Qt::Uninitialized);
+    qint64 receivedFrames = 0;
+    qint64 elapsed = 0;
+    QElapsedTimer timer;
+    qint64 frames = 0;
+    QEventLoop *burstLoop = Q_NULLPTR;
+
+    // unbuffered sockets are read while readyRead() is emitted, straight into the sink,
+    // sockets of the reactor when it is emitted from the event loop
+    if (unbuffered || reactor) {
+        connect(&socket, &QIODevice::readyRead, [&]() {
+            while (socket.bytesAvailable() > 0) {
+                const qint64 readBytes = socket.read(sink.data(), sink.size());
+                if (readBytes <= 0)
+                    break;
+                frames += readBytes / CAN_MTU;
+            }
+            if (burstLoop && frames >= BurstSize)
+                burstLoop->quit();
+        });
+    }
+
+    for (int burst = 0; burst < Bursts; ++burst) {
+        QVERIFY(sendBurst(BurstSize));
+
+        timer.start();
+        frames = 0;
+        if (reactor) {
+            QEventLoop loop;
+            burstLoop = &loop;
+            QTimer::singleShot(1000, &loop, SLOT(quit()));
+            loop.exec();
+            burstLoop = Q_NULLPTR;
+        }
+        else {
+            while (frames < BurstSize && socket.waitForReadyRead(1000)) {
+                if (!unbuffered)
+                    frames += socket.read(sink.data(), sink.size()) / CAN_MTU;
+            }
+        }
+        elapsed += timer.nsecsElapsed();
+
+        QCOMPARE(frames, qint64(BurstSize));
+        receivedFrames += frames;
+    }
+
+    countedDescriptor = -1;
+
+    qDebug("%.3f receive syscalls per frame, %llu frames dropped by the kernel",
+           double(receiveSyscalls) / receivedFrames, socket.droppedFrames());
+    if (ioBackend == CanAbstractSocket::ReceiveThreadIoBackend) {
+        qDebug("%llu frames dropped, %lld bytes queued at most",
+               socket.receiveQueueDroppedFrames(), socket.receiveQueueHighWaterMark());
+    }
+    QTest::setBenchmarkResult(receivedFrames * 1e9 / elapsed, QTest::FramesPerSecond);
+}
+
+void tst_Bench_CanRawSocket::receiveCaptured()
+{
+    CanCaptureSocket socket;
+    // a burst doesn't fill a block, it is handed over when the block times out
+    socket.setBlockTimeout(1);
+    if (!socket.connectToInterface(interfaceName))
+        QSKIP("Packet sockets need CAP_NET_RAW");
+
+    qint64 receivedFrames = 0;
+    qint64 elapsed = 0;
+    QElapsedTimer timer;
+
+    for (int burst = 0; burst < Bursts; ++burst) {
+        QVERIFY(sendBurst(BurstSize));
+
+        timer.start();
+        // the ring also sees the sent frames, depending on the device more than once
+        qint64 frames = 0;
+        while (frames < BurstSize) {
+            CanCaptureBlock block = socket.nextBlock();
+            if (!block.isValid()) {
+                QVERIFY(socket.waitForReadyRead(1000));
+                continue;
+            }
+            for (CanCaptureFrame frame = block.firstFrame(); frame.isValid(); frame = frame.next())
+                ++frames;
+            socket.releaseBlock(block);
+        }
+        elapsed += timer.nsecsElapsed();
+
+        receivedFrames += frames;
+    }
+
+    qDebug("%llu frames dropped by the kernel", socket.droppedFrames());
+    QTest::setBenchmarkResult(receivedFrames * 1e9 / elapsed, QTest::FramesPerSecond);
+}
+
+void tst_Bench_CanRawSocket::roundTrip_data()
+{
+    QTest::addColumn<CanAbstractSocket::IoBackend>("ioBackend");
+    QTest::addColumn<int>("busyPoll");
+    QTest::addColumn<bool>("flush");
+
+    QTest::newRow("notifier") << CanAbstractSocket::NotifierIoBackend << 0 << true;
+    QTest::newRow("busy-poll") << CanAbstractSocket::NotifierIoBackend << 1000 << true;
+    // the request leaves in write(), without write-through it waits for the socket to be selected
+    QTest::newRow("write-through") << CanAbstractSocket::NotifierIoBackend << 0 << false;
+}
+
+void tst_Bench_CanRawSocket::roundTrip()
+{
+    QFETCH(CanAbstractSocket::IoBackend, ioBackend);
+    QFETCH(int, busyPoll);
+    QFETCH(bool, flush);
+
+    const int responderDescriptor = openResponderSocket();
+    QVERIFY(responderDescriptor != -1);
+    Responder responder(responderDescriptor);
+    responder.start(QThread::TimeCriticalPriority);
+
+    CanRawSocket socket;
+    socket.setIoBackend(ioBackend);
+    socket.setBusyPoll(busyPoll);
+    // keeps the spinning thread off the cpu of the test and the responder
+    if (busyPoll > 0 && QThread::idealThreadCount() > 2)
+        socket.setBusyPollCpu(QThread::idealThreadCount() - 1);
+    QVERIFY(socket.connectToInterface(interfaceName, QIODevice::ReadWrite));
+
+    // the filter is applied to the connected socket, only responses are received
+    const CanRawFilterArray responseFilter(1, CanRawFilter(ResponseId, CAN_SFF_MASK));
+    socket.setCanFilter(responseFilter);
+    QVERIFY(socket.canFilter() == responseFilter);
+
+    struct can_frame request;
+    ::memset(&request, 0, sizeof(request));
+    request.can_id = RequestId;
+    request.can_dlc = CAN_MAX_DLEN;
+    // frame type tags of the library, see res0FromCanMtu() and res1FromCanMtu()
+    reinterpret_cast<char *>(&request)[6] = CAN_MAX_DLEN;
+    reinterpret_cast<char *>(&request)[7] = CAN_MTU;
+
+    QVector<qint64> latencies;
+    latencies.reserve(RoundTrips);
+    char response[CAN_MTU];
+    QElapsedTimer timer;
+
+    for (int i = 0; i < RoundTrips; ++i) {
+        timer.start();
+        QCOMPARE(socket.write(reinterpret_cast<const char *>(&request), sizeof(request)), qint64(sizeof(request)));
+        if (flush)
+            socket.flush();
+        while (socket.bytesAvailable() < CAN_MTU)
+            QVERIFY(socket.waitForReadyRead(1000));
+        QCOMPARE(socket.read(response, sizeof(response)), qint64(sizeof(response)));
+        latencies.append(timer.nsecsElapsed());
+    }
+
+    struct can_frame stop;
+    ::memset(&stop, 0, sizeof(stop));
+    stop.can_id = StopId;
+    QVERIFY(::write(sender, &stop, sizeof(stop)) == sizeof(stop));
+    responder.wait();
+    ::close(responderDescriptor);
+
+    std::sort(latencies.begin(), latencies.end());
+    const auto percentile = [&latencies](double p) {
+        return latencies.at(qMin(latencies.size() - 1, int(p * latencies.size())));
+    };
+
+    qDebug("round trip p50 %.1f us, p99 %.1f us, p99.9 %.1f us",
+           percentile(0.5) / 1e3, percentile(0.99) / 1e3, percentile(0.999) / 1e3);
+    QTest::setBenchmarkResult(percentile(0.99), QTest::WalltimeNanoseconds);
+}
+
+void tst_Bench_CanRawSocket::readFrames_data()
+{
+    QTest::addColumn<bool>("dataStream");
+
+    QTest::newRow("QDataStream") << true;
+    QTest::newRow("readFrames") << false;
+}
+
+void tst_Bench_CanRawSocket::readFrames()
+{
+    QFETCH(bool, dataStream);
+
+    CanRawSocket socket;
+    QVERIFY(socket.connectToInterface(interfaceName, QIODevice::ReadOnly));
+
+    QDataStream stream(&socket);
+    stream.setByteOrder(static_cast<QDataStream::ByteOrder>(QSysInfo::ByteOrder));
+
+    QVector<CanFrame> frames(BurstSize);
+    qint64 decodedFrames = 0;
+    qint64 elapsed = 0;
+    QElapsedTimer timer;
+
+    for (int burst = 0; burst < Bursts; ++burst) {
+        QVERIFY(sendBurst(BurstSize));
+        while (socket.bytesAvailable() < BurstSize * qint64(CAN_MTU))
+            QVERIFY(socket.waitForReadyRead(1000));
+
+        // only the decoding of the buffered frames is measured
+        timer.start();
+        if (dataStream) {
+            for (int i = 0; i < BurstSize; ++i)
+                stream >> frames[i];
+        }
+        else {
+            QCOMPARE(socket.readFrames(frames.data(), BurstSize), qint64(BurstSize));
+        }
+        elapsed += timer.nsecsElapsed();
+
+        QCOMPARE(frames.at(BurstSize - 1).canId(), uint(0x100 + ((BurstSize - 1) & 0xff)));
+        QCOMPARE(frames.at(BurstSize - 1).frameType(), CanFrame::DataFrame);
+        decodedFrames += BurstSize;
+    }
+
+    QCOMPARE(socket.bytesAvailable(), qint64(0));
+    QTest::setBenchmarkResult(decodedFrames * 1e9 / elapsed, QTest::FramesPerSecond);
+}
+
+void tst_Bench_CanRawSocket::urgentFrame_data()
+{
+    QTest::addColumn<CanRawSocket::TransmitScheduling>("scheduling");
+
+    QTest::newRow("fifo") << CanRawSocket::FifoTransmitScheduling;
+    QTest::newRow("priority") << CanRawSocket::PriorityTransmitScheduling;
+}
+
+// counts the bulk frames that reach the bus before an urgent frame written after them
+void tst_Bench_CanRawSocket::urgentFrame()
+{
+    QFETCH(CanRawSocket::TransmitScheduling, scheduling);
+
+    struct can_frame frame;
+    while (::recv(sender, &frame, sizeof(frame), MSG_DONTWAIT) > 0)
+        ;
+
+    CanRawSocket socket;
+    socket.setTransmitScheduling(scheduling);
+    QVERIFY(socket.connectToInterface(interfaceName, QIODevice::WriteOnly));
+
+    QVector<CanFrame> bulk(BulkFrames, CanFrame(CanFrame::DataFrame));
+    for (int i = 0; i < BulkFrames; ++i)
+        bulk[i].setCanId(BulkId + (i & 0xff));
+    QCOMPARE(socket.writeFrames(bulk.constData(), BulkFrames), qint64(BulkFrames));
+
+    CanFrame urgent(CanFrame::DataFrame);
+    urgent.setCanId(UrgentId);
+    QCOMPARE(socket.writeFrames(&urgent, 1), qint64(1));
+
+    while (socket.bytesToWrite() > 0)
+        QVERIFY(socket.waitForBytesWritten(1000));
+
+    int framesAhead = -1;
+    for (int i = 0; i <= BulkFrames; ++i) {
+        QCOMPARE(::recv(sender, &frame, sizeof(frame), 0), ssize_t(sizeof(frame)));
+        if (frame.can_id == UrgentId)
+            framesAhead = i;
+    }
+    QVERIFY(framesAhead != -1);
+
+    if (scheduling == CanRawSocket::PriorityTransmitScheduling) {
+        const CanRawTransmitStatistics urgentClass = socket.transmitStatistics(0);
+        const CanRawTransmitStatistics bulkClass = socket.transmitStatistics(BulkId >> 8);
+        qDebug("queueing delay urgent %.1f us, bulk max %.1f us",
+               urgentClass.maxDelay / 1e3, bulkClass.maxDelay / 1e3);
+    }
+    QTest::setBenchmarkResult(framesAhead, QTest::Events);
+}
+
+int tst_Bench_CanRawSocket::openResponderSocket()
+{
+    struct ifreq ifr;
+    struct sockaddr_can addr;
+    struct can_filter filters[2] = {
+        { RequestId, CAN_SFF_MASK },
+        { StopId, CAN_SFF_MASK }
+    };
+
+    const int descriptor = ::socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (descriptor == -1)
+        return -1;
+
+    ::strncpy(ifr.ifr_name, interfaceName.toLocal8Bit().constData(), IFNAMSIZ - 1);
+    ifr.ifr_name[IFNAMSIZ - 1] = '\0';
+    if (::ioctl(descriptor, SIOCGIFINDEX, &ifr) == -1
+            || ::setsockopt(descriptor, SOL_CAN_RAW, CAN_RAW_FILTER, filters, sizeof(filters)) == -1) {
+        ::close(descriptor);
+        return -1;
+    }
+
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    if (::bind(descriptor, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == -1) {
+        ::close(descriptor);
+        return -1;
+    }
+    return descriptor;
+}
+
+bool tst_Bench_CanRawSocket::sendBurst(int frames)
+{
+    struct can_frame frame;
+    ::memset(&frame, 0, sizeof(frame));
+    frame.can_dlc = CAN_MAX_DLEN;
+
+    for (int i = 0; i < frames; ++i) {
+        frame.can_id = 0x100 + (i & 0xff);
+        if (::write(sender, &frame, sizeof(frame)) != sizeof(frame))
+            return false;
+    }
+    return true;
+}
+
+QTEST_MAIN(tst_Bench_CanRawSocket)
+
+#include "tst_bench_canrawsocket.moc"
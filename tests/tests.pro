@@ -1,2 +1,2 @@
 TEMPLATE = subdirs
-SUBDIRS += auto manual
+SUBDIRS += auto manual benchmarks